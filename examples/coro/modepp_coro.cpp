@@ -0,0 +1,151 @@
+// MoDe++ coroutine test-functions
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License:
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Demonstrates monitoring scripts as coroutine test-functions (see Coroutine test-functions in MoDePP.h).
+//  They run in the server-thread and suspend on timers, descriptors and calls of other test-functions.
+//  Usage: modepp_coro [port]              server with the functions below (default port 4545)
+//         modepp_coro scripts [n]         runs n scripts at once over a unix socket and reports their memory
+//                                         and time. Exit code is 1 if one of them fails
+//  Needs C++20, e.g.:
+//    g++ -std=c++20 -DUSING_BOOST_ASIO -I../../modepp_server -I../../modepp_client modepp_coro.cpp -o modepp_coro
+//        -lboost_thread -lboost_system -lpthread -lrt
+//
+#include "MoDePP.h"
+#include "MoDePPClient.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+MODEPP_BEGIN_TEST_FUNCTION2( add, a, b )
+        MODEPP_RETURN_TEST_FUNCTION( (int)a + (int)b )
+MODEPP_END_TEST_FUNCTION
+
+///Sends n heartbeats, one every ms milliseconds
+MODEPP_BEGIN_CORO_TEST_FUNCTION2( heartbeat, n, ms )
+        int i = 0;
+        while ( i < (int)n && co_await modeppSleep( (int)ms ) )
+                MODEPP_PROGRESS( "beat " << ++i )
+        MODEPP_RETURN_TEST_FUNCTION( i )
+MODEPP_END_CORO_TEST_FUNCTION
+
+///Reports size of a file (-1: missing) and each change of it till the call is cancelled
+MODEPP_BEGIN_CORO_TEST_FUNCTION2( watchFile, path, ms )
+        long long last = -2;
+        do
+        {
+                struct stat st;
+                long long size = stat( path.toString().c_str(), &st ) == 0 ? (long long)st.st_size : -1;
+                if ( size != last )
+                        MODEPP_PROGRESS( path.toString() << " " << size )
+                last = size;
+        }
+        while ( co_await modeppSleep( (int)ms ) );
+MODEPP_END_CORO_TEST_FUNCTION
+
+///Returns next line of standard input
+MODEPP_BEGIN_CORO_TEST_FUNCTION( readLine )
+        std::string line;
+        char c;
+        while ( co_await modeppReadable( 0 ) && read( 0, &c, 1 ) == 1 && c != '\n' )
+                line += c;
+        MODEPP_RETURN_TEST_FUNCTION( line )
+MODEPP_END_CORO_TEST_FUNCTION
+
+///Helper-coroutine, awaited by check
+static CoroTask settle( int ms, int & waited )
+{
+        unsigned long long start = modeppTimestamp();
+        co_await modeppSleep( ms );
+        waited = (int)( ( modeppTimestamp() - start ) / 1000000 );
+}
+
+///Awaits other test-functions and a helper
+MODEPP_BEGIN_CORO_TEST_FUNCTION2( check, a, b )
+        std::string sum = co_await modeppCall( "add", a, b );
+        std::string beats = co_await modeppCall( "heartbeat", 2, 10 );
+        int waited = 0;
+        co_await settle( 10, waited );
+        MODEPP_RETURN_TEST_FUNCTION( sum << ", " << beats << ", settled after " << waited << "ms" )
+MODEPP_END_CORO_TEST_FUNCTION
+
+///Counts returns and ends of calls
+struct Counter: IClientHandler
+{
+        unsigned long done, failed;
+        Counter():done(0),failed(0){}
+        void onReturn( unsigned int, const std::string & data ) { failed += data != "heartbeat 2"; }
+        void onCallDone( unsigned int, bool ) { ++done; }
+};
+
+///Resident memory of the process in kB
+static long residentKb()
+{
+        long pages = 0, resident = 0;
+        FILE * f = fopen( "/proc/self/statm", "r" );
+        if ( f && fscanf( f, "%ld %ld", &pages, &resident ) != 2 )
+                resident = 0;
+        if ( f )
+                fclose( f );
+        return resident * ( sysconf( _SC_PAGESIZE ) / 1024 );
+}
+
+int scripts( unsigned long n )
+{
+        char path[64];
+        sprintf( path, "/tmp/modepp_coro.%d", (int)getpid() );
+        MoDePP::instance().startLocal( path );
+        MoDePP::instance().startNow();
+        MoDePPClient client;
+        Counter counter;
+        client.setHandler( &counter );
+        for ( int i = 0; i < 50 && !client.connectLocal( path ); ++i )
+                usleep( 20000 );
+        if ( !client.connected() )
+        {
+                std::cerr << client.lastError() << std::endl;
+                return 1;
+        }
+        long before = residentKb();
+        unsigned long long start = modeppTimestamp();
+        std::vector<std::string> params;
+        params.push_back( "2" );
+        params.push_back( "500" );
+        for ( unsigned long i = 0; i < n; ++i )
+        {
+                client.callFunction( "heartbeat", params );
+                if ( i % 256 == 255 && ( !client.flush() || !client.poll( 0 ) ) )
+                        break;
+        }
+        client.flush();
+        while ( MoDePP::instance().coroutines().size() < n && client.poll( 10 ) ) {}
+        long during = residentKb();
+        printf( "%lu scripts suspended: %ld kB resident, %.0f bytes per script (client included)\n",
+                (unsigned long)MoDePP::instance().coroutines().size(), during - before, ( during - before ) * 1024.0 / n );
+        while ( counter.done < n && client.poll( 2000 ) ) {}
+        printf( "%lu done, %lu failed in %.0f ms\n", counter.done, counter.failed, ( modeppTimestamp() - start ) / 1e6 );
+        MoDePP::instance().stop();
+        unlink( path );
+        return counter.done == n && !counter.failed ? 0 : 1;
+}
+
+int main( int argc, char * argv[] )
+{
+        std::string mode = argc > 1 ? argv[1] : "";
+        if ( mode == "scripts" )
+                return scripts( argc > 2 ? strtoul( argv[2], 0, 10 ) : 10000 );
+        MoDePP::instance().start( argc > 1 ? (unsigned short)atoi( argv[1] ) : 4545 );
+        MoDePP::instance().startNow();
+        for (;;)
+                sleep( 1000 );
+        return 0;
+}
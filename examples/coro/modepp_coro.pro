@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = modepp_coro
+CONFIG += console
+CONFIG -= qt
+DEPENDPATH += . ../../modepp_server ../../modepp_client
+INCLUDEPATH += ../../modepp_server ../../modepp_client
+DEFINES += USING_BOOST_ASIO
+LIBS += -lboost_thread -lboost_system -lrt
+QMAKE_CXXFLAGS += -std=c++20
+
+# Input
+SOURCES += modepp_coro.cpp
+HEADERS += ../../modepp_server/MoDePP.h ../../modepp_client/MoDePPClient.h
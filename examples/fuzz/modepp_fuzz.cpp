@@ -0,0 +1,399 @@
+// MoDe++ fuzz and stress harness
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License:
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Exercises the message parser and dispatcher of the server (see Malformed data in MoDePP.h).
+//  Usage: modepp_fuzz fuzz [iterations] [seed]    mutates valid frames and feeds them in random pieces to the parser
+//         modepp_fuzz stress [threads] [seconds]  server on a unix socket: threads trace while a client pipelines
+//                                                 valid and malformed calls. Reports calls/s and traces/s
+//         modepp_fuzz bench [megabytes]           parse throughput of pipelined messages in MB/s and messages/s
+//         modepp_fuzz allocs [calls]              heap allocations of the server-thread per call and return, after
+//                                                 warm-up. Exit code is 1 if there are any
+//         modepp_fuzz rules                       rules nested too deep for the stack must be answered by an error,
+//                                                 the deepest allowed must evaluate. Exit code is 1 if one does not
+//  Build it with -fsanitize=address,undefined (g++ or clang++) in order to find memory errors and undefined
+//  behaviour, e.g.:
+//    g++ -g -O1 -fsanitize=address,undefined -DUSING_BOOST_ASIO -I../../modepp_server -I../../modepp_client
+//        modepp_fuzz.cpp -o modepp_fuzz -lboost_thread -lpthread -lrt
+//  With -DMODEPP_LIBFUZZER and clang++ -fsanitize=fuzzer,address it is a libFuzzer target instead of a program.
+//
+#define MODEPP_TRACK_ALLOCATIONS
+#include "MoDePP.h"
+#include "MoDePPClient.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+MODEPP_BEGIN_TEST_FUNCTION1( echo, text )
+        MODEPP_RETURN_TEST_FUNCTION( text )
+MODEPP_END_TEST_FUNCTION
+
+MODEPP_BEGIN_TEST_FUNCTION2( add, a, b )
+        MODEPP_RETURN_TEST_FUNCTION( (int)a + (int)b )
+MODEPP_END_TEST_FUNCTION
+
+///Allocations of the calling thread, the server-thread, so far
+MODEPP_BEGIN_TEST_FUNCTION( threadAllocs )
+        MODEPP_RETURN_TEST_FUNCTION( AllocTracker::threadCounters().allocs )
+MODEPP_END_TEST_FUNCTION
+
+///Parser of the server, as its transport sees it
+static ITransportHandler & server()
+{
+        return MoDePP::instance();
+}
+
+///Builds message with header
+static std::string frame( int cmd, const std::string & data )
+{
+        char hdr[HEADER_LEN+1];
+        sprintf( hdr, "%04x%04x", (unsigned int)data.length(), (unsigned int)cmd );
+        return hdr + data;
+}
+
+///Builds data of MsgCallFunctionId
+static std::string call( unsigned int id, const std::string & fname, const std::string & param )
+{
+        char hdr[CALL_ID_LEN+1];
+        sprintf( hdr, "%08x", id );
+        std::string data( hdr, CALL_ID_LEN );
+        std::vector<std::string> params( 1, param );
+        MoDePPClient::appendCall( data, fname, params );
+        return data;
+}
+
+///Valid frames of all commands the client sends, which don't start threads. The fuzzer mutates them
+static std::vector<std::string> seeds()
+{
+        std::vector<std::string> s;
+        s.push_back( frame( MsgGetVersion, "" ) );
+        s.push_back( frame( MsgListFunctions, "" ) );
+        s.push_back( frame( MsgGetFunctionList, "0123456789abcdef" ) );
+        s.push_back( frame( MsgHeartbeat, "" ) );
+        s.push_back( frame( MsgCallFunction, call( 0, "echo", "hello" ).substr( CALL_ID_LEN ) ) );
+        s.push_back( frame( MsgCallFunctionId, call( 1, "echo", "hello" ) ) );
+        s.push_back( frame( MsgCallFunctionId, call( 2, "echo", MoDePPClient::enumParam( 1 ) ) ) );
+        s.push_back( frame( MsgCallFunctionId, call( 3, "nosuch", "" ) ) );
+        s.push_back( frame( MsgCancel, "00000003" ) );
+        s.push_back( frame( MsgSetMetrics, "0" ) );
+        s.push_back( frame( MsgGetAllocStats, "3" ) );
+        s.push_back( frame( MsgAddRule, "00000004rss > 1 && trace ~ 'x'" ) );
+        s.push_back( frame( MsgAddRule, "00000005" + std::string( 100, '(' ) + "!!!1" + std::string( 100, ')' ) ) );
+        s.push_back( frame( 0x7777, "unknown" ) );
+        return s;
+}
+
+///Feeds data in pieces of random length, as the transport would after short reads
+static void feed( const std::string & data )
+{
+        server().onConnected();
+        for ( size_t pos = 0; pos < data.length(); )
+        {
+                size_t n = std::min<size_t>( 1 + rand() % 64, data.length() - pos );
+                server().onData( data.data() + pos, n );
+                pos += n;
+        }
+}
+
+///Changes a few bytes of the input: random bytes, digits of lengths, inserts, deletes and truncation
+static void mutate( std::string & d )
+{
+        static const char chars[] = "0123456789abcdefABCDEFxyz -\x01\xff";
+        for ( int m = 1 + rand() % 4; m > 0 && !d.empty(); --m )
+        {
+                size_t at = rand() % d.length();
+                switch ( rand() % 5 )
+                {
+                case 0: d[at] = (char)rand(); break;
+                case 1: d[at] = chars[rand() % ( sizeof(chars) - 1 )]; break;
+                case 2: d.insert( at, 1, chars[rand() % ( sizeof(chars) - 1 )] ); break;
+                case 3: d.erase( at, 1 ); break;
+                case 4: d.resize( at ); break;
+                }
+        }
+}
+
+#ifdef MODEPP_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput( const unsigned char * data, size_t size )
+{
+        server().onConnected();
+        server().onData( (const char *)data, size );
+        return 0;
+}
+#else
+
+static double seconds()
+{
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int fuzz( unsigned long iterations, unsigned int seed )
+{
+        srand( seed );
+        MODEPP_ADD_PARAM_ENUM( "text", 1 );
+        MODEPP_ADD_PARAM_ENUM( "text", 2 );
+        std::vector<std::string> s = seeds();
+        for ( unsigned long i = 0; i < iterations; ++i )
+        {
+                std::string d;
+                for ( int n = 1 + rand() % 8; n > 0; --n )
+                        d += s[rand() % s.size()];
+                mutate( d );
+                feed( d );
+        }
+        std::cout << iterations << " inputs, seed " << seed << ": ok" << std::endl;
+        return 0;
+}
+
+int bench( unsigned long megabytes )
+{
+        const char * names[] = { "heartbeat", "call" };
+        std::string msgs[] = { frame( MsgHeartbeat, "" ), frame( MsgCallFunctionId, call( 1, "nosuch", "parameter" ) ) };
+        for ( int k = 0; k < 2; ++k )
+        {
+                std::string chunk;
+                while ( chunk.length() < 65536 )
+                        chunk += msgs[k];
+                unsigned long count = chunk.length() / msgs[k].length();
+                unsigned long chunks = megabytes * 1048576 / chunk.length() + 1;
+                server().onConnected();
+                double start = seconds();
+                for ( unsigned long i = 0; i < chunks; ++i )
+                        server().onData( chunk.data(), chunk.length() );
+                double t = seconds() - start;
+                printf( "%-10s %8.1f MB/s %12.0f messages/s\n", names[k], chunks * chunk.length() / 1048576.0 / t, chunks * count / t );
+        }
+        return 0;
+}
+
+static volatile bool stopTracing = false;
+
+///Traces as fast as possible
+struct Tracer
+{
+        unsigned long * count;
+        Tracer( unsigned long * c ):count(c){}
+        void operator()()
+        {
+                char text[32];
+                while ( !stopTracing )
+                {
+                        sprintf( text, "stress %lu", ++*count );
+                        MODEPP_TRACE( text );
+                }
+                MODEPP_FLUSH_TRACES
+        }
+};
+
+///Counts responses of the stress client
+struct Counter: public IClientHandler
+{
+        unsigned long returns, invalid, traces;
+        std::string last;       ///<last return
+        Counter():returns(0),invalid(0),traces(0){}
+        void onReturn( unsigned int, const std::string & r )
+        {
+                ++returns;
+                last = r;
+                if ( r.compare( 0, 19, "Error! invalid call" ) == 0 )     //allocation counts may follow
+                        ++invalid;
+        }
+        void onTrace( const TraceRecord & ) { ++traces; }
+};
+
+///Starts server on a unix socket and connects client to it
+static bool connectServer( MoDePPClient & client, char path[64] )
+{
+        sprintf( path, "/tmp/modepp_fuzz.%d", (int)getpid() );
+        MoDePP::instance().startLocal( path );
+        MoDePP::instance().startNow();
+        for ( int i = 0; i < 50 && !client.connectLocal( path ); ++i )
+                usleep( 20000 );
+        if ( !client.connected() )
+                std::cerr << client.lastError() << std::endl;
+        return client.connected();
+}
+
+int stress( int threads, int duration )
+{
+        char path[64];
+        Counter counter;
+        MoDePPClient client( &counter );
+        if ( !connectServer( client, path ) )
+                return 1;
+        std::vector<unsigned long> traced( threads );
+        std::vector<modepp::thread*> tracers;
+        for ( int i = 0; i < threads; ++i )
+                tracers.push_back( new modepp::thread( Tracer( &traced[i] ) ) );
+
+        //90 valid and 10 malformed calls per round, at most one round in flight
+        unsigned long calls = 0, malformed = 0;
+        double start = seconds();
+        while ( seconds() - start < duration )
+        {
+                for ( int i = 0; i < 100; ++i )
+                {
+                        std::string data = call( ++calls, "echo", "stress" );
+                        if ( i % 10 == 9 )
+                        {
+                                data[CALL_ID_LEN+1] = 'f';      //name longer than message
+                                ++malformed;
+                        }
+                        client.queue( MsgCallFunctionId, data );
+                }
+                if ( !client.flush() )
+                        break;
+                while ( counter.returns < calls && client.poll( 1000 ) ) {}
+        }
+        double t = seconds() - start;
+        stopTracing = true;
+        unsigned long traces = 0;
+        for ( int i = 0; i < threads; ++i )
+        {
+                tracers[i]->join();
+                delete tracers[i];
+                traces += traced[i];
+        }
+        for ( int i = 0; i < 20 && client.poll( 50 ); ++i ) {}
+
+        //a header which is not hex must cost the connection
+        bool closed = ::write( client.fd(), "zzzzzzzz", HEADER_LEN ) == HEADER_LEN;
+        while ( closed && client.poll( 1000 ) ) {}
+        closed = closed && !client.connected();
+        printf( "%lu calls (%lu malformed) %.0f calls/s, %lu returns, %lu invalid\n", calls, malformed, calls / t, counter.returns, counter.invalid );
+        printf( "%d threads: %lu traces %.0f traces/s, %lu received\n", threads, traces, traces / t, counter.traces );
+        printf( "garbage header %s\n", closed ? "closed connection" : "did NOT close connection" );
+        MoDePP::instance().stop();
+        unlink( path );
+        return counter.returns == calls && counter.invalid == malformed && closed ? 0 : 1;
+}
+
+///Sends calls of echo and add, 100 in flight at most, and waits for their returns
+static bool calls( MoDePPClient & client, Counter & counter, unsigned long n )
+{
+        std::vector<std::string> echo( 1, "a parameter longer than a short string" ), add;
+        add.push_back( "1234" );
+        add.push_back( "-56" );
+        unsigned long sent = counter.returns;
+        for ( unsigned long i = 0; i < n; ++i )
+        {
+                if ( i % 2 )
+                        client.callFunction( "echo", echo );
+                else
+                        client.callFunction( "add", add );
+                if ( ++sent - counter.returns >= 100 || i + 1 == n )
+                {
+                        if ( !client.flush() )
+                                return false;
+                        while ( counter.returns < sent )
+                                if ( !client.poll( 1000 ) )
+                                        return false;
+                }
+        }
+        return true;
+}
+
+///Allocations of the server-thread so far
+static unsigned long long serverAllocs( MoDePPClient & client, Counter & counter )
+{
+        client.callFunction( "threadAllocs" );
+        client.flush();
+        unsigned long expected = counter.returns + 1;
+        while ( counter.returns < expected && client.poll( 1000 ) ) {}
+        return strtoull( counter.last.c_str() + strlen( "threadAllocs " ), 0, 10 );
+}
+
+int allocs( unsigned long n )
+{
+        char path[64];
+        Counter counter;
+        MoDePPClient client( &counter );
+        if ( !connectServer( client, path ) )
+                return 1;
+        calls( client, counter, 1000 );         //buffers grow to their size
+        serverAllocs( client, counter );
+        unsigned long long before = serverAllocs( client, counter );
+        bool ok = calls( client, counter, n );
+        unsigned long long after = serverAllocs( client, counter );
+        printf( "%lu calls: %llu allocations of the server-thread, %.3f per call\n", n, after - before, ( after - before ) / (double)n );
+        MoDePP::instance().stop();
+        unlink( path );
+        return ok && after == before ? 0 : 1;
+}
+
+///Sends rule and waits a second for its answer, empty if there is none
+static std::string addRule( MoDePPClient & client, Counter & counter, const std::string & rule )
+{
+        unsigned long expected = counter.returns + 1;
+        client.addRule( rule );
+        client.flush();
+        counter.last.clear();
+        for ( int i = 0; i < 20 && counter.returns < expected && client.poll( 50 ); ++i ) {}
+        return counter.last;
+}
+
+int rules()
+{
+        char path[64];
+        Counter counter;
+        MoDePPClient client( &counter );
+        if ( !connectServer( client, path ) )
+                return 1;
+        const char * nested[] = { "(", "!", "!(" };
+        bool ok = true;
+        for ( int i = 0; i < 3; ++i )
+        {
+                std::string rule;
+                while ( rule.length() < 30000 )        //as long as a message allows
+                        rule += nested[i];
+                std::string r = addRule( client, counter, rule + "1" );
+                printf( "%-5s x %lu %s\n", nested[i], (unsigned long)rule.length() / strlen( nested[i] ), r.c_str() );
+                ok = ok && r.find( "Error! invalid rule: nesting too deep" ) != std::string::npos;
+        }
+        //as deep as allowed compiles, the rule is not answered
+        std::string r = addRule( client, counter, std::string( 63, '(' ) + "0" + std::string( 63, ')' ) );
+        printf( "(     x 63 %s\n", r.empty() ? "compiled" : r.c_str() );
+        ok = ok && r.empty();
+        //right-nested at that depth needs two values per level on the stack, a true condition must hold
+        std::string deep;
+        for ( int i = 0; i < 63; ++i )
+                deep += "0 || 1 && (";
+        deep += "1" + std::string( 63, ')' );
+        RulePredicate p;
+        bool holds = p.compile( deep ) && p.evaluate( RulePredicate::Values(), 0, 0 );
+        printf( "0 || 1 && ( x 63 %s\n", holds ? "holds" : ( "fails " + p.error() ).c_str() );
+        ok = ok && holds;
+        MoDePP::instance().stop();
+        unlink( path );
+        return ok && client.connected() ? 0 : 1;
+}
+
+int main( int argc, char * argv[] )
+{
+        std::string mode = argc > 1 ? argv[1] : "";
+        if ( mode == "fuzz" )
+                return fuzz( argc > 2 ? strtoul( argv[2], 0, 10 ) : 100000, argc > 3 ? atoi( argv[3] ) : (unsigned int)time( 0 ) );
+        if ( mode == "bench" )
+                return bench( argc > 2 ? strtoul( argv[2], 0, 10 ) : 256 );
+        if ( mode == "stress" )
+                return stress( argc > 2 ? atoi( argv[2] ) : 4, argc > 3 ? atoi( argv[3] ) : 5 );
+        if ( mode == "allocs" )
+                return allocs( argc > 2 ? strtoul( argv[2], 0, 10 ) : 10000 );
+        if ( mode == "rules" )
+                return rules();
+        std::cerr << "Usage: modepp_fuzz fuzz [iterations] [seed] | stress [threads] [seconds] | bench [megabytes] | allocs [calls]"
+                  << " | rules" << std::endl;
+        return 2;
+}
+#endif
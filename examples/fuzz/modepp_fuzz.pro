@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = modepp_fuzz
+CONFIG += console
+CONFIG -= qt
+DEPENDPATH += . ../../modepp_server ../../modepp_client
+INCLUDEPATH += ../../modepp_server ../../modepp_client
+DEFINES += USING_BOOST_ASIO
+LIBS += -lboost_thread -lboost_system -lrt
+QMAKE_CXXFLAGS += -g -fsanitize=address,undefined
+QMAKE_LFLAGS += -fsanitize=address,undefined
+
+# Input
+SOURCES += modepp_fuzz.cpp
+HEADERS += ../../modepp_server/MoDePP.h ../../modepp_client/MoDePPClient.h
@@ -0,0 +1,173 @@
+// MoDe++ shared-memory agent
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License: 
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Local client for a program which started MoDe++ with MODEPP_START_SHM( "/name" ).
+//  Usage: shm_agent /name
+//  Prints all messages of the server. Lines from stdin are sent as commands:
+//    list                      - list test-functions
+//    <function> [<param>...]   - call test-function
+//    q                         - exit
+//
+#define MODEPP_INCLUDE_MESSAGE_TYPES_ONLY
+#include "MoDePP.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+ShmControl * ctl=0;
+char * outRing=0;
+char * inRing=0;
+
+///Builds message with header
+std::string message( int cmd, const std::string & data )
+{
+    char hdr[HEADER_LEN+1];
+    sprintf( hdr, "%04x%04x", (unsigned int)data.length(), cmd );
+    return hdr + data;
+}
+
+///Writes message to client-to-server ring
+bool put( const std::string & msg )
+{
+    unsigned long long head = ctl->inHead;
+    unsigned long long tail = shmLoad( ctl->inTail );
+    if ( ctl->inSize - ( head - tail ) < msg.length() )
+        return false;
+    for ( size_t i = 0; i < msg.length(); ++i )
+        inRing[ ( head + i ) % ctl->inSize ] = msg[i];
+    shmStore( ctl->inHead, head + msg.length() );
+    return true;
+}
+
+///Reads available data of server-to-client ring
+void get( std::string & data )
+{
+    unsigned long long head = shmLoad( ctl->outHead );
+    unsigned long long tail = ctl->outTail;
+    for ( ; tail != head; ++tail )
+        data += outRing[ tail % ctl->outSize ];
+    shmStore( ctl->outTail, tail );
+}
+
+void print( int cmd, const std::string & data )
+{
+    if ( cmd == MsgTraceBatch )
+    {
+        for ( size_t pos = 0; pos + TRACE_RECORD_HEADER_LEN <= data.length(); )
+        {
+            unsigned long long stamp = strtoull( data.substr( pos, 16 ).c_str(), 0, 16 );
+            unsigned long thread = strtoul( data.substr( pos+16, 8 ).c_str(), 0, 16 );
+            unsigned long seq = strtoul( data.substr( pos+24, 8 ).c_str(), 0, 16 );
+            unsigned long call = strtoul( data.substr( pos+32, 8 ).c_str(), 0, 16 );
+            size_t len = strtoul( data.substr( pos+40, 4 ).c_str(), 0, 16 );
+            std::cout << "TRC " << stamp << " [" << thread << ":" << seq << "] #" << call << ": "
+                      << data.substr( pos + TRACE_RECORD_HEADER_LEN, len ) << std::endl;
+            pos += TRACE_RECORD_HEADER_LEN + len;
+        }
+    }
+    else if ( cmd == MsgAddFunction ) std::cout << "FN: " << data << std::endl;
+    else if ( cmd == MsgReturn ) std::cout << "RET: " << data << std::endl;
+    else if ( cmd == MsgProgress ) std::cout << "PRG #" << strtoul( data.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 ) << ": " << data.substr( CALL_ID_LEN ) << std::endl;
+    else if ( cmd == MsgReturnId ) std::cout << "RET #" << strtoul( data.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 ) << ": " << data.substr( CALL_ID_LEN ) << std::endl;
+    else if ( cmd == MsgTrace ) std::cout << "TRC: " << data << std::endl;
+    else if ( cmd == MsgVersion ) std::cout << "VERSION: " << data << std::endl;
+    else std::cout << "MSG " << cmd << ": " << data << std::endl;
+}
+
+///Sends stdin-line as command
+void command( const std::string & line )
+{
+    std::istringstream words( line );
+    std::string fn, p;
+    if ( !( words >> fn ) )
+        return;
+    if ( fn == "list" )
+    {
+        put( message( MsgListFunctions, "" ) );
+        return;
+    }
+    char len[5];
+    sprintf( len, "%04x", (unsigned int)fn.length() );
+    std::string data = len + fn;
+    while ( words >> p )
+    {
+        sprintf( len, "%04x", (unsigned int)p.length() );
+        data += len + p;
+    }
+    put( message( MsgCallFunction, data ) );
+}
+
+int main( int argc, char *argv[] )
+{
+    if ( argc < 2 )
+    {
+        std::cerr << "Usage: shm_agent /name" << std::endl;
+        return 1;
+    }
+    int fd = shm_open( argv[1], O_RDWR, 0 );
+    struct stat st;
+    if ( fd < 0 || fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(ShmControl) )
+    {
+        std::cerr << "Can't open shared memory " << argv[1] << std::endl;
+        return 1;
+    }
+    void * seg = mmap( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    ctl = (ShmControl*)seg;
+    if ( seg == MAP_FAILED || shmLoad( ctl->magic ) != SHM_MAGIC )
+    {
+        std::cerr << "Not a MoDe++ segment " << argv[1] << std::endl;
+        return 1;
+    }
+    outRing = (char*)seg + sizeof(ShmControl);
+    inRing = outRing + ctl->outSize;
+
+    shmStore( ctl->outTail, shmLoad( ctl->outHead ) );
+    shmStore( ctl->inHead, shmLoad( ctl->inTail ) );
+    shmStore( ctl->attached, 1u );
+    put( message( MsgGetVersion, "" ) );
+
+    std::string data, line;
+    pollfd in = { 0, POLLIN, 0 };
+    bool running = true;
+    while ( running )
+    {
+        if ( poll( &in, 1, 1 ) > 0 )
+        {
+            if ( !std::getline( std::cin, line ) )
+                in.fd = -1;
+            else if ( line == "q" )
+                running = false;
+            else
+                command( line );
+        }
+        get( data );
+        size_t pos = 0;
+        while ( data.length() - pos >= HEADER_LEN )
+        {
+            int len = strtol( data.substr( pos, 4 ).c_str(), 0, 16 );
+            int cmd = strtol( data.substr( pos+4, 4 ).c_str(), 0, 16 );
+            if ( data.length() - pos - HEADER_LEN < (size_t)len )
+                break;
+            print( cmd, data.substr( pos + HEADER_LEN, len ) );
+            pos += HEADER_LEN + len;
+        }
+        data.erase( 0, pos );
+    }
+    shmStore( ctl->attached, 0u );
+    return 0;
+}
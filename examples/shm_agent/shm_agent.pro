@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = shm_agent
+CONFIG += console
+CONFIG -= qt
+DEPENDPATH += . ../../modepp_server
+INCLUDEPATH += ../../modepp_server
+LIBS += -lrt
+
+# Input
+SOURCES += shm_agent.cpp
+HEADERS += ../../modepp_server/MoDePP.h
@@ -0,0 +1,596 @@
+//
+// MoDe++ - Monitoring & Debugging of C++ code
+// Client library
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License: 
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// D E S C R I P T I O N
+// Headless client for MoDe++ servers implemented in single c++ header file (POSIX sockets, no other dependencies).
+// It uses the message definitions of MoDePP.h, so it always speaks the protocol of the server it is built with.
+//
+// Calls are pipelined: callFunction() and the other requests only append the message to the send-buffer.
+// The buffer is written by flush() or poll(), so many calls go out in one write without waiting for returns.
+// Each call gets a call-id, which comes back with its returns and traces, so they can be matched in any order.
+// Messages of the server are decoded incrementally by poll() and passed to an IClientHandler.
+//
+// Usage:
+//   struct Printer: IClientHandler { void onReturn( unsigned int id, const std::string & r ) { std::cout << r << std::endl; } };
+//   Printer p;
+//   MoDePPClient c( &p );
+//   c.connect( "127.0.0.1", 4545 );
+//   c.callFunction( "test_addition", params );
+//   while ( c.poll( 100 ) ) {}
+//
+
+#ifndef _MoDePPClient_HG_
+#define _MoDePPClient_HG_
+
+#define MODEPP_INCLUDE_MESSAGE_TYPES_ONLY //prevent including server implementation
+#include "MoDePP.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+///Trace-record of MsgTraceBatch
+struct TraceRecord
+{
+        unsigned long long timestamp;   ///<monotonic time of server in nanoseconds
+        unsigned int thread;            ///<MoDe++ thread-id
+        unsigned int seq;               ///<sequence-nr of record in its thread
+        unsigned int callId;            ///<call the thread was running or 0
+        std::string text;
+};
+
+///Receiver of server-messages. Default implementations ignore them.
+struct IClientHandler
+{
+        virtual void onVersion( const std::string & ) {}
+        virtual void onFunction( const std::string & /*name*/, const std::vector<std::string> & /*params*/ ) {}
+        ///Entry of MsgFunctionList. async: function runs in an own thread, may send progress and can be cancelled
+        virtual void onFunctionInfo( const std::string & name, const std::vector<std::string> & params, bool /*async*/ ) { onFunction( name, params ); }
+        ///Entry of MsgFunctionList: names of the valid values of parameters named param. Pass enumParam( index )
+        ///in a call to select one of them
+        virtual void onParamEnum( const std::string & /*param*/, const std::vector<std::string> & /*names*/ ) {}
+        ///Test-function was added (with params) or removed at runtime
+        virtual void onFunctionsChanged( bool /*added*/, const std::string & /*name*/, const std::vector<std::string> & /*params*/ ) {}
+        virtual void onTrace( const TraceRecord & ) {}
+        ///Return of test-function. callId is 0 if the function was called without id
+        virtual void onReturn( unsigned int /*callId*/, const std::string & ) {}
+        ///Partial result or progress of asynchronous call
+        virtual void onProgress( unsigned int /*callId*/, const std::string & ) {}
+        ///Asynchronous call is finished
+        virtual void onCallDone( unsigned int /*callId*/, bool /*cancelled*/ ) {}
+        ///Part of a dump: entries separated by newline
+        virtual void onDumpChunk( unsigned int /*callId*/, const std::string & ) {}
+        ///Process metrics, see MsgMetrics
+        virtual void onMetrics( const std::string & ) {}
+        ///Messages not handled by the methods above
+        virtual void onMessage( int /*cmd*/, const char * /*data*/, size_t /*len*/ ) {}
+        ///Server the next message comes from, when connected to a relay. Called with empty name after that message
+        virtual void onSource( const std::string & ) {}
+        ///Every message before it is handled. Return true if it is consumed, e.g. forwarded as it is
+        virtual bool onFrame( int /*cmd*/, const char * /*data*/, size_t /*len*/ ) { return false; }
+        virtual ~IClientHandler(){}
+};
+
+///Connection to a MoDe++ server
+class MoDePPClient
+{
+        int _fd;
+        IClientHandler * _handler;
+        std::string _out;       ///<messages not written yet
+        std::string _in;        ///<received data
+        size_t _inPos;          ///<start of first unprocessed message in _in
+        std::string _error;     ///<last error
+        unsigned int _nextCallId;
+        std::string _listCache; ///<cache-file of requested function-list
+        std::string _list;      ///<entries of function-list received so far
+        bool _sourced;          ///<MsgSource preceded current message
+
+        MoDePPClient(const MoDePPClient &);
+        MoDePPClient& operator=(const MoDePPClient &);
+
+        bool fail( const std::string & what )
+        {
+                _error = what + ": " + strerror( errno );
+                close();
+                return false;
+        }
+
+        ///Parses given number of hex digits. Returns -1 on invalid digit
+        static long long hex( const char * p, int digits )
+        {
+                long long v = 0;
+                for ( int i = 0; i < digits; ++i )
+                {
+                        char ch = p[i];
+                        int d;
+                        if ( ch >= '0' && ch <= '9' ) d = ch - '0';
+                        else if ( ch >= 'a' && ch <= 'f' ) d = ch - 'a' + 10;
+                        else if ( ch >= 'A' && ch <= 'F' ) d = ch - 'A' + 10;
+                        else return -1;
+                        v = ( v << 4 ) | d;
+                }
+                return v;
+        }
+
+        ///Splits text at spaces
+        static std::vector<std::string> words( const char * data, size_t len )
+        {
+                std::vector<std::string> w;
+                size_t start = 0;
+                for ( size_t i = 0; i <= len; ++i )
+                {
+                        if ( i == len || data[i] == ' ' )
+                        {
+                                if ( i > start )
+                                        w.push_back( std::string( data + start, i - start ) );
+                                start = i + 1;
+                        }
+                }
+                return w;
+        }
+
+        ///Reads hash and entries of cached function-list. Returns false if there is none
+        static bool readListCache( const std::string & file, std::string & hash, std::string & entries )
+        {
+                FILE * f = file.empty() ? 0 : fopen( file.c_str(), "rb" );
+                if ( !f )
+                        return false;
+                std::string text;
+                char buf[4096];
+                size_t n;
+                while ( ( n = fread( buf, 1, sizeof(buf), f ) ) > 0 )
+                        text.append( buf, n );
+                fclose( f );
+                if ( text.length() < 17 || text[16] != '\n' )
+                        return false;
+                hash = text.substr( 0, 16 );
+                entries = text.substr( 17 );
+                return true;
+        }
+
+        ///Handles part of MsgFunctionList. The complete list is taken from the server or from the cache-file
+        void functionList( const char * data, size_t len )
+        {
+                if ( len < 17 )
+                        return;
+                if ( !_list.empty() && len > 17 )
+                        _list += '\n';
+                _list.append( data + 17, len - 17 );
+                if ( data[16] != '1' )
+                        return;
+                std::string hash( data, 16 ), cachedHash, entries;
+                if ( _list.empty() && readListCache( _listCache, cachedHash, entries ) && cachedHash == hash )
+                        _list.swap( entries );
+                else if ( !_listCache.empty() )
+                {
+                        FILE * f = fopen( _listCache.c_str(), "wb" );
+                        if ( f )
+                        {
+                                fprintf( f, "%s\n", hash.c_str() );
+                                fwrite( _list.data(), 1, _list.length(), f );
+                                fclose( f );
+                        }
+                }
+                for ( size_t pos = 0; pos < _list.length(); )
+                {
+                        size_t end = _list.find( '\n', pos );
+                        if ( end == std::string::npos )
+                                end = _list.length();
+                        std::vector<std::string> w = words( _list.data() + pos, end - pos );
+                        if ( w.size() >= 2 && w[0] == "e" )
+                                _handler->onParamEnum( w[1], std::vector<std::string>( w.begin() + 2, w.end() ) );
+                        else if ( w.size() >= 2 )
+                                _handler->onFunctionInfo( w[1], std::vector<std::string>( w.begin() + 2, w.end() ), w[0] == "a" );
+                        pos = end + 1;
+                }
+                _list.clear();
+        }
+
+        ///Passes one message to the handler. Heartbeats are answered here
+        void dispatch( int cmd, const char * data, size_t len )
+        {
+                if ( cmd == MsgHeartbeat )
+                {
+                        queue( MsgHeartbeat, "" );
+                        return;
+                }
+                if ( !_handler )
+                        return;
+                if ( cmd == MsgSource )
+                {
+                        _sourced = true;
+                        _handler->onSource( std::string( data, len ) );
+                        return;
+                }
+                if ( !_handler->onFrame( cmd, data, len ) )
+                        handle( cmd, data, len );
+                if ( _sourced )
+                {
+                        _sourced = false;
+                        _handler->onSource( std::string() );
+                }
+        }
+
+        ///Passes message to matching method of the handler
+        void handle( int cmd, const char * data, size_t len )
+        {
+                if ( cmd == MsgTraceBatch )
+                {
+                        TraceRecord r;
+                        for ( size_t pos = 0; pos + TRACE_RECORD_HEADER_LEN <= len; )
+                        {
+                                const char * p = data + pos;
+                                long long tlen = hex( p + 40, 4 );
+                                if ( tlen < 0 || pos + TRACE_RECORD_HEADER_LEN + tlen > len )
+                                        break;
+                                r.timestamp = (unsigned long long)hex( p, 16 );
+                                r.thread = (unsigned int)hex( p + 16, 8 );
+                                r.seq = (unsigned int)hex( p + 24, 8 );
+                                r.callId = (unsigned int)hex( p + 32, 8 );
+                                r.text.assign( p + TRACE_RECORD_HEADER_LEN, tlen );
+                                _handler->onTrace( r );
+                                pos += TRACE_RECORD_HEADER_LEN + tlen;
+                        }
+                }
+                else if ( cmd == MsgTrace )
+                {
+                        TraceRecord r;
+                        r.timestamp = 0;
+                        r.thread = 0;
+                        r.seq = 0;
+                        r.callId = 0;
+                        r.text.assign( data, len );
+                        _handler->onTrace( r );
+                }
+                else if ( cmd == MsgReturn )
+                {
+                        _handler->onReturn( 0, std::string( data, len ) );
+                }
+                else if ( ( cmd == MsgReturnId || cmd == MsgProgress || cmd == MsgCallDone || cmd == MsgDumpChunk ) && len >= CALL_ID_LEN )
+                {
+                        long long id = hex( data, CALL_ID_LEN );
+                        unsigned int callId = id < 0 ? 0 : (unsigned int)id;
+                        std::string text( data + CALL_ID_LEN, len - CALL_ID_LEN );
+                        if ( cmd == MsgReturnId )
+                                _handler->onReturn( callId, text );
+                        else if ( cmd == MsgProgress )
+                                _handler->onProgress( callId, text );
+                        else if ( cmd == MsgDumpChunk )
+                                _handler->onDumpChunk( callId, text );
+                        else
+                                _handler->onCallDone( callId, text == "cancelled" );
+                }
+                else if ( cmd == MsgMetrics )
+                {
+                        _handler->onMetrics( std::string( data, len ) );
+                }
+                else if ( cmd == MsgVersion )
+                {
+                        _handler->onVersion( std::string( data, len ) );
+                }
+                else if ( cmd == MsgAddFunction || ( cmd == MsgFunctionsChanged && len > 0 ) )
+                {
+                        bool added = true;
+                        if ( cmd == MsgFunctionsChanged )
+                        {
+                                added = *data == '+';
+                                ++data;
+                                --len;
+                        }
+                        std::vector<std::string> w = words( data, len );
+                        if ( !w.empty() )
+                        {
+                                std::string name = w.front();
+                                w.erase( w.begin() );
+                                if ( cmd == MsgAddFunction )
+                                        _handler->onFunction( name, w );
+                                else
+                                        _handler->onFunctionsChanged( added, name, w );
+                        }
+                }
+                else if ( cmd == MsgFunctionList )
+                {
+                        functionList( data, len );
+                }
+                else
+                {
+                        _handler->onMessage( cmd, data, len );
+                }
+        }
+
+        ///Dispatches all complete messages of the receive-buffer. Returns false on invalid header
+        bool decode()
+        {
+                while ( _in.length() - _inPos >= HEADER_LEN )
+                {
+                        const char * p = _in.data() + _inPos;
+                        long long len = hex( p, 4 );
+                        long long cmd = hex( p + 4, 4 );
+                        if ( len < 0 || cmd < 0 )
+                        {
+                                _error = "invalid message header";
+                                close();
+                                return false;
+                        }
+                        if ( _in.length() - _inPos - HEADER_LEN < (size_t)len )
+                                break;
+                        _inPos += HEADER_LEN + len;
+                        dispatch( (int)cmd, p + HEADER_LEN, len );
+                }
+                _in.erase( 0, _inPos );
+                _inPos = 0;
+                return true;
+        }
+
+public:
+        MoDePPClient( IClientHandler * handler = 0 ):_fd(-1),_handler(handler),_inPos(0),_nextCallId(1),_sourced(false){}
+
+        ~MoDePPClient() { close(); }
+
+        void setHandler( IClientHandler * handler ) { _handler = handler; }
+
+        bool connected() const { return _fd >= 0; }
+
+        ///Socket, e.g. for polling many clients at once
+        int fd() const { return _fd; }
+
+        const std::string & lastError() const { return _error; }
+
+        ///Connects to TCP-server
+        bool connect( const std::string & host, unsigned short port )
+        {
+                close();
+                char service[8];
+                sprintf( service, "%u", port );
+                addrinfo hints = addrinfo();
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                addrinfo * res = 0;
+                int rc = getaddrinfo( host.c_str(), service, &hints, &res );
+                if ( rc != 0 )
+                {
+                        _error = std::string( "resolve " ) + host + ": " + gai_strerror( rc );
+                        return false;
+                }
+                for ( addrinfo * ai = res; ai && _fd < 0; ai = ai->ai_next )
+                {
+                        _fd = ::socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+                        if ( _fd >= 0 && ::connect( _fd, ai->ai_addr, ai->ai_addrlen ) < 0 )
+                        {
+                                ::close( _fd );
+                                _fd = -1;
+                        }
+                }
+                freeaddrinfo( res );
+                if ( _fd < 0 )
+                        return fail( "connect " + host );
+                int on = 1;
+                setsockopt( _fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+                return true;
+        }
+
+        ///Connects to server started by MODEPP_START_LOCAL
+        bool connectLocal( const std::string & path )
+        {
+                close();
+                sockaddr_un addr = sockaddr_un();
+                addr.sun_family = AF_UNIX;
+                if ( path.length() >= sizeof(addr.sun_path) )
+                {
+                        _error = "socket path too long: " + path;
+                        return false;
+                }
+                path.copy( addr.sun_path, path.length() );
+                _fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+                if ( _fd < 0 || ::connect( _fd, (sockaddr*)&addr, sizeof(addr) ) < 0 )
+                        return fail( "connect " + path );
+                return true;
+        }
+
+        void close()
+        {
+                if ( _fd >= 0 )
+                        ::close( _fd );
+                _fd = -1;
+                _out.clear();
+                _in.clear();
+                _inPos = 0;
+                _list.clear();
+                _sourced = false;
+        }
+
+        ///Appends message to the send-buffer
+        void queue( int cmd, const std::string & data )
+        {
+                char hdr[HEADER_LEN+1];
+                sprintf( hdr, "%04x%04x", (unsigned int)data.length(), (unsigned int)cmd );
+                _out.append( hdr, HEADER_LEN );
+                _out += data;
+        }
+
+        void getVersion() { queue( MsgGetVersion, "" ); }
+
+        void listFunctions() { queue( MsgListFunctions, "" ); }
+
+        ///Requests list of test-functions in one response (onFunctionInfo). With a cacheFile the list is kept in the
+        ///file and taken from there, if the server's functions did not change
+        void listFunctions( const std::string & cacheFile )
+        {
+                _listCache = cacheFile;
+                std::string hash, entries;
+                readListCache( cacheFile, hash, entries );
+                queue( MsgGetFunctionList, hash );
+        }
+
+        ///Queues dump of exposed object, without name the names of exposed objects are sent. Returns call-id
+        unsigned int dump( const std::string & name = std::string() )
+        {
+                unsigned int id = nextCallId();
+                char hdr[CALL_ID_LEN+1];
+                sprintf( hdr, "%08x", id );
+                queue( MsgDump, hdr + name );
+                return id;
+        }
+
+        ///Subscribes to process metrics every intervalMs, 0 stops them
+        void setMetricsInterval( unsigned int intervalMs )
+        {
+                char n[16];
+                sprintf( n, "%u", intervalMs );
+                queue( MsgSetMetrics, n );
+        }
+
+        ///Requests statistics of allocation tracking with given number of top allocation-sites (onMessage MsgAllocStats)
+        void getAllocStats( int topSites = 10 )
+        {
+                char n[16];
+                sprintf( n, "%d", topSites );
+                queue( MsgGetAllocStats, n );
+        }
+
+        ///Returns next call-id
+        unsigned int nextCallId()
+        {
+                unsigned int id = _nextCallId++;
+                if ( !_nextCallId )
+                        _nextCallId = 1;
+                return id;
+        }
+
+        ///Call-parameter selecting the enum-value of given index (see Parameter enums in MoDePP.h)
+        static std::string enumParam( unsigned int index )
+        {
+                char p[16];
+                sprintf( p, "%c%u", MODEPP_ENUM_PARAM, index );
+                return p;
+        }
+
+        ///Appends function-name and parameters in the format of MsgCallFunction
+        static void appendCall( std::string & data, const std::string & fname, const std::vector<std::string> & params )
+        {
+                char len[5];
+                sprintf( len, "%04x", (unsigned int)fname.length() );
+                data.append( len, 4 );
+                data += fname;
+                for ( size_t i = 0; i < params.size() && i < 5; ++i )
+                {
+                        sprintf( len, "%04x", (unsigned int)params[i].length() );
+                        data.append( len, 4 );
+                        data += params[i];
+                }
+        }
+
+        ///Queues call of test-function with up to 5 parameters. Returns call-id, which comes back with its returns
+        unsigned int callFunction( const std::string & fname, const std::vector<std::string> & params = std::vector<std::string>() )
+        {
+                unsigned int id = nextCallId();
+                char hdr[CALL_ID_LEN+1];
+                sprintf( hdr, "%08x", id );
+                std::string data( hdr, CALL_ID_LEN );
+                appendCall( data, fname, params );
+                queue( MsgCallFunctionId, data );
+                return id;
+        }
+
+        ///Queues load test of test-function: threads call it at given total rate per second (0: as fast as possible)
+        ///for durationMs. Statistics come as progress of the returned call-id. Returns 0 if threads exceed 0xffff,
+        ///the limit of the message
+        unsigned int loadTest( const std::string & fname, unsigned int threads, unsigned int rate, unsigned int durationMs,
+                               const std::vector<std::string> & params = std::vector<std::string>() )
+        {
+                if ( threads > 0xffff )
+                {
+                        _error = "invalid number of threads";
+                        return 0;
+                }
+                unsigned int id = nextCallId();
+                char hdr[CALL_ID_LEN+20+1];
+                sprintf( hdr, "%08x%04x%08x%08x", id, threads, rate, durationMs );
+                std::string data( hdr, CALL_ID_LEN + 20 );
+                appendCall( data, fname, params );
+                queue( MsgLoadTest, data );
+                return id;
+        }
+
+        ///Queues rule "<condition>[ => <action>]" (see Rules in MoDePP.h). Firings come as progress of the returned
+        ///call-id, cancel removes the rule
+        unsigned int addRule( const std::string & rule )
+        {
+                unsigned int id = nextCallId();
+                char hdr[CALL_ID_LEN+1];
+                sprintf( hdr, "%08x", id );
+                queue( MsgAddRule, hdr + rule );
+                return id;
+        }
+
+        ///Queues cancellation of asynchronous call
+        void cancel( unsigned int callId )
+        {
+                char id[CALL_ID_LEN+1];
+                sprintf( id, "%08x", callId );
+                queue( MsgCancel, id );
+        }
+
+        ///Writes send-buffer. Blocks till all is written
+        bool flush()
+        {
+                size_t done = 0;
+                while ( _fd >= 0 && done < _out.length() )
+                {
+                        ssize_t n = ::send( _fd, _out.data() + done, _out.length() - done, MSG_NOSIGNAL );
+                        if ( n < 0 )
+                        {
+                                if ( errno == EINTR )
+                                        continue;
+                                return fail( "send" );
+                        }
+                        done += n;
+                }
+                _out.clear();
+                return _fd >= 0;
+        }
+
+        ///Writes send-buffer, waits up to timeoutMs for data and dispatches all complete messages.
+        ///Returns false if the connection is closed.
+        bool poll( int timeoutMs )
+        {
+                if ( !flush() )
+                        return false;
+                pollfd pfd = { _fd, POLLIN, 0 };
+                int rc = ::poll( &pfd, 1, timeoutMs );
+                if ( rc < 0 )
+                        return errno == EINTR;
+                if ( rc == 0 )
+                        return true;
+                char buf[65536];
+                ssize_t n = ::recv( _fd, buf, sizeof(buf), 0 );
+                if ( n <= 0 )
+                {
+                        if ( n < 0 && errno == EINTR )
+                                return true;
+                        if ( n == 0 )
+                                errno = ECONNRESET;
+                        return fail( "recv" );
+                }
+                _in.append( buf, n );
+                return decode();
+        }
+};
+
+#endif //_MoDePPClient_HG_
@@ -0,0 +1,423 @@
+// MoDe++ command-line client
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License: 
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Headless client for scripts and CI. Connects to a MoDe++ server, sends commands and prints
+//  the messages of the server one per line.
+//  Usage: modepp_cli [options] [<command>]
+//    -H <host>     host of server (default 127.0.0.1)
+//    -p <port>     TCP-port of server (default 4545)
+//    -u <path>     unix domain socket of server (MODEPP_START_LOCAL)
+//    -f <file>     read commands from file, '-' for stdin
+//    -o <file>     write output to file instead of stdout
+//    -w <ms>       exit after server was silent for <ms> milliseconds (default 1000)
+//    -t            follow: keep printing traces until the server closes the connection
+//    -c <file>     cache the function-list in file, it is transferred again only if the functions changed
+//  Commands (one per line in a file, '#' starts a comment):
+//    list                      - list test-functions
+//    version                   - get version of server
+//    dump [<name>]             - dump exposed object, without name list exposed objects
+//    metrics <ms>              - get process metrics every <ms> milliseconds, 0 stops them
+//    allocs [<sites>]          - get statistics of allocation tracking with top allocation-sites (default 10)
+//    wait <ms>                 - send pending commands and print messages for <ms> milliseconds
+//    cancel <call-id>          - cancel asynchronous call or rule. Calls are numbered from 1 in order of commands
+//    rule <condition> [=> <action>]
+//                              - add rule evaluated by the server, e.g. rule "trace ~ 'error' => dump cache".
+//                                Firings come as PRG, quote text in the condition with ''
+//    load <function> <threads> <rate> <ms> [<param>...]
+//                              - run function from <threads> threads of the server at <rate> calls/s
+//                                (0: as fast as possible) for <ms> milliseconds. Statistics come as PRG
+//    <function> [<param>...]   - call test-function, quote parameters containing spaces with "".
+//                                A parameter %<n> selects the value with index n of the parameter's enum (ENUM)
+//  Commands between two waits are pipelined, i.e. sent in one write without waiting for returns.
+//  Output:
+//    VERSION <version>
+//    FN <function> [<param>...]
+//    ENUM <param> <value-name>...                       (valid values of parameters of that name, index from 0)
+//    CHG +<function> [<param>...] | -<function>           (function added or removed at runtime)
+//    RET #<call-id> <return-data>
+//    PRG #<call-id> <progress-data>
+//    DONE #<call-id> done|cancelled
+//    DMP #<call-id> <entry>
+//    MET <metrics>
+//    MSG <command> <data>      (other messages, e.g. allocation statistics)
+//    TRC <timestamp> [<thread>:<seq>] #<call-id>: <text>      (call-id only for traces of a call)
+//  Connected to modepp_relay, each line is preceded by "@<server> " of the server the message comes from.
+//
+#include "MoDePPClient.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <time.h>
+
+///Prints messages of server. Output is fully buffered and flushed when the server is idle
+struct Printer : IClientHandler
+{
+        FILE * out;
+        unsigned long messages;     ///<count of printed messages
+        std::string source;         ///<server of current message, when connected to a relay
+
+        Printer( FILE * f ):out(f),messages(0)
+        {
+                setvbuf( out, 0, _IOFBF, 1 << 20 );
+        }
+
+        void onSource( const std::string & s ) { source = s; }
+
+        ///Starts output-line, with the source of the message if any
+        void line()
+        {
+                if ( !source.empty() )
+                        fprintf( out, "@%s ", source.c_str() );
+        }
+
+        void onVersion( const std::string & v )
+        {
+                ++messages;
+                line();
+                fprintf( out, "VERSION %s\n", v.c_str() );
+        }
+
+        void onFunction( const std::string & name, const std::vector<std::string> & params )
+        {
+                ++messages;
+                line();
+                fputs( "FN ", out );
+                fputs( name.c_str(), out );
+                for ( size_t i = 0; i < params.size(); ++i )
+                {
+                        fputc( ' ', out );
+                        fputs( params[i].c_str(), out );
+                }
+                fputc( '\n', out );
+        }
+
+        void onParamEnum( const std::string & param, const std::vector<std::string> & names )
+        {
+                ++messages;
+                line();
+                fputs( "ENUM ", out );
+                fputs( param.c_str(), out );
+                for ( size_t i = 0; i < names.size(); ++i )
+                {
+                        fputc( ' ', out );
+                        fputs( names[i].c_str(), out );
+                }
+                fputc( '\n', out );
+        }
+
+        void onFunctionsChanged( bool added, const std::string & name, const std::vector<std::string> & params )
+        {
+                ++messages;
+                line();
+                fprintf( out, "CHG %c%s", added ? '+' : '-', name.c_str() );
+                for ( size_t i = 0; i < params.size(); ++i )
+                {
+                        fputc( ' ', out );
+                        fputs( params[i].c_str(), out );
+                }
+                fputc( '\n', out );
+        }
+
+        void onTrace( const TraceRecord & r )
+        {
+                ++messages;
+                line();
+                if ( r.callId )
+                        fprintf( out, "TRC %llu [%u:%u] #%u: ", r.timestamp, r.thread, r.seq, r.callId );
+                else
+                        fprintf( out, "TRC %llu [%u:%u]: ", r.timestamp, r.thread, r.seq );
+                fwrite( r.text.data(), 1, r.text.length(), out );
+                fputc( '\n', out );
+        }
+
+        void onReturn( unsigned int callId, const std::string & data )
+        {
+                ++messages;
+                line();
+                fprintf( out, "RET #%u ", callId );
+                fwrite( data.data(), 1, data.length(), out );
+                fputc( '\n', out );
+        }
+
+        void onProgress( unsigned int callId, const std::string & data )
+        {
+                ++messages;
+                line();
+                fprintf( out, "PRG #%u ", callId );
+                fwrite( data.data(), 1, data.length(), out );
+                fputc( '\n', out );
+        }
+
+        void onCallDone( unsigned int callId, bool cancelled )
+        {
+                ++messages;
+                line();
+                fprintf( out, "DONE #%u %s\n", callId, cancelled ? "cancelled" : "done" );
+        }
+
+        void onDumpChunk( unsigned int callId, const std::string & data )
+        {
+                ++messages;
+                for ( size_t pos = 0; pos < data.length(); )
+                {
+                        size_t end = data.find( '\n', pos );
+                        if ( end == std::string::npos )
+                                end = data.length();
+                        line();
+                        fprintf( out, "DMP #%u ", callId );
+                        fwrite( data.data() + pos, 1, end - pos, out );
+                        fputc( '\n', out );
+                        pos = end + 1;
+                }
+        }
+
+        void onMetrics( const std::string & data )
+        {
+                ++messages;
+                line();
+                fputs( "MET ", out );
+                fwrite( data.data(), 1, data.length(), out );
+                fputc( '\n', out );
+        }
+
+        void onMessage( int cmd, const char * data, size_t len )
+        {
+                ++messages;
+                line();
+                fprintf( out, "MSG %d ", cmd );
+                fwrite( data, 1, len, out );
+                fputc( '\n', out );
+        }
+};
+
+///Splits line into words. Words may be quoted with ""
+std::vector<std::string> split( const std::string & line )
+{
+        std::vector<std::string> words;
+        size_t i = 0;
+        while ( i < line.length() )
+        {
+                if ( isspace( (unsigned char)line[i] ) )
+                {
+                        ++i;
+                        continue;
+                }
+                if ( line[i] == '#' )
+                        break;
+                std::string w;
+                if ( line[i] == '"' )
+                {
+                        size_t end = line.find( '"', i + 1 );
+                        if ( end == std::string::npos )
+                                end = line.length();
+                        w = line.substr( i + 1, end - i - 1 );
+                        i = end + 1;
+                }
+                else
+                {
+                        size_t end = i;
+                        while ( end < line.length() && !isspace( (unsigned char)line[end] ) )
+                                ++end;
+                        w = line.substr( i, end - i );
+                        i = end;
+                }
+                words.push_back( w );
+        }
+        return words;
+}
+
+///Monotonic time in milliseconds
+static long long nowMs()
+{
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+///Prints messages of server for given time. Returns false if the connection is closed
+bool waitFor( MoDePPClient & client, Printer & printer, int ms )
+{
+        long long deadline = nowMs() + ms;
+        for ( long long left = ms; left > 0; left = deadline - nowMs() )
+        {
+                if ( !client.poll( (int)std::min( left, 10LL ) ) )
+                        return false;
+        }
+        fflush( printer.out );
+        return true;
+}
+
+///Prints messages of server until it was silent for idleMs (forever if idleMs < 0)
+bool drain( MoDePPClient & client, Printer & printer, int idleMs )
+{
+        long long lastMessage = nowMs();
+        while ( idleMs < 0 || nowMs() - lastMessage < idleMs )
+        {
+                unsigned long before = printer.messages;
+                bool ok = client.poll( 10 );
+                if ( printer.messages != before )
+                        lastMessage = nowMs();
+                else
+                        fflush( printer.out );
+                if ( !ok )
+                        break;
+        }
+        fflush( printer.out );
+        return client.connected();
+}
+
+///Parses decimal number up to max. Returns false for anything else, e.g. a sign or trailing characters
+static bool number( const std::string & word, unsigned long max, unsigned int & value )
+{
+        if ( word.empty() || !isdigit( (unsigned char)word[0] ) )
+                return false;
+        char * end = 0;
+        errno = 0;
+        unsigned long v = strtoul( word.c_str(), &end, 10 );
+        if ( *end || errno == ERANGE || v > max )
+                return false;
+        value = (unsigned int)v;
+        return true;
+}
+
+///Cache-file of the function-list (-c)
+static std::string listCache;
+
+///Queues one command. Returns false on error
+bool command( MoDePPClient & client, Printer & printer, const std::vector<std::string> & words )
+{
+        if ( words.empty() )
+                return true;
+        if ( words[0] == "list" )
+                client.listFunctions( listCache );
+        else if ( words[0] == "version" )
+                client.getVersion();
+        else if ( words[0] == "dump" )
+                client.dump( words.size() > 1 ? words[1] : std::string() );
+        else if ( words[0] == "metrics" && words.size() > 1 )
+                client.setMetricsInterval( atoi( words[1].c_str() ) );
+        else if ( words[0] == "allocs" )
+                client.getAllocStats( words.size() > 1 ? atoi( words[1].c_str() ) : 10 );
+        else if ( words[0] == "rule" && words.size() > 1 )
+        {
+                std::string rule;
+                for ( size_t i = 1; i < words.size(); ++i )
+                        rule += ( i > 1 ? " " : "" ) + words[i];
+                client.addRule( rule );
+        }
+        else if ( words[0] == "cancel" && words.size() > 1 )
+                client.cancel( (unsigned int)strtoul( words[1].c_str(), 0, 10 ) );
+        else if ( words[0] == "load" && words.size() >= 5 )
+        {
+                unsigned int threads, rate, ms;
+                if ( !number( words[2], 0xffff, threads ) || !number( words[3], 0xffffffffUL, rate ) || !number( words[4], 0xffffffffUL, ms ) )
+                {
+                        std::cerr << "invalid load: threads 0-65535, rate and ms 0-4294967295" << std::endl;
+                        return false;
+                }
+                if ( !client.loadTest( words[1], threads, rate, ms, std::vector<std::string>( words.begin() + 5, words.end() ) ) )
+                        return false;
+        }
+        else if ( words[0] == "wait" )
+                return waitFor( client, printer, words.size() > 1 ? atoi( words[1].c_str() ) : 0 );
+        else
+        {
+                std::vector<std::string> params( words.begin() + 1, words.end() );
+                for ( size_t i = 0; i < params.size(); ++i )
+                        if ( params[i].length() > 1 && params[i][0] == '%' && params[i].find_first_not_of( "0123456789", 1 ) == std::string::npos )
+                                params[i] = MoDePPClient::enumParam( atoi( params[i].c_str() + 1 ) );
+                client.callFunction( words[0], params );
+        }
+        return true;
+}
+
+void usage()
+{
+        std::cerr << "Usage: modepp_cli [-H host] [-p port | -u path] [-f script] [-o file] [-w ms] [-t] [-c file] [command]" << std::endl;
+}
+
+int main( int argc, char * argv[] )
+{
+        std::string host = "127.0.0.1";
+        std::string path;
+        std::string script;
+        std::string output;
+        int port = 4545;
+        int linger = 1000;
+        bool follow = false;
+        int opt;
+        while ( ( opt = getopt( argc, argv, "H:p:u:f:o:w:tc:" ) ) != -1 )
+        {
+                switch ( opt )
+                {
+                case 'H': host = optarg; break;
+                case 'p': port = atoi( optarg ); break;
+                case 'u': path = optarg; break;
+                case 'f': script = optarg; break;
+                case 'o': output = optarg; break;
+                case 'w': linger = atoi( optarg ); break;
+                case 't': follow = true; break;
+                case 'c': listCache = optarg; break;
+                default: usage(); return 2;
+                }
+        }
+
+        FILE * out = stdout;
+        if ( !output.empty() && !( out = fopen( output.c_str(), "w" ) ) )
+        {
+                perror( output.c_str() );
+                return 2;
+        }
+        Printer printer( out );
+        MoDePPClient client( &printer );
+        if ( !( path.empty() ? client.connect( host, (unsigned short)port ) : client.connectLocal( path ) ) )
+        {
+                std::cerr << client.lastError() << std::endl;
+                return 1;
+        }
+
+        bool ok = true;
+        if ( !script.empty() )
+        {
+                std::ifstream file;
+                if ( script != "-" )
+                {
+                        file.open( script.c_str() );
+                        if ( !file )
+                        {
+                                perror( script.c_str() );
+                                return 2;
+                        }
+                }
+                std::istream & in = script == "-" ? std::cin : file;
+                std::string line;
+                while ( ok && std::getline( in, line ) )
+                        ok = command( client, printer, split( line ) );
+        }
+        if ( ok && optind < argc )
+        {
+                std::vector<std::string> words( argv + optind, argv + argc );
+                ok = command( client, printer, words );
+        }
+        if ( ok )
+                ok = drain( client, printer, follow ? -1 : linger );
+        if ( !ok && !follow && !client.lastError().empty() )
+                std::cerr << client.lastError() << std::endl;
+        if ( out != stdout )
+                fclose( out );
+        return ok || follow ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+TEMPLATE = app
+TARGET = modepp_cli
+CONFIG += console
+CONFIG -= qt
+DEPENDPATH += . ../modepp_server
+INCLUDEPATH += ../modepp_server
+
+# Input
+SOURCES += modepp_cli.cpp
+HEADERS += MoDePPClient.h ../modepp_server/MoDePP.h
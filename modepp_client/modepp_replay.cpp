@@ -0,0 +1,310 @@
+// MoDe++ replay of recorded calls
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License:
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Turns a recorded debug session (MODEPP_RECORD, see Recording in MoDePP.h) into a regression test.
+//  Sends the calls of the log to a server again, compares their returns with the recorded ones and reports
+//  the latency of each function: recorded, replayed and the delta. Latency is the time from the call to its
+//  first return (or MsgCallDone). The recorded one is measured by the server, the replayed one by this
+//  client, so it includes the round-trip; for equal conditions record the replay too and compare the logs.
+//  Usage: modepp_replay [options] <log>
+//         modepp_replay -c <log> <log2>      compare two logs, calls are matched by order
+//    -H <host>     host of server (default 127.0.0.1)
+//    -p <port>     TCP-port of server (default 4545)
+//    -u <path>     unix domain socket of server
+//    -s <speed>    1: original timing (default), 2: twice as fast, 0.5: half as fast, 0: as fast as possible
+//    -w <ms>       wait that long for outstanding returns after the last call (default 2000)
+//    -v            print each differing return, not only the first 10
+//  Exit code is 1 if returns differ or are missing.
+//
+#include "MoDePPClient.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+///Recorded or replayed call
+struct Call
+{
+        std::string function;
+        std::string data;                       ///<data of MsgCallFunction: name and parameters
+        unsigned long long time;                ///<time of the call
+        unsigned long long latency;             ///<time to first response, 0 if none
+        std::vector<std::string> returns;
+        Call():time(0),latency(0){}
+};
+
+typedef std::vector<Call> Calls;
+
+///Monotonic time in nanoseconds
+static unsigned long long now()
+{
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+///Reads little-endian number of given bytes
+static unsigned long long readLe( const unsigned char * p, int bytes )
+{
+        unsigned long long v = 0;
+        for ( int i = bytes - 1; i >= 0; --i )
+                v = ( v << 8 ) | p[i];
+        return v;
+}
+
+///Takes first response of call and returns
+static void respond( Call & c, unsigned long long t, const std::string * ret )
+{
+        if ( !c.latency )
+                c.latency = t > c.time ? t - c.time : 1;
+        if ( ret )
+                c.returns.push_back( *ret );
+}
+
+///Reads log of MODEPP_RECORD. Returns false if it is not a recording
+bool readLog( const std::string & path, Calls & calls )
+{
+        FILE * f = fopen( path.c_str(), "rb" );
+        if ( !f )
+        {
+                perror( path.c_str() );
+                return false;
+        }
+        char magic[sizeof(MODEPP_RECORD_MAGIC)] = "";
+        if ( fread( magic, 1, sizeof(magic) - 1, f ) != sizeof(magic) - 1 || strcmp( magic, MODEPP_RECORD_MAGIC ) != 0 )
+        {
+                std::cerr << path << ": not a MoDe++ recording" << std::endl;
+                fclose( f );
+                return false;
+        }
+        std::map<unsigned int, size_t> open;    ///<calls by call-id
+        size_t last = (size_t)-1;               ///<last call without id
+        unsigned char hdr[11];
+        std::string data;
+        while ( fread( hdr, 1, sizeof(hdr), f ) == sizeof(hdr) )
+        {
+                int cmd = hdr[0];
+                unsigned long long t = readLe( hdr + 1, 8 );
+                data.resize( readLe( hdr + 9, 2 ) );
+                if ( !data.empty() && fread( &data[0], 1, data.length(), f ) != data.length() )
+                        break;
+                unsigned int id = 0;
+                if ( cmd == MsgCallFunctionId || cmd == MsgReturnId || cmd == MsgCallDone )
+                {
+                        if ( data.length() < CALL_ID_LEN )
+                                continue;
+                        id = strtoul( data.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 );
+                        data.erase( 0, CALL_ID_LEN );
+                }
+                if ( cmd == MsgCallFunction || cmd == MsgCallFunctionId )
+                {
+                        Call c;
+                        c.data = data;
+                        c.time = t;
+                        size_t len = data.length() >= 4 ? strtoul( data.substr( 0, 4 ).c_str(), 0, 16 ) : 0;
+                        c.function = data.substr( std::min<size_t>( 4, data.length() ), len );
+                        calls.push_back( c );
+                        if ( id )
+                                open[id] = calls.size() - 1;
+                        else
+                                last = calls.size() - 1;
+                }
+                else if ( cmd == MsgReturn && last != (size_t)-1 )
+                {
+                        respond( calls[last], t, &data );
+                }
+                else if ( id && open.count( id ) )
+                {
+                        respond( calls[open[id]], t, cmd == MsgReturnId ? &data : 0 );
+                        if ( cmd == MsgCallDone )
+                                open.erase( id );
+                }
+        }
+        fclose( f );
+        return true;
+}
+
+///Collects returns of replayed calls, call-id is index + 1
+struct Collector : IClientHandler
+{
+        Calls & calls;
+        size_t responses;       ///<calls with response
+
+        Collector( Calls & c ):calls(c),responses(0){}
+
+        void onResponse( unsigned int id, const std::string * data )
+        {
+                if ( !id || id > calls.size() )
+                        return;
+                Call & c = calls[id-1];
+                if ( !c.latency )
+                        ++responses;
+                respond( c, now(), data );
+        }
+
+        void onReturn( unsigned int id, const std::string & data ) { onResponse( id, &data ); }
+
+        void onCallDone( unsigned int id, bool ) { onResponse( id, 0 ); }
+};
+
+///Sends calls at their recorded time divided by speed (0: at once) and collects the responses into replayed
+bool replay( MoDePPClient & client, const Calls & recorded, double speed, int waitMs, Calls & replayed )
+{
+        Collector collector( replayed );
+        client.setHandler( &collector );
+        unsigned long long start = now();
+        for ( size_t i = 0; i < recorded.size(); ++i )
+        {
+                unsigned long long at = start;
+                if ( speed > 0 )
+                        at += (unsigned long long)( ( recorded[i].time - recorded[0].time ) / speed );
+                //responses are read while waiting, the last millisecond is spun
+                for ( unsigned long long t = now(); t < at; t = now() )
+                {
+                        unsigned long long left = ( at - t ) / 1000000;
+                        if ( left > 0 && !client.poll( (int)std::min<unsigned long long>( left, 10 ) ) )
+                                return false;
+                }
+                Call c = recorded[i];
+                c.latency = 0;
+                c.returns.clear();
+                c.time = now();
+                replayed.push_back( c );
+                char id[CALL_ID_LEN+1];
+                sprintf( id, "%08x", (unsigned int)( i + 1 ) );
+                client.queue( MsgCallFunctionId, id + c.data );
+                if ( speed > 0 && !client.flush() )
+                        return false;
+        }
+        for ( int idle = 0; collector.responses < replayed.size() && idle < waitMs; idle += 10 )
+        {
+                size_t before = collector.responses;
+                if ( !client.poll( 10 ) )
+                        return false;
+                if ( collector.responses != before )
+                        idle = 0;
+        }
+        return true;
+}
+
+///Latencies of a function
+struct Latency
+{
+        unsigned long calls;
+        unsigned long long sumA, maxA, sumB, maxB;
+        Latency():calls(0),sumA(0),maxA(0),sumB(0),maxB(0){}
+};
+
+///Compares returns and latencies of the calls. Returns count of differences
+unsigned long report( const Calls & a, const Calls & b, bool verbose )
+{
+        unsigned long differ = 0, missing = 0;
+        std::map<std::string, Latency> functions;
+        for ( size_t i = 0; i < a.size() && i < b.size(); ++i )
+        {
+                if ( a[i].function != b[i].function || a[i].returns != b[i].returns )
+                {
+                        if ( ++differ <= 10 || verbose )
+                        {
+                                printf( "DIFF #%lu %s\n", (unsigned long)( i + 1 ), a[i].function.c_str() );
+                                for ( size_t r = 0; r < a[i].returns.size(); ++r )
+                                        printf( "  - %s\n", a[i].returns[r].c_str() );
+                                for ( size_t r = 0; r < b[i].returns.size(); ++r )
+                                        printf( "  + %s\n", b[i].returns[r].c_str() );
+                        }
+                }
+                if ( a[i].latency && !b[i].latency )
+                        ++missing;
+                if ( !a[i].latency || !b[i].latency || a[i].function != b[i].function )
+                        continue;
+                Latency & l = functions[a[i].function];
+                ++l.calls;
+                l.sumA += a[i].latency;
+                l.sumB += b[i].latency;
+                l.maxA = std::max( l.maxA, a[i].latency );
+                l.maxB = std::max( l.maxB, b[i].latency );
+        }
+        printf( "%-24s %8s %12s %12s %12s %12s %8s\n", "function", "calls", "avg_us", "max_us", "new_avg_us", "new_max_us", "delta" );
+        for ( std::map<std::string, Latency>::const_iterator it = functions.begin(); it != functions.end(); ++it )
+        {
+                const Latency & l = it->second;
+                double avgA = l.sumA / 1000.0 / l.calls, avgB = l.sumB / 1000.0 / l.calls;
+                printf( "%-24s %8lu %12.1f %12.1f %12.1f %12.1f %+7.1f%%\n", it->first.c_str(), l.calls, avgA, l.maxA / 1000.0,
+                        avgB, l.maxB / 1000.0, avgA > 0 ? ( avgB - avgA ) * 100 / avgA : 0.0 );
+        }
+        if ( a.size() != b.size() )
+                printf( "calls: %lu, other: %lu\n", (unsigned long)a.size(), (unsigned long)b.size() );
+        printf( "%lu calls, %lu with different returns, %lu without response\n", (unsigned long)std::min( a.size(), b.size() ),
+                differ, missing );
+        return differ + missing + ( a.size() != b.size() );
+}
+
+void usage()
+{
+        std::cerr << "Usage: modepp_replay [-H host] [-p port | -u path] [-s speed] [-w ms] [-v] log" << std::endl
+                  << "       modepp_replay -c log log2" << std::endl;
+}
+
+int main( int argc, char * argv[] )
+{
+        std::string host = "127.0.0.1";
+        std::string path;
+        int port = 4545;
+        double speed = 1;
+        int waitMs = 2000;
+        bool compare = false;
+        bool verbose = false;
+        int opt;
+        while ( ( opt = getopt( argc, argv, "H:p:u:s:w:cv" ) ) != -1 )
+        {
+                switch ( opt )
+                {
+                case 'H': host = optarg; break;
+                case 'p': port = atoi( optarg ); break;
+                case 'u': path = optarg; break;
+                case 's': speed = atof( optarg ); break;
+                case 'w': waitMs = atoi( optarg ); break;
+                case 'c': compare = true; break;
+                case 'v': verbose = true; break;
+                default: usage(); return 2;
+                }
+        }
+        if ( optind + ( compare ? 2 : 1 ) != argc )
+        {
+                usage();
+                return 2;
+        }
+        Calls recorded, other;
+        if ( !readLog( argv[optind], recorded ) )
+                return 2;
+        if ( compare )
+        {
+                if ( !readLog( argv[optind+1], other ) )
+                        return 2;
+                return report( recorded, other, verbose ) ? 1 : 0;
+        }
+
+        MoDePPClient client;
+        if ( !( path.empty() ? client.connect( host, (unsigned short)port ) : client.connectLocal( path ) ) )
+        {
+                std::cerr << client.lastError() << std::endl;
+                return 2;
+        }
+        if ( !replay( client, recorded, speed, waitMs, other ) )
+        {
+                std::cerr << client.lastError() << std::endl;
+                return 2;
+        }
+        return report( recorded, other, verbose ) ? 1 : 0;
+}
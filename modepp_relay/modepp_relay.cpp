@@ -0,0 +1,441 @@
+// MoDe++ relay
+// ~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Copyright (c) 2009 Valentin Heinitz, vheinitz@googlemail.com, http://heinitz-it.de
+//
+// Distributed under the GNU Lesser General Public License:
+//    http://www.gnu.org/licenses/lgpl-3.0.html
+//
+// Description:
+//  Aggregates a fleet of instrumented processes behind one MoDe++ server. The relay connects to each
+//  server, forwards their traces, metrics, returns and other messages to its own client, every message
+//  preceded by MsgSource with the name of the server, and registers their test-functions as its own.
+//  A call of such a function is sent to every server which has it (broadcast); their returns come back
+//  with the call-id of the client. An asynchronous function is asynchronous in the relay too: MsgCancel is
+//  sent to the servers running the call, the relay sends one MsgCallDone when all of them are done.
+//  Servers which are not reachable are retried every second.
+//  Usage: modepp_relay [options] <server>...
+//    -p <port>     TCP-port of the relay (default 4545)
+//    -u <path>     unix domain socket of the relay instead of TCP
+//    -m <ms>       subscribe to process metrics of each server every <ms> milliseconds
+//  <server>: [<name>=]<host>:<port> or [<name>=]<path> of unix domain socket. Default name is the address.
+//  Example: modepp_relay -p 4600 -m 1000 web1=10.0.0.1:4545 web2=10.0.0.2:4545 db=/tmp/db.modepp
+//
+#include "MoDePP.h"
+#include "MoDePPClient.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+///Call of a forwarded function, data in the format of MsgCallFunctionId. Without data it cancels call id
+struct Call
+{
+        std::string name;
+        std::string data;
+        unsigned int id;
+        bool async;
+};
+
+struct Source;
+static std::vector<Source*> sources;
+
+///Servers running an asynchronous call. Filled by the event-loop when it sent the call
+struct AsyncCall
+{
+        bool sent;
+        std::set<Source*> running;
+        AsyncCall():sent(false){}
+};
+
+static modepp::mutex callsMutex;
+static std::deque<Call> calls;  ///<calls of the client, taken by the event-loop
+static std::map<unsigned int, AsyncCall> asyncCalls;   ///<by call-id, guarded by callsMutex too
+static int wakePipe[2];         ///<wakes the event-loop when a call was queued
+
+///Queues call for the event-loop
+static void queueCall( const Call & c )
+{
+        {
+                modepp::scoped_lock lock( callsMutex );
+                calls.push_back( c );
+        }
+        char b = 0;
+        if ( write( wakePipe[1], &b, 1 ) < 0 ) {}
+}
+
+///Call of current thread in the format of MsgCallFunctionId
+static Call makeCall( const char * name, bool async, const VarParam & p1, const VarParam & p2, const VarParam & p3,
+                      const VarParam & p4, const VarParam & p5 )
+{
+        const VarParam * all[] = { &p1, &p2, &p3, &p4, &p5 };
+        std::vector<std::string> p;
+        for ( int i = 0; i < 5; ++i )
+                p.push_back( all[i]->toString() );
+        while ( !p.empty() && p.back().empty() )
+                p.pop_back();
+        Call c;
+        c.id = MoDePP::instance().callId();
+        c.async = async;
+        c.name = name;
+        char id[CALL_ID_LEN+1];
+        sprintf( id, "%08x", c.id );
+        c.data.assign( id, CALL_ID_LEN );
+        MoDePPClient::appendCall( c.data, c.name, p );
+        return c;
+}
+
+///Synchronous test-function of one or more servers. Called in the server-thread of the relay, it only queues
+///the call for the event-loop, which sends it to the servers
+struct ForwardFunction: public ITestFunctionWrapper
+{
+        std::string params;
+
+        ForwardFunction( const std::string & p ):params(p) { _parameters = params.c_str(); }
+
+        void testFunction( const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5 )
+        {
+                queueCall( makeCall( _name, false, p1, p2, p3, p4, p5 ) );
+        }
+};
+
+///Asynchronous test-function of one or more servers. Its thread queues the call and waits until the servers
+///which got it sent MsgCallDone, a cancellation of the client is forwarded to them
+struct AsyncForwardFunction: public IAsyncTestFunctionWrapper
+{
+        std::string params;
+
+        AsyncForwardFunction( const std::string & p ):params(p) { _parameters = params.c_str(); }
+
+        void asyncTestFunction( const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5 )
+        {
+                Call c = makeCall( _name, true, p1, p2, p3, p4, p5 );
+                if ( !c.id )
+                {
+                        queueCall( c );         //without call-id there is no MsgCallDone to wait for
+                        return;
+                }
+                {
+                        modepp::scoped_lock lock( callsMutex );
+                        asyncCalls[c.id] = AsyncCall();
+                }
+                queueCall( c );
+                bool cancelSent = false;
+                for (;;)
+                {
+                        usleep( 10000 );
+                        {
+                                modepp::scoped_lock lock( callsMutex );
+                                std::map<unsigned int, AsyncCall>::iterator it = asyncCalls.find( c.id );
+                                if ( it->second.sent && it->second.running.empty() )
+                                {
+                                        asyncCalls.erase( it );
+                                        return;
+                                }
+                        }
+                        if ( !cancelSent && MODEPP_CANCELLED )
+                        {
+                                Call cancel;
+                                cancel.id = c.id;
+                                cancel.async = true;
+                                queueCall( cancel );
+                                cancelSent = true;
+                        }
+                }
+        }
+};
+
+///Wrappers by function name. Replaced ones are kept, a call may still run
+static std::map<std::string, ITestFunctionWrapper*> forwards;
+
+///Connection to one server
+struct Source: public IClientHandler
+{
+        std::string name;
+        std::string host;
+        unsigned short port;
+        std::string path;
+        MoDePPClient client;
+        std::set<std::string> functions;        ///<test-functions of the server
+        std::string via;                        ///<source-name of current message, if the server is a relay too
+        time_t retry;                           ///<time of next connection attempt
+        bool relist;                            ///<functions were added, their kinds come with the function-list
+        std::vector<MoDePP::NamedFunction> added;       ///<registrations of the last messages, see commit()
+        std::vector<std::string> removed;
+
+        Source( const std::string & spec ):port(0),client(this),retry(0),relist(false)
+        {
+                std::string addr = spec;
+                size_t eq = spec.find( '=' );
+                if ( eq != std::string::npos )
+                        addr = spec.substr( eq + 1 );
+                name = eq != std::string::npos ? spec.substr( 0, eq ) : addr;
+                size_t colon = addr.rfind( ':' );
+                if ( addr.find( '/' ) == std::string::npos && colon != std::string::npos )
+                {
+                        host = addr.substr( 0, colon );
+                        port = (unsigned short)atoi( addr.c_str() + colon + 1 );
+                }
+                else
+                {
+                        path = addr;
+                }
+        }
+
+        bool connect( unsigned int metricsMs )
+        {
+                retry = time( 0 ) + 1;
+                if ( !( path.empty() ? client.connect( host, port ) : client.connectLocal( path ) ) )
+                        return false;
+                std::cerr << "connected " << name << std::endl;
+                client.listFunctions( std::string() );
+                if ( metricsMs )
+                        client.setMetricsInterval( metricsMs );
+                return client.flush();
+        }
+
+        void disconnected()
+        {
+                std::cerr << "disconnected " << name << ": " << client.lastError() << std::endl;
+                std::set<std::string> gone;
+                gone.swap( functions );
+                for ( std::set<std::string>::const_iterator it = gone.begin(); it != gone.end(); ++it )
+                        withdraw( *it );
+                relist = false;
+                commit();
+                {
+                        modepp::scoped_lock lock( callsMutex );
+                        for ( std::map<unsigned int, AsyncCall>::iterator it = asyncCalls.begin(); it != asyncCalls.end(); ++it )
+                                it->second.running.erase( this );
+                }
+                retry = time( 0 ) + 1;
+        }
+
+        ///Registers function in the relay, if no other server has it yet. A wrapper with other parameters or
+        ///kind is replaced
+        void provide( const std::string & fname, const std::vector<std::string> & params, bool async )
+        {
+                functions.insert( fname );
+                std::string p;
+                for ( size_t i = 0; i < params.size(); ++i )
+                        p += ( i ? " " : "" ) + params[i];
+                ITestFunctionWrapper *& f = forwards[fname];
+                if ( f && ( p != f->_parameters || async != ( dynamic_cast<AsyncForwardFunction*>( f ) != 0 ) ) )
+                {
+                        removed.push_back( fname );
+                        f = 0;
+                }
+                if ( !f )
+                {
+                        if ( async )
+                                f = new AsyncForwardFunction( p );
+                        else
+                                f = new ForwardFunction( p );
+                }
+                added.push_back( MoDePP::NamedFunction( fname, f ) );
+        }
+
+        ///Unregisters function from the relay, if no other server has it
+        void withdraw( const std::string & fname )
+        {
+                for ( size_t i = 0; i < sources.size(); ++i )
+                        if ( sources[i]->functions.count( fname ) )
+                                return;
+                for ( size_t i = added.size(); i-- > 0; )
+                        if ( added[i].first == fname )
+                                added.erase( added.begin() + i );
+                removed.push_back( fname );
+        }
+
+        ///Applies registrations of the messages read last by one change of the relay's function-table each.
+        ///Requests the function-list, if functions were added
+        void commit()
+        {
+                if ( !removed.empty() )
+                        MoDePP::instance().removeFunctions( removed );
+                if ( !added.empty() )
+                        MoDePP::instance().addFunctions( added );
+                removed.clear();
+                added.clear();
+                if ( relist )
+                {
+                        relist = false;
+                        client.listFunctions( std::string() );
+                        if ( !client.flush() )
+                                disconnected();
+                }
+        }
+
+        void onFunctionInfo( const std::string & fname, const std::vector<std::string> & params, bool async )
+        {
+                provide( fname, params, async );
+        }
+
+        void onFunctionsChanged( bool add, const std::string & fname, const std::vector<std::string> & )
+        {
+                if ( add )
+                {
+                        relist = true;
+                }
+                else
+                {
+                        functions.erase( fname );
+                        withdraw( fname );
+                }
+        }
+
+        void onSource( const std::string & s ) { via = s; }
+
+        ///Forwards all messages but the function-lists, which are merged in the relay, and the MsgCallDone of
+        ///asynchronous calls, which the relay sends itself
+        bool onFrame( int cmd, const char * data, size_t len )
+        {
+                if ( cmd == MsgAddFunction || cmd == MsgFunctionsChanged || cmd == MsgFunctionList )
+                        return false;
+                if ( cmd == MsgCallDone && len >= CALL_ID_LEN )
+                {
+                        unsigned int id = strtoul( std::string( data, CALL_ID_LEN ).c_str(), 0, 16 );
+                        modepp::scoped_lock lock( callsMutex );
+                        std::map<unsigned int, AsyncCall>::iterator it = asyncCalls.find( id );
+                        if ( it != asyncCalls.end() && it->second.running.erase( this ) )
+                                return true;
+                }
+                MoDePP::instance().sendFromSource( via.empty() ? name : name + "/" + via, cmd, data, len );
+                return true;
+        }
+};
+
+///Sends calls of the client to all connected servers having the function
+void sendCalls()
+{
+        char b[256];
+        while ( read( wakePipe[0], b, sizeof(b) ) > 0 ) {}
+        std::deque<Call> pending;
+        {
+                modepp::scoped_lock lock( callsMutex );
+                pending.swap( calls );
+        }
+        for ( std::deque<Call>::const_iterator c = pending.begin(); c != pending.end(); ++c )
+        {
+                if ( c->data.empty() )
+                {
+                        modepp::scoped_lock lock( callsMutex );
+                        std::map<unsigned int, AsyncCall>::const_iterator it = asyncCalls.find( c->id );
+                        if ( it != asyncCalls.end() )
+                                for ( std::set<Source*>::const_iterator s = it->second.running.begin(); s != it->second.running.end(); ++s )
+                                        (*s)->client.cancel( c->id );
+                        continue;
+                }
+                std::set<Source*> running;
+                for ( size_t i = 0; i < sources.size(); ++i )
+                {
+                        if ( sources[i]->client.connected() && sources[i]->functions.count( c->name ) )
+                        {
+                                sources[i]->client.queue( MsgCallFunctionId, c->data );
+                                running.insert( sources[i] );
+                        }
+                }
+                if ( c->async && c->id )
+                {
+                        modepp::scoped_lock lock( callsMutex );
+                        AsyncCall & a = asyncCalls[c->id];
+                        a.sent = true;
+                        a.running.swap( running );
+                }
+        }
+        for ( size_t i = 0; i < sources.size(); ++i )
+                if ( sources[i]->client.connected() && !sources[i]->client.flush() )
+                        sources[i]->disconnected();
+}
+
+void usage()
+{
+        std::cerr << "Usage: modepp_relay [-p port | -u path] [-m ms] [name=]host:port|[name=]path ..." << std::endl;
+}
+
+int main( int argc, char * argv[] )
+{
+        int port = 4545;
+        std::string path;
+        unsigned int metricsMs = 0;
+        int opt;
+        while ( ( opt = getopt( argc, argv, "p:u:m:" ) ) != -1 )
+        {
+                switch ( opt )
+                {
+                case 'p': port = atoi( optarg ); break;
+                case 'u': path = optarg; break;
+                case 'm': metricsMs = atoi( optarg ); break;
+                default: usage(); return 2;
+                }
+        }
+        if ( optind >= argc )
+        {
+                usage();
+                return 2;
+        }
+        if ( pipe( wakePipe ) < 0 )
+        {
+                perror( "pipe" );
+                return 1;
+        }
+        fcntl( wakePipe[0], F_SETFL, O_NONBLOCK );
+        for ( int i = optind; i < argc; ++i )
+                sources.push_back( new Source( argv[i] ) );
+
+        if ( path.empty() )
+                MoDePP::instance().start( (unsigned short)port );
+        else
+                MoDePP::instance().startLocal( path );
+        MoDePP::instance().startNow();
+
+        //Event-loop: all servers and the wake-pipe are polled at once, each ready server is read without blocking
+        std::vector<pollfd> fds;
+        std::vector<Source*> polled;
+        for (;;)
+        {
+                fds.clear();
+                polled.clear();
+                pollfd wake = { wakePipe[0], POLLIN, 0 };
+                fds.push_back( wake );
+                time_t now = time( 0 );
+                for ( size_t i = 0; i < sources.size(); ++i )
+                {
+                        Source * s = sources[i];
+                        if ( !s->client.connected() && now >= s->retry )
+                                s->connect( metricsMs );
+                        if ( s->client.connected() )
+                        {
+                                pollfd pfd = { s->client.fd(), POLLIN, 0 };
+                                fds.push_back( pfd );
+                                polled.push_back( s );
+                        }
+                }
+                int rc = ::poll( &fds[0], fds.size(), 1000 );
+                if ( rc < 0 && errno != EINTR )
+                {
+                        perror( "poll" );
+                        return 1;
+                }
+                if ( rc <= 0 )
+                        continue;
+                if ( fds[0].revents )
+                        sendCalls();
+                for ( size_t i = 0; i < polled.size(); ++i )
+                {
+                        if ( fds[i+1].revents && polled[i]->client.connected() && !polled[i]->client.poll( 0 ) )
+                                polled[i]->disconnected();
+                        else
+                                polled[i]->commit();
+                }
+        }
+        return 0;
+}
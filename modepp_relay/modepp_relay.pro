@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = modepp_relay
+CONFIG += console
+CONFIG -= qt
+DEPENDPATH += . ../modepp_server ../modepp_client
+INCLUDEPATH += ../modepp_server ../modepp_client
+DEFINES += USING_BOOST_ASIO
+LIBS += -lboost_thread -lboost_system -lrt
+
+# Input
+SOURCES += modepp_relay.cpp
+HEADERS += ../modepp_client/MoDePPClient.h ../modepp_server/MoDePP.h
@@ -25,12 +25,43 @@
 //
 // How it works
 // ------------
-// MoDe++ is a server which works in it's own thread. It contain a map of function-name to func. pointer.
-// MoDe++ macros register functions of your program in this map. Using MoDe++ network protocol
+// MoDe++ is a server which works in it's own thread. It contain a table of function-name to func. pointer.
+// MoDe++ macros register functions of your program by linking them into a list during static initialization
+// (no lock, no allocation). The server builds the sorted table from this list on first use. Using MoDe++ network protocol
 // a client can get the list of registered test-functions and call them by name.
 // MoDe+ macros use static-initialization of C++. There is no need to place any of MoDe++ macros
 // in your program-code, no need to incude MoDePP.h in your program-code or to call any MoDe++ functions from there.
 //
+// Backends
+// --------
+// By default the server uses asio (define USING_BOOST_ASIO for boost's asio) and boost::thread.
+// Define MODEPP_USE_EPOLL before including MoDePP.h in order to use the lean linux-backend instead:
+// an epoll event-loop in a std::thread (C++11), which doesn't need boost at all.
+// Both backends provide the same macros and speak the same protocol.
+//
+// Transports
+// ----------
+// MODEPP_START(port) listens on a TCP-port. For clients on the same host there are two more start-macros:
+// MODEPP_START_LOCAL(path) listens on a unix domain socket, MODEPP_START_SHM(name) exchanges messages over
+// a POSIX shared-memory segment with two lock-free rings (see ShmControl and examples/shm_agent).
+//
+// Startup
+// -------
+// By default the start-macro opens the server and starts its thread during static initialization.
+// Define MODEPP_STARTUP (or set environment-variable MODEPP_STARTUP) in order to defer it:
+//   MODEPP_STARTUP_LAZY / lazy         - server starts on the first trace or by MODEPP_START_NOW()
+//   MODEPP_STARTUP_EXPLICIT / explicit - server starts only by MODEPP_START_NOW(), e.g. after daemonising
+// Environment-variable MODEPP overrides the endpoint of the start-macro: <port>, local:<path> or shm:<name>.
+// MODEPP=off disables the server; then no socket and no thread are created at all.
+// After fork() the child abandons the inherited server and starts its own one on the next trace
+// (or by MODEPP_START_NOW() in explicit mode).
+//
+// Clients
+// -------
+// qmodepp_client is the GUI-client. modepp_client/MoDePPClient.h is a headless client library (POSIX) with
+// pipelined calls; modepp_cli is built on it and runs commands from the command-line or a script-file,
+// modepp_replay replays recorded calls (see Recording). modepp_relay serves many servers as one (see Relay).
+//
 // MoDe++ communication protocol
 // -----------------------------
 // MoDe++ uses ASCII-bases, fixed-lenngth-header, 0-filled, length-value protocol
@@ -51,6 +82,173 @@
 // MsgCallFunction  | C - S     | <LenOfFuncData><MsgCallFunctionID><LenOfFuncName><FuncName>[<LenOfParamData><ParamData>[...]]
 // MsgTrace         | S - C     | <LenOfTraceData><MsgTraceID><TraceData>
 // MsgReturn        | S - C     | <LenOfReturnData><MsgReturnID><ReturnData>
+// MsgTraceBatch    | S - C     | <LenOfRecords><MsgTraceBatchID><TraceRecord>[<TraceRecord>[...]]
+// MsgCallFunctionId| C - S     | <LenOfFuncData><MsgCallFunctionIdID><CallID><LenOfFuncName><FuncName>[<LenOfParamData><ParamData>[...]]
+// MsgReturnId      | S - C     | <LenOfReturnData><MsgReturnIdID><CallID><ReturnData>
+// MsgProgress      | S - C     | <LenOfProgressData><MsgProgressID><CallID><ProgressData>
+// MsgCancel        | C - S     | 0008<MsgCancelID><CallID>
+// MsgCallDone      | S - C     | <LenOfStatus><MsgCallDoneID><CallID><Status: done|cancelled>
+// MsgGetAllocStats | C - S     | <LenOfData><MsgGetAllocStatsID>[<NumberOfSites>]
+// MsgAllocStats    | S - C     | <LenOfStats><MsgAllocStatsID><Stats>
+// MsgSetMetrics    | C - S     | <LenOfInterval><MsgSetMetricsID><IntervalMs>
+// MsgMetrics       | S - C     | <LenOfMetrics><MsgMetricsID><Metrics>
+// MsgDump          | C - S     | <LenOfData><MsgDumpID><CallID>[<Name>]
+// MsgDumpChunk     | S - C     | <LenOfEntries><MsgDumpChunkID><CallID><Entry>[\n<Entry>[...]]
+// MsgLoadTest      | C - S     | <LenOfData><MsgLoadTestID><CallID><Threads 4><Rate 8><DurationMs 8><LenOfFuncName><FuncName>[<LenOfParamData><ParamData>[...]]
+// MsgFunctionsChanged| S - C   | <LenOfData><MsgFunctionsChangedID><+|-><FuncName>[ <ParamName1>[...]]
+// MsgGetFunctionList| C - S    | <LenOfHash><MsgGetFunctionListID>[<Hash of cached list>]
+// MsgFunctionList  | S - C     | <LenOfList><MsgFunctionListID><Hash 16 hex digits><Last 0|1>[<Entry>[\n<Entry>[...]]]
+// MsgHeartbeat     | S - C - S | 0000<MsgHeartbeatID>
+// MsgAddRule       | C - S     | <LenOfRule><MsgAddRuleID><CallID><Condition>[ => <Action>]
+// MsgSource        | S - C     | <LenOfName><MsgSourceID><SourceName>
+//
+// Malformed data
+// A header which isn't 8 hex digits can't be resynchronized: the server drops the received data and closes
+// the connection. A call whose lengths aren't hex or exceed the message is answered by a return
+// "Error! invalid call". Unknown commands are ignored. examples/fuzz feeds random and mutated frames to the parser.
+//
+// Function list
+// MsgListFunctions sends one MsgAddFunction per function. MsgGetFunctionList sends the whole list at once:
+// MsgFunctionList messages with entries "<s|a> <FuncName>[ <ParamName1>[...]]" (s: synchronous, a: asynchronous)
+// split between entries at MAX_MSG_LEN (join the parts with \n), Last is 1 in the final one. Hash is FNV-1a of all entries, so it stays
+// the same for the same functions, also after restart. If the client sent this hash, the list is not sent
+// again: the answer is one MsgFunctionList with hash and no entries, the client uses its cached list.
+//
+// Parameter enums
+// MODEPP_ADD_PARAM_ENUM( "param", VALUE ) adds a valid value for parameters of that name to all functions.
+// The function list has an entry "e <ParamName> <ValueName0>[ <ValueName1>[...]]" per parameter name.
+// A call may pass <MODEPP_ENUM_PARAM><Index, decimal> instead of the parameter's text, then the function gets
+// the VarParam stored by MODEPP_ADD_PARAM_ENUM: nothing is parsed and a typo can't reach the function.
+// An invalid index is answered by a return "Error! invalid enum ..." and the function is not called.
+//
+// Rules
+// MsgAddRule pushes a condition to the server, which compiles it into a small program (see RulePredicate):
+//   rss > 500000000 || fds >= 1000        metrics as in MsgMetrics (Linux), read every MODEPP_TRACE_FLUSH_MS
+//   $queue_len > 100 && !(threads < 4)    $<name>: value of object exposed by MODEPP_EXPOSE
+//   trace ~ 'timeout' && sendq > 0        trace-records containing text, checked when their batch is sent
+// The rule fires when its condition becomes true, trace-conditions fire once per flush interval while records
+// match. Firing is sent as MsgProgress "fired[ n=<matching records> <text of first>]" with the rule's call-id,
+// then the server runs the action at once, without round trip to the client:
+//   call <FuncName>[ <Param>[...]]   calls test-function as MsgCallFunctionId with the rule's call-id does
+//   dump <Name>                      dumps exposed object as MsgDump with the rule's call-id does
+//   metrics                          sends MsgMetrics
+// A syntax error or nesting deeper than 64 is answered by MsgReturnId "Error! ...". MsgCancel removes the rule
+// and is answered by MsgCallDone. Rules belong to the connected client, they are removed when the next client
+// connects.
+//
+// Relay
+// modepp_relay is a MoDe++ server, which connects to many MoDe++ servers (e.g. worker processes) and forwards
+// their messages to its one client. Each forwarded message is preceded by MsgSource with the name of the
+// server (<name> given on the command-line, else <host>:<port> or socket path; a relay behind a relay adds
+// "/<name>"), MsgSource applies to the next message only. Functions of all servers are registered in the relay,
+// a call is sent to each server which has the function, all returns come with the call-id of the client.
+//
+// Sessions
+// A sending thread never waits for the client: what the socket does not take at once is queued and written by
+// the server-thread. While more than MODEPP_SEND_HIGH_WATERMARK bytes are queued, trace-batches are dropped,
+// till the queue is below MODEPP_SEND_LOW_WATERMARK. Then a MsgTrace tells how many were dropped. Returns and
+// other messages are kept, but a client with more than MODEPP_SEND_MAX_QUEUE queued bytes is disconnected.
+// TCP-keepalive (MODEPP_KEEPALIVE_S) detects a vanished client. With MODEPP_HEARTBEAT_MS the server sends
+// MsgHeartbeat when it was silent that long, clients answer with MsgHeartbeat. With MODEPP_IDLE_TIMEOUT_MS
+// (greater than MODEPP_HEARTBEAT_MS) a client which sent nothing for that time is disconnected.
+//
+// Runtime registration
+// Functions may be added and removed while clients are connected: MoDePP::addFunction / removeFunction,
+// or MoDePP::addRegistrations after loading a plugin, which declares functions by the macros. Remove the
+// functions of a plugin before unloading it. Each change is sent as MsgFunctionsChanged, "+" with the
+// data of MsgAddFunction or "-" with the name. Lookups of calls never wait for a change. Every change copies
+// the table, so register many functions at once by MoDePP::addFunctions / removeFunctions.
+//
+// Call IDs
+// MsgCallFunctionId is MsgCallFunction with a call-id of 8 hex digits chosen by the client (0 means no id).
+// Returns of the call are sent as MsgReturnId with the same id, trace-records of the call carry it too.
+// So a client can keep many calls in flight and match returns which arrive in any order: a test-function
+// may pass MODEPP_CALL_ID to another thread, which opens MODEPP_CALL_SCOPE( id ) and returns from there.
+// A call of an unknown function is answered by MsgReturnId with "Error! no such function: <FuncName>".
+//
+// Asynchronous test-functions
+// Functions declared by MODEPP_BEGIN_ASYNC_TEST_FUNCTIONx run in an own thread, the server continues
+// with the next message at once. The body may send any number of MsgProgress (MODEPP_PROGRESS) and returns.
+// MsgCancel sets the cancel-flag of a running call, the body should check MODEPP_CANCELLED and stop.
+// When the body is finished, MsgCallDone tells whether it was cancelled.
+//
+// Coroutine test-functions (C++20)
+// Compiled with C++20 coroutines (unless MODEPP_NO_COROUTINES is defined), MODEPP_BEGIN_CORO_TEST_FUNCTIONx ...
+// MODEPP_END_CORO_TEST_FUNCTION declares a test-function whose body is a coroutine. It runs in the server-thread
+// and suspends without blocking it: co_await modeppSleep( ms ), modeppReadable( fd ) / modeppWritable( fd ),
+// modeppCall( name, params... ) of another registered function (results in its returns, which are not sent)
+// or a CoroTask of an own helper-coroutine. The event-loop of the transport resumes it (descriptors and timers
+// of MODEPP_START_SHM are polled every MODEPP_SHM_POLL_MS), so a suspended call costs its coroutine-frame only,
+// no thread: thousands of monitoring scripts may run at once. Otherwise it behaves like an asynchronous one:
+// MODEPP_PROGRESS, returns and MsgCallDone, MsgCancel makes the running sleep or wait end at once (their result
+// is false) and MODEPP_CANCELLED true. Long computations between two co_awaits delay the server-thread.
+//
+// Load tests
+// MsgLoadTest runs a registered (synchronous, thread-safe) test-function from <Threads> threads of the program
+// for <DurationMs> milliseconds. With <Rate> > 0 calls are started at that total rate per second (open-loop),
+// latency is measured from the scheduled start, so a stall is not hidden by the calls it delayed
+// (coordinated omission). A rate above 10^9 calls/s per thread is refused, with <Rate> 0 each thread calls
+// as fast as it can (closed-loop).
+// Returns and traces of the calls are suppressed. Every MODEPP_LOAD_REPORT_MS a MsgProgress with statistics
+// of the interval is sent, at the end a MsgReturnId with the totals, then MsgCallDone. MsgCancel stops it.
+// Statistics: n=<calls> rate=<calls/s> p50= p90= p99= p999= max=<latency ns> hist=<bucket ns>:<count>[,...]
+//
+// Recording
+// With environment-variable MODEPP_RECORD=<file> (or MoDePP::record) the server writes every received
+// MsgCallFunction/MsgCallFunctionId and every sent MsgReturn/MsgReturnId/MsgCallDone into a binary log:
+//   MODEPP_RECORD_MAGIC, then per message <Cmd 1 byte><Time 8 bytes><LenOfData 2 bytes><Data>
+// Time is nanoseconds since start of recording, numbers are little-endian. A MsgReturn belongs to the last
+// call without call-id. modepp_replay sends the calls of a log again (at original, scaled or full speed),
+// compares the returns and reports latency deltas, or compares two logs, e.g. of two builds.
+//
+// Allocation tracking (POSIX)
+// Define MODEPP_TRACK_ALLOCATIONS before including MoDePP.h in exactly one source-file of the program in order
+// to replace global operator new/delete by counting ones. Counters are per thread and need no lock. Every
+// MODEPP_ALLOC_SAMPLE-th allocation of a thread records its call-stack into a table of allocation-sites.
+// MsgGetAllocStats is answered by MsgAllocStats, lines of text:
+//   live=<bytes> blocks=<n> allocs=<n> frees=<n> bytes=<n> alloc_rate=<allocs/s> byte_rate=<bytes/s> threads=<n>
+//   thread <slot> allocs=<n> frees=<n> bytes=<n>                       (one line per thread)
+//   site bytes=<n> count=<n> live=<n> <frame>[ <frame>[...]]            (top sites, estimated from samples)
+// Returns of test-functions get " allocs=<n> bytes=<n>" appended: allocations of the calling thread during the call.
+// The server-thread decodes calls into buffers which it reuses, returns are formatted into a reusable buffer of
+// the calling thread: once they have grown, a call and its return allocate nothing (see examples/fuzz allocs).
+//
+// Dumps
+// MODEPP_EXPOSE( name, object ) registers a variable for MsgDump, MODEPP_EXPOSE_LOCKED( name, object, mutex )
+// one which is guarded by a mutex. The object is written in an own thread, in MsgDumpChunks of at most
+// MODEPP_DUMP_CHUNK_BYTES: no string of the whole object is built and the mutex is held for one chunk only.
+// Containers are written one entry per line, maps as <key>=<value>. Between two chunks the position is kept
+// as index (sequences) or as last key (associative containers), so the owner may modify the container.
+// A list is walked from its begin to that index at each chunk, which makes dumps of long lists slow.
+// Values are written by ModeppFormat<T>, which uses operator<<. Specialize it for own types.
+// MsgDump without name lists names of exposed objects. MsgCancel stops a dump, MsgCallDone ends it.
+//
+// Process metrics (Linux)
+// MsgSetMetrics subscribes the client to process metrics every <IntervalMs> (decimal, 0 stops them,
+// MODEPP_METRICS_MS is the default for each new client). The server-thread reads them from /proc and sends
+// them along with the periodic flush of traces, so the interval is rounded up to MODEPP_TRACE_FLUSH_MS.
+// Metrics: ts=<timestamp ns> rss=<bytes> user_ms= sys_ms= vcsw= nvcsw= fds= recvq=<bytes> sendq=<bytes> threads=<n>
+//          [ thread=<tid>,<name>,<user_ms>,<sys_ms>,<vcsw>,<nvcsw>[...]]
+// vcsw/nvcsw are voluntary/involuntary context-switches, recvq/sendq bytes queued in the client's connection.
+//
+// Trace records
+// MODEPP_TRACE does not write to the socket. Each thread stages its records in an own buffer,
+// which is sent as one MsgTraceBatch when it is full or when the server flushes it periodically.
+// TraceRecord: <Timestamp 16 hex digits><ThreadID 8 hex digits><SeqNr 8 hex digits><CallID 8 hex digits>
+//              <LenOfText 4 hex digits><Text>
+// Timestamp is monotonic time in nanoseconds, ThreadID is assigned by MoDe++ in order of the first trace
+// of a thread, SeqNr counts records per thread, CallID is the id of the call the thread was running or 0.
+// Clients should merge the records of all threads by timestamp.
+//
+// Trace shards
+// By default a thread sends its full batch itself, so on many cores all tracing threads meet in one send.
+// With MODEPP_TRACE_SHARDS (or environment-variable MODEPP_TRACE_SHARDS) the batch is queued in the shard of
+// the CPU the thread first traced on:
+//   MODEPP_TRACE_SHARDS_NODE / node  - one shard per NUMA node (Linux: /sys/devices/system/node, else one shard)
+//   MODEPP_TRACE_SHARDS_CPU / cpu    - one shard per CPU
+// Each shard has a sender-thread bound to the shard's CPUs, so its queue is allocated on their node, which
+// writes all queued batches with one send. A thread keeps its shard, so its batches keep their order.
+// MODEPP_FLUSH_TRACES (and so each return of a test-function) writes the shard of the thread at once.
 
 #ifndef _MoDePP_HG_
 #define _MoDePP_HG_
@@ -60,6 +258,21 @@
 ///Length of message-header: 4 hex digits for message-length + 4 hex digits for message-type
 #define HEADER_LEN 8
 
+///Maximal length of message-data (4 hex digits in header)
+#define MAX_MSG_LEN 0xFFFF
+
+///Length of trace-record header: 16 timestamp + 8 thread-id + 8 sequence-nr + 8 call-id + 4 text-length hex digits
+#define TRACE_RECORD_HEADER_LEN 44
+
+///Length of call-id in MsgCallFunctionId and MsgReturnId (hex digits)
+#define CALL_ID_LEN 8
+
+///First character of a call-parameter, which is the index of an enum-value (see Parameter enums)
+#define MODEPP_ENUM_PARAM '\x01'
+
+///Start of a call-recording (see Recording)
+#define MODEPP_RECORD_MAGIC "MoDePPrec1\n"
+
 ///Enum for client/server commands
 enum CommandNumber{
     MsgGetVersion=0,    ///<client's request for server's version
@@ -69,38 +282,181 @@ enum CommandNumber{
     MsgCallFunction,    ///<client requests server to call a particular test-function
     MsgTrace,           ///<Server sends data which should be interpreted as trace-message
     MsgReturn,          ///<Server sends data which should be interpreted as return of test-function
+    MsgTraceBatch,      ///<Server sends batch of time-stamped trace-records of one thread
+    MsgCallFunctionId,  ///<same as MsgCallFunction, with client's call-id
+    MsgReturnId,        ///<return of test-function called by MsgCallFunctionId, with its call-id
+    MsgProgress,        ///<partial result or progress of running call, with its call-id
+    MsgCancel,          ///<client requests to cancel running asynchronous call
+    MsgCallDone,        ///<asynchronous call is finished or cancelled
+    MsgLoadTest,        ///<client requests to run a test-function under load in the program
+    MsgGetAllocStats,   ///<client requests statistics of allocation tracking
+    MsgAllocStats,      ///<Server sends statistics of allocation tracking
+    MsgSetMetrics,      ///<client sets interval of process metrics
+    MsgMetrics,         ///<Server sends process metrics
+    MsgDump,            ///<client requests dump of exposed object
+    MsgDumpChunk,       ///<Server sends part of a dump
+    MsgFunctionsChanged,///<Server tells that a test-function was added or removed at runtime
+    MsgGetFunctionList, ///<Client requests list of test-functions in one response, unless its cached list is current
+    MsgFunctionList,    ///<Server sends list of test-functions (in several messages if long) or only its hash
+    MsgHeartbeat,       ///<Server sends it if it was silent for MODEPP_HEARTBEAT_MS, client answers with it
+    MsgAddRule,         ///<Client adds a rule: condition evaluated by the server and action when it becomes true
+    MsgSource,          ///<Relay tells from which server the next message comes
+};
+
+#ifndef _WIN32
+///Magic number in ShmControl::magic, set when the segment is ready
+#define SHM_MAGIC 0x4D6F4465
+
+///Control block at start of the shared-memory segment of MODEPP_START_SHM. It is followed by the
+///server-to-client ring (outSize bytes) and the client-to-server ring (inSize bytes). Rings carry the
+///normal protocol-messages. Positions are free-running byte-counters, ring-offset is position % size.
+///Each position is written by one side only, so both rings are lock-free single-producer/single-consumer.
+///A client sets outTail=outHead and inHead=inTail before it sets attached=1.
+struct ShmControl
+{
+    unsigned int magic;             ///<SHM_MAGIC
+    unsigned int outSize;           ///<size of server-to-client ring
+    unsigned int inSize;            ///<size of client-to-server ring
+    unsigned int attached;          ///<1 while a client reads the segment. Written by client
+    unsigned int dropped;           ///<messages dropped by server because the out-ring was full
+    char pad0[44];
+    unsigned long long outHead;     ///<end of written data in out-ring. Written by server
+    char pad1[56];
+    unsigned long long outTail;     ///<end of read data in out-ring. Written by client
+    char pad2[56];
+    unsigned long long inHead;      ///<end of written data in in-ring. Written by client
+    char pad3[56];
+    unsigned long long inTail;      ///<end of read data in in-ring. Written by server
+    char pad4[56];
 };
 
+///Reads a position or flag of ShmControl written by the other side
+template <class T> inline T shmLoad( const volatile T & v ) { return __atomic_load_n( &v, __ATOMIC_ACQUIRE ); }
+
+///Publishes a position or flag of ShmControl to the other side
+template <class T> inline void shmStore( volatile T & v, T x ) { __atomic_store_n( &v, x, __ATOMIC_RELEASE ); }
+#endif
+
 ///A client should declare this macro in order to disable server implementation.  If declared, stop here.
 #ifndef MODEPP_INCLUDE_MESSAGE_TYPES_ONLY
 
-#ifdef USING_BOOST_ASIO         // asio belongs to boost since 1.35
-  #include <boost/asio.hpp>
-  using namespace boost::asio;
-  using boost::asio::ip::tcp;
-  using namespace boost::system;
+#if defined(_WIN32) && !defined(NOMINMAX)
+  #define NOMINMAX                // windows.h, also included by asio, would define min and max as macros
+#endif
+
+#ifdef MODEPP_USE_EPOLL          // lean linux-backend: epoll event-loop and std::thread, no boost (C++11)
+  #include <thread>
+  #include <mutex>
+  #include <condition_variable>
+  #include <memory>
+  #include <system_error>
+  #include <sys/epoll.h>
+  #include <sys/timerfd.h>
+  #include <sys/eventfd.h>
+  #include <sys/socket.h>
+  #include <sys/uio.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+  #include <errno.h>
 #else
-  #include <asio.hpp>		// asio is standalone till 1.34
-  using namespace asio;
-  using asio::ip::tcp;
+  #include <utility>              // asio's awaitable.hpp (C++20) of some boost-versions misses it
+  #ifdef USING_BOOST_ASIO         // asio belongs to boost since 1.35
+    #include <boost/asio.hpp>
+    using namespace boost::asio;
+    using boost::asio::ip::tcp;
+    using namespace boost::system;
+  #else
+    #include <asio.hpp>		// asio is standalone till 1.34
+    using namespace asio;
+    using asio::ip::tcp;
+  #endif
+  #include <boost/bind.hpp>
+  #include <boost/foreach.hpp>
+  #include <boost/thread/thread.hpp>
+  #include <boost/thread/mutex.hpp>
+  #include <boost/thread/condition_variable.hpp>
+  #include <boost/thread/tss.hpp>
+  #include <boost/shared_ptr.hpp>
+  #include <boost/scoped_ptr.hpp>
+  #include <boost/array.hpp>
+  #define foreach BOOST_FOREACH
 #endif
 
 #include <iostream>
-#include <boost/bind.hpp>
 #include <sstream>
-#include <boost/foreach.hpp>
-#include <boost/bind.hpp>
-#include <boost/thread/mutex.hpp>
 #include <list>
-#define foreach BOOST_FOREACH
+#include <map>
+#include <set>
+#include <vector>
 #include <iomanip>
 #include <iterator>
-#include <iostream>
-#include <boost/thread/thread.hpp>
-#include <boost/thread/mutex.hpp>
-#include <boost/shared_ptr.hpp>
 #include <memory>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <cctype>
+#ifdef _WIN32
+  #include <windows.h>            // QueryPerformanceCounter, Sleep
+#else
+  #include <time.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <pthread.h>
+  #include <execinfo.h>
+  #include <poll.h>
+#endif
+#ifdef __linux__
+  #include <dirent.h>
+  #include <sys/ioctl.h>
+  #include <linux/sockios.h>
+  #include <sched.h>
+#endif
+#include <new>
+#if !defined(MODEPP_NO_COROUTINES) && defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+  #define MODEPP_COROUTINES             // coroutine test-functions (C++20), see Coroutine test-functions
+  #include <coroutine>
+  #include <exception>
+#endif
+
+///Threading primitives of selected backend
+namespace modepp
+{
+#ifdef MODEPP_USE_EPOLL
+        typedef std::mutex mutex;
+        typedef std::lock_guard<std::mutex> scoped_lock;
+        typedef std::unique_lock<std::mutex> unique_lock;
+        typedef std::condition_variable condition;
+        typedef std::thread thread;
+        using std::shared_ptr;
+#else
+        typedef boost::mutex mutex;
+        typedef boost::mutex::scoped_lock scoped_lock;
+        typedef boost::unique_lock<boost::mutex> unique_lock;
+        typedef boost::condition_variable condition;
+        typedef boost::thread thread;
+        using boost::shared_ptr;
+#endif
+
+        ///Sequentially consistent access to counters and pointers, which threads share without lock.
+        ///Builtins of gcc and clang, Interlocked-functions of MSVC
+#ifdef _MSC_VER
+        template <class T> inline T atomicLoad( const volatile T & v ) { T x = v; MemoryBarrier(); return x; }
+        inline void atomicStore( volatile unsigned long & v, unsigned long x ) { InterlockedExchange( (volatile LONG *)&v, (LONG)x ); }
+        template <class T> inline void atomicStore( T * volatile & v, T * x ) { InterlockedExchangePointer( (void * volatile *)&v, (void *)x ); }
+        inline unsigned long atomicAdd( volatile unsigned long & v, unsigned long d ) { return (unsigned long)InterlockedExchangeAdd( (volatile LONG *)&v, (LONG)d ) + d; }
+#else
+        template <class T> inline T atomicLoad( const volatile T & v ) { return __atomic_load_n( &v, __ATOMIC_SEQ_CST ); }
+        template <class T> inline void atomicStore( volatile T & v, T x ) { __atomic_store_n( &v, x, __ATOMIC_SEQ_CST ); }
+        inline unsigned long atomicAdd( volatile unsigned long & v, unsigned long d ) { return __atomic_add_fetch( &v, d, __ATOMIC_SEQ_CST ); }
+#endif
+}
 
 using std::setw;
 using std::hex;
@@ -111,18 +467,134 @@ using std::string;
 using std::stringstream;
 
 ///Version/Info String
-static const std::string MoDePP_Version="0.02 "__DATE__;
+static const std::string MoDePP_Version="0.02 " __DATE__;
+
+///Staged trace-bytes of one thread, after which the thread sends them as MsgTraceBatch
+#ifndef MODEPP_TRACE_BATCH_BYTES
+  #define MODEPP_TRACE_BATCH_BYTES 4096
+#endif
+
+///Interval in milliseconds in which the server sends trace-records of all threads
+#ifndef MODEPP_TRACE_FLUSH_MS
+  #define MODEPP_TRACE_FLUSH_MS 50
+#endif
+
+///Size of the server-to-client ring of MODEPP_START_SHM
+#ifndef MODEPP_SHM_RING_BYTES
+  #define MODEPP_SHM_RING_BYTES (1<<20)
+#endif
+
+///Interval in milliseconds in which the server polls the client-to-server ring of MODEPP_START_SHM
+#ifndef MODEPP_SHM_POLL_MS
+  #define MODEPP_SHM_POLL_MS 5
+#endif
+
+///Interval in milliseconds of the statistics sent while a load test is running
+#ifndef MODEPP_LOAD_REPORT_MS
+  #define MODEPP_LOAD_REPORT_MS 1000
+#endif
+
+///Maximal number of threads of a load test
+#ifndef MODEPP_LOAD_MAX_THREADS
+  #define MODEPP_LOAD_MAX_THREADS 256
+#endif
+
+///Every n-th allocation of a thread records its call-stack, 0 disables allocation-sites
+#ifndef MODEPP_ALLOC_SAMPLE
+  #define MODEPP_ALLOC_SAMPLE 64
+#endif
+
+///Number of threads with own allocation-counters. Further threads share one slot
+#ifndef MODEPP_ALLOC_MAX_THREADS
+  #define MODEPP_ALLOC_MAX_THREADS 256
+#endif
+
+///Size of table of allocation-sites
+#ifndef MODEPP_ALLOC_SITES
+  #define MODEPP_ALLOC_SITES 1024
+#endif
+
+///Default interval in milliseconds of process metrics, 0: not sent till client sends MsgSetMetrics
+#ifndef MODEPP_METRICS_MS
+  #define MODEPP_METRICS_MS 0
+#endif
+
+///Maximal size of MsgDumpChunk data
+#ifndef MODEPP_DUMP_CHUNK_BYTES
+  #define MODEPP_DUMP_CHUNK_BYTES 16384
+#endif
+
+///Bytes queued for a slow client, above which trace-batches are dropped
+#ifndef MODEPP_SEND_HIGH_WATERMARK
+  #define MODEPP_SEND_HIGH_WATERMARK (1<<20)
+#endif
+
+///Bytes queued for a slow client, below which trace-batches are sent again
+#ifndef MODEPP_SEND_LOW_WATERMARK
+  #define MODEPP_SEND_LOW_WATERMARK (256<<10)
+#endif
+
+///Bytes queued for a slow client, above which it is disconnected
+#ifndef MODEPP_SEND_MAX_QUEUE
+  #define MODEPP_SEND_MAX_QUEUE (16<<20)
+#endif
+
+///Idle time in seconds of a TCP-connection, after which keepalive-probes detect a vanished client
+#ifndef MODEPP_KEEPALIVE_S
+  #define MODEPP_KEEPALIVE_S 10
+#endif
+
+///Server sends MsgHeartbeat if it sent nothing else for this time in milliseconds, 0 disables heartbeats
+#ifndef MODEPP_HEARTBEAT_MS
+  #define MODEPP_HEARTBEAT_MS 0
+#endif
+
+///Client is disconnected if it sent nothing for this time in milliseconds, 0 disables the timeout
+#ifndef MODEPP_IDLE_TIMEOUT_MS
+  #define MODEPP_IDLE_TIMEOUT_MS 0
+#endif
+
+///Startup-policies, see MODEPP_STARTUP
+#define MODEPP_STARTUP_STATIC   0       ///<start-macro starts the server during static initialization
+#define MODEPP_STARTUP_LAZY     1       ///<server starts on first trace or by MODEPP_START_NOW
+#define MODEPP_STARTUP_EXPLICIT 2       ///<server starts only by MODEPP_START_NOW
+
+///Startup-policy of the start-macros. May be overridden by environment-variable MODEPP_STARTUP=static|lazy|explicit
+#ifndef MODEPP_STARTUP
+  #define MODEPP_STARTUP MODEPP_STARTUP_STATIC
+#endif
+
+///Trace-shard layouts, see MODEPP_TRACE_SHARDS
+#define MODEPP_TRACE_SHARDS_NONE 0      ///<each thread sends its batches itself
+#define MODEPP_TRACE_SHARDS_NODE 1      ///<one shard with sender-thread per NUMA node
+#define MODEPP_TRACE_SHARDS_CPU  2      ///<one shard with sender-thread per CPU
+
+///Trace-shard layout. May be overridden by environment-variable MODEPP_TRACE_SHARDS=none|node|cpu
+#ifndef MODEPP_TRACE_SHARDS
+  #define MODEPP_TRACE_SHARDS MODEPP_TRACE_SHARDS_NONE
+#endif
+
+///Start server, configured by a start-macro, immediately. E.g. in main() after daemonising
+#define MODEPP_START_NOW() MoDePP::instance().startNow();
 
 ///Use this macro one time in order to start MoDe++ server
 #define MODEPP_START( port ) static int DummyIntUsedForStartingServer=MoDePP::instance().start(port);\
 struct DummyClassUsedForSurpressingWarning{ int i;DummyClassUsedForSurpressingWarning():i(DummyIntUsedForStartingServer){} };
 
+///Same as MODEPP_START, but the server listens on a unix domain socket at given path
+#define MODEPP_START_LOCAL( path ) static int DummyIntUsedForStartingServer=MoDePP::instance().startLocal(path);\
+struct DummyClassUsedForSurpressingWarning{ int i;DummyClassUsedForSurpressingWarning():i(DummyIntUsedForStartingServer){} };
+
+///Same as MODEPP_START, but messages are exchanged over POSIX shared-memory segment with given name (see ShmControl)
+#define MODEPP_START_SHM( name ) static int DummyIntUsedForStartingServer=MoDePP::instance().startShm(name);\
+struct DummyClassUsedForSurpressingWarning{ int i;DummyClassUsedForSurpressingWarning():i(DummyIntUsedForStartingServer){} };
+
 ///Begin test-function without parameters
 #define MODEPP_BEGIN_TEST_FUNCTION( FN ) \
 namespace testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &, const VarParam &, const VarParam &, const VarParam &, const VarParam &){
 
 
@@ -131,7 +603,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &, const VarParam &, const VarParam &, const VarParam &, const VarParam &){\
 FN();\
 }};static CCbWrapper cbwrapper;}
@@ -142,7 +614,7 @@ FN();\
 namespace testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){ _parameters=#P1; testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1; testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam & (P1), const VarParam &, const VarParam &, const VarParam &, const VarParam &){
 
 ///One line test-function with 1 parameter
@@ -150,7 +622,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &, const VarParam &, const VarParam &, const VarParam &){\
 FN(P1);\
 }};static CCbWrapper cbwrapper;}
@@ -160,7 +632,7 @@ FN(P1);\
 namespace testFunction_ns_##FN{\
         const char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &, const VarParam &, const VarParam &){
 
 ///One line test-function with 2 parameters
@@ -168,7 +640,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &, const VarParam &, const VarParam &){\
 FN(P1,P2);\
 }};static CCbWrapper cbwrapper;}
@@ -179,7 +651,7 @@ FN(P1,P2);\
 namespace testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &, const VarParam &){
 
 ///One line test-function with 3 parameters
@@ -187,7 +659,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &, const VarParam &){\
 FN(P1,P2,P3);\
 }};static CCbWrapper cbwrapper;}
@@ -198,7 +670,7 @@ FN(P1,P2,P3);\
 namespace testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam & P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &){
 
 ///One line test-function with 4 parameters
@@ -206,7 +678,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &){\
 FN(P1,P2,P3,P4);\
 }};static CCbWrapper cbwrapper;}
@@ -217,7 +689,7 @@ FN(P1,P2,P3,P4);\
 namespace testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4" "#P5;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4" "#P5;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam & P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &P5){
 
 ///One line test-function with 5 parameters
@@ -225,7 +697,7 @@ namespace testFunction_ns_##FN{\
 namespace simple_testFunction_ns_##FN{\
         const  char *testFunction_ns_fn=0;\
         struct CCbWrapper:public ITestFunctionWrapper{\
-                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4" "#P5;testFunction_ns_fn = fn;MoDePP::instance().addFunction( fn, this );}\
+                CCbWrapper( const char * fn=#FN ){_parameters=#P1" "#P2" "#P3" "#P4" "#P5;testFunction_ns_fn = fn;registerFunction( fn );}\
                 virtual void testFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &P5){\
 FN(P1,P2,P3,P4,P5);\
 }};static CCbWrapper cbwrapper;}
@@ -234,9 +706,128 @@ FN(P1,P2,P3,P4,P5);\
 ///End test-function
 #define MODEPP_END_TEST_FUNCTION  }};static CCbWrapper cbwrapper;}
 
-///Send data to client tagged as "return-value". Value is sent with function-name.
-#define MODEPP_RETURN_TEST_FUNCTION( VAL ) { std::stringstream s; s<<testFunction_ns_fn<<" "<<VAL;\
-            MoDePP::instance().send( MsgReturn, s.str() ); }
+///Asynchronous test-function. The body runs in an own thread, so it may take long without blocking the server.
+///It runs in the scope of its call-id, may report by MODEPP_PROGRESS and should stop when MODEPP_CANCELLED.
+///When the body is finished, MsgCallDone is sent. End it with MODEPP_END_TEST_FUNCTION.
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION( FN ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &, const VarParam &, const VarParam &, const VarParam &, const VarParam &){
+
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION1( FN, P1 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &P1, const VarParam &, const VarParam &, const VarParam &, const VarParam &){
+
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION2( FN, P1, P2 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &P1, const VarParam &P2, const VarParam &, const VarParam &, const VarParam &){
+
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION3( FN, P1, P2, P3 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &, const VarParam &){
+
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION4( FN, P1, P2, P3, P4 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3" "#P4; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &){
+
+#define MODEPP_BEGIN_ASYNC_TEST_FUNCTION5( FN, P1, P2, P3, P4, P5 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public IAsyncTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3" "#P4" "#P5; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual void asyncTestFunction(const VarParam &P1, const VarParam &P2, const VarParam &P3, const VarParam &P4, const VarParam &P5){
+
+#ifdef MODEPP_COROUTINES
+///Coroutine test-function (C++20). The body runs in the server-thread and may co_await modeppSleep,
+///modeppReadable/modeppWritable, modeppCall or other CoroTasks without blocking it. Parameters are copies.
+///It runs in the scope of its call-id like an asynchronous one. End it with MODEPP_END_CORO_TEST_FUNCTION.
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION( FN ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam, VarParam, VarParam, VarParam, VarParam){
+
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION1( FN, P1 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam P1, VarParam, VarParam, VarParam, VarParam){
+
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION2( FN, P1, P2 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam P1, VarParam P2, VarParam, VarParam, VarParam){
+
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION3( FN, P1, P2, P3 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam P1, VarParam P2, VarParam P3, VarParam, VarParam){
+
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION4( FN, P1, P2, P3, P4 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3" "#P4; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam P1, VarParam P2, VarParam P3, VarParam P4, VarParam){
+
+#define MODEPP_BEGIN_CORO_TEST_FUNCTION5( FN, P1, P2, P3, P4, P5 ) \
+namespace testFunction_ns_##FN{\
+        const  char *testFunction_ns_fn=0;\
+        struct CCbWrapper:public ICoroTestFunctionWrapper{\
+                CCbWrapper( const char * fn=#FN ){ _parameters=#P1" "#P2" "#P3" "#P4" "#P5; testFunction_ns_fn = fn;registerFunction( fn );}\
+                virtual CoroTask coroTestFunction(VarParam P1, VarParam P2, VarParam P3, VarParam P4, VarParam P5){
+
+///End coroutine test-function. The co_return makes a body without co_await a coroutine too
+#define MODEPP_END_CORO_TEST_FUNCTION  co_return; }};static CCbWrapper cbwrapper;}
+#endif
+
+///Send partial result or progress of the running call to client. Traces of calling thread are sent before.
+#define MODEPP_PROGRESS( VAL ) { std::stringstream s; s<<VAL;\
+            MoDePP::instance().flushThreadTraces();\
+            MoDePP::instance().sendProgress( s.str() ); }
+
+///True if client cancelled the running call. Long-running functions should check it and return
+#define MODEPP_CANCELLED MoDePP::instance().cancelled()
+
+///Register object for MsgDump. In namespace-scope it registers during static initialization
+#define MODEPP_EXPOSE( NAME, OBJ ) static int modepp_exposed_##NAME = modeppExpose( #NAME, OBJ, modeppNullLock() );
+
+///Register object, which is guarded by a mutex (any type with lock() and unlock()), for MsgDump
+#define MODEPP_EXPOSE_LOCKED( NAME, OBJ, MX ) static int modepp_exposed_##NAME = modeppExpose( #NAME, OBJ, MX );
+
+///Send data to client tagged as "return-value". Value is sent with function-name and call-id of the thread.
+///Traces of calling thread are sent before, so they don't arrive after the return.
+///The return is formatted into the reusable output-buffer of the thread.
+#define MODEPP_RETURN_TEST_FUNCTION( VAL ) { std::string & modeppOut = MoDePP::instance().outputBuffer(); modeppOut.clear();\
+            { ModeppStringStream modeppStream( modeppOut ); modeppStream<<testFunction_ns_fn<<" "<<VAL; }\
+            MoDePP::instance().flushThreadTraces();\
+            MoDePP::instance().sendReturn( modeppOut ); }
+
+///Call-id of the running test-function (0 if it was called without id)
+#define MODEPP_CALL_ID MoDePP::instance().callId()
+
+///Continues call with given id in the current scope, e.g. in a worker-thread. Traces and returns are tagged with it
+#define MODEPP_CALL_SCOPE( ID ) CallScope modepp_call_scope( ID );
 
 ///Static initialization. Code here will be executed before main()
 #define MODEPP_BEGIN_STATIC_INITIALISATION( BN ) \
@@ -245,28 +836,59 @@ namespace Initializer_ns_##BN{ struct Initializer{ Initializer(){
 ///End static initialization
 #define MODEPP_END_STATIC_INITIALISATION }};static Initializer initializer;}
 
-///TODO: add a variable to be used by client as valid value for a parameter
+///Adds a valid value for parameters named PName. Clients offer it by the name of VName (see Parameter enums)
 #define MODEPP_ADD_PARAM_ENUM( PName, VName )  MoDePP::instance().addParamEnum( PName, #VName, VarParam( VName ) ); 
 
-///Send data to client tagged as "trace-value".
+///Send data to client tagged as "trace-value". Value is staged in thread's trace-buffer.
 #define MODEPP_TRACE( VAL ){ \
-	MoDePP::instance().send( MsgTrace, VAL ); }
+	MoDePP::instance().trace( VAL ); }
 
 ///Same as above, but with a prefix string.
 #define MODEPP_TRACE2( MSG, VAL ){ \
-	MoDePP::instance().send( MsgTrace, MSG + VarParam( VAL).toString() ); }	
+	MoDePP::instance().trace( MSG + VarParam( VAL).toString() ); }	
+
+///Send staged trace-records of the calling thread immediately
+#define MODEPP_FLUSH_TRACES MoDePP::instance().flushThreadTraces();
 
 ///Simple variant-value class. Contains value as string, able to convert it implicitely to different types.
 class VarParam
 {
 	std::string _value;
 	public:
+	VarParam(){}
 	VarParam( const std::string & v):_value(v){}
-	VarParam( int v){std::stringstream str; str << v; _value=str.str(); }
+	VarParam( int v){ char buf[16]; sprintf( buf, "%d", v ); _value=buf; }
 	operator const std::string &() const {return _value;}
 	const std::string & toString() const {return _value;}
-	operator int() const { std::stringstream str(_value); int ival=0; str >> ival; return ival; }
-	int toInt() const { std::stringstream str(_value); int ival=0; str >> ival; return ival; }
+	///Value for assigning in place, so its capacity is reused
+	std::string & str() {return _value;}
+	operator int() const { return toInt(); }
+	int toInt() const
+	{
+	        long v = strtol( _value.c_str(), 0, 10 );
+	        return (int)std::max<long>( std::min<long>( v, std::numeric_limits<int>::max() ), std::numeric_limits<int>::min() );
+	}
+};
+
+///Output-stream appending to a string, e.g. to the reusable output-buffer of a thread. Allocates nothing itself
+class ModeppStringStream: private std::streambuf, public std::ostream
+{
+        std::string & _s;
+
+        int overflow( int c )
+        {
+                if ( c != std::streambuf::traits_type::eof() )
+                        _s += (char)c;
+                return c;
+        }
+
+        std::streamsize xsputn( const char * p, std::streamsize n )
+        {
+                _s.append( p, n );
+                return n;
+        }
+public:
+        ModeppStringStream( std::string & s ):std::ostream( this ),_s(s){}
 };
 
 
@@ -277,298 +899,4581 @@ struct ITestFunctionWrapper
         virtual void testFunction(const VarParam &, const VarParam &, const VarParam &, const VarParam &, const VarParam &)=0;
 
         ///names separated by space. sent to client along with corresponding function-name
-        std::string _parameters;
+        const char * _parameters;
+
+        const char * _name;                     ///<function-name
+        ITestFunctionWrapper * _next;           ///<next entry in list of registrations
+
+        ITestFunctionWrapper():_parameters(""),_name(""),_next(0){}
+        virtual ~ITestFunctionWrapper(){}
+
+        ///Head of the list of registered test-functions. Constant-initialized, so it is valid before any constructor runs
+        static ITestFunctionWrapper *& registrations()
+        {
+                static ITestFunctionWrapper * head = 0;
+                return head;
+        }
+
+        ///Links wrapper into list of registrations. Called by the macros during static initialization:
+        ///takes no lock and allocates nothing. MoDePP builds its function-table from the list on first use.
+        void registerFunction( const char * name )
+        {
+                _name = name;
+                _next = registrations();
+                registrations() = this;
+        }
 };
 
-///States of simple message-receiver state machine
-enum ReadState
+///Orders test-functions by name
+inline bool functionNameLess( const ITestFunctionWrapper * a, const ITestFunctionWrapper * b )
 {
-            WaitingHeader,      ///<waiting till minimum number of bytes arrive
-            WaitingMsgComplete, ///<waiting till data with length specified in header arrive
-            ProcessingMessage   ///<read one message from data and return to WaitingHeader
-};
+        return strcmp( a->_name, b->_name ) < 0;
+}
 
-/// Class for reading given number of bytes from stream into any (currently int/string) data type
-class FixedLengthValue
+///Interface for asynchronous test-function. testFunction starts asyncTestFunction in an own thread
+struct IAsyncTestFunctionWrapper: public ITestFunctionWrapper
 {
-        mutable int unused_int;
-        mutable std::string tmp;
-        mutable int & _val;
-        mutable std::string & _sval;
-        mutable int _len;
-        mutable bool _readInt;
+        ///Abstract method. Implemented as wrapper of the function which should be tested.
+        virtual void asyncTestFunction(const VarParam &, const VarParam &, const VarParam &, const VarParam &, const VarParam &)=0;
 
-        public: FixedLengthValue( int & i, int len ):_val(i),_sval(tmp),_len(len),_readInt(true){};
-        public: FixedLengthValue( std::string & s, int len ):_val(unused_int),_sval(s),_len(len),_readInt(false){};        
+        ///Starts the call. Implemented after MoDePP
+        virtual void testFunction(const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5);
+};
 
-    public: std::istream& process (std::istream& strm ) const
+#ifdef MODEPP_COROUTINES
+///Coroutine of a coroutine test-function or of a helper, which a coroutine awaits by co_await. It starts when
+///it is awaited (a test-function: when it is called) and resumes the awaiting coroutine when it is finished.
+///The task owns the frame. Exceptions of the body are thrown again to the awaiting coroutine
+class CoroTask
+{
+public:
+        struct promise_type
         {
-                if (_len < 0)
-                        return strm;
+                std::coroutine_handle<> continuation;   ///<awaiting coroutine, none for a test-function
+                std::exception_ptr error;               ///<exception which ended the body
 
-                char *buf = new char[_len+1];
-                strm.get(buf, _len+1);
-                tmp = buf;
-                delete[] buf;
-                if(_readInt)
+                ///Continues with the awaiting coroutine. A test-function returns to the CoroExecutor
+                struct FinalAwaiter
                 {
-                        std::stringstream ostr(tmp);
-                        ostr >> std::hex >> _val;
-                        return strm;
-                }
-                _sval = tmp;
-                return strm;
+                        bool await_ready() noexcept { return false; }
+                        std::coroutine_handle<> await_suspend( std::coroutine_handle<promise_type> h ) noexcept
+                        {
+                                std::coroutine_handle<> c = h.promise().continuation;
+                                return c ? c : std::noop_coroutine();
+                        }
+                        void await_resume() noexcept {}
+                };
+
+                CoroTask get_return_object() { return CoroTask( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+                std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+                FinalAwaiter final_suspend() noexcept { return FinalAwaiter(); }
+                void return_void() {}
+                void unhandled_exception() { error = std::current_exception(); }
+        };
+        typedef std::coroutine_handle<promise_type> Handle;
+
+        CoroTask( CoroTask && t ) noexcept :_h(t._h) { t._h = Handle(); }
+        ~CoroTask() { if ( _h ) _h.destroy(); }
+
+        ///Hands the frame over to the caller
+        Handle release() { Handle h = _h; _h = Handle(); return h; }
+
+        bool await_ready() const noexcept { return !_h || _h.done(); }
+
+        ///Runs the task in place of the awaiting coroutine
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+        {
+                _h.promise().continuation = awaiting;
+                return _h;
         }
-};	
 
-///Main MoDe++ singleton-class. Contains Lists of test-functions, tcp-server.
-class MoDePP
-{	
-    boost::shared_ptr <tcp::socket> _socket;
-	io_service _service;
-	std::auto_ptr<tcp::acceptor> _acceptor;
-	std::auto_ptr<boost::thread> _thread;
-	unsigned short _port;
+        void await_resume()
+        {
+                if ( _h && _h.promise().error )
+                        std::rethrow_exception( _h.promise().error );
+        }
+private:
+        Handle _h;
 
-        ///Pair for traversing map usinf boost's foreach
-		typedef std::pair<std::string, ITestFunctionWrapper*> FuncMapEntry;
+        explicit CoroTask( Handle h ):_h(h){}
+        CoroTask(const CoroTask &);
+        CoroTask& operator=(const CoroTask &);
+};
 
-        ///Paid maps variable-name to its value
-        typedef std::list< std::pair<std::string, VarParam> > TVarValues;
+///Interface for coroutine test-function. testFunction starts coroTestFunction in the server's CoroExecutor
+struct ICoroTestFunctionWrapper: public ITestFunctionWrapper
+{
+        ///Abstract method. Implemented as coroutine, which wraps the function which should be tested.
+        virtual CoroTask coroTestFunction(VarParam, VarParam, VarParam, VarParam, VarParam)=0;
 
-        ///Map of parameters and their valid lists of values
-        typedef std::map< std::string, TVarValues > TParVarValues;
+        ///Starts the call. Implemented after MoDePP
+        virtual void testFunction(const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5);
+};
+#endif
 
-        ///TODO: unused now.
-	TParVarValues _paramValues;
+///Writes value for MsgDump. Specialize for own types, which have no operator<<
+template <class T> struct ModeppFormat
+{
+        static void write( std::ostream & o, const T & v ) { o << v; }
+};
 
-        ///Map of function-name to function-pointer wrapper and parameter list
-        typedef std::map<std::string,  ITestFunctionWrapper*> FuncMap;
-	FuncMap functionMap;
-	
-        bool _stop;             ///<stop MoDe++ server
-        std::string _data;      ///<Buffer of received data
+///Entry of a map: <key>=<value>
+template <class K, class V> struct ModeppFormat< std::pair<K,V> >
+{
+        static void write( std::ostream & o, const std::pair<K,V> & v )
+        {
+                ModeppFormat<K>::write( o, v.first );
+                o << "=";
+                ModeppFormat<V>::write( o, v.second );
+        }
+};
 
-        ReadState _readState;   ///<current state of receiving state machine
-        int _expectedLength;    ///<after fixed-size header is read, this variable contains length of message
+///Detects containers (types with const_iterator). Strings are values
+template <class T> struct ModeppIsContainer
+{
+        template <class U> static char test( typename U::const_iterator * );
+        template <class U> static long test( ... );
+        enum { value = sizeof( test<T>( 0 ) ) == sizeof( char ) };
+};
+template <> struct ModeppIsContainer<std::string> { enum { value = 0 }; };
 
-        MoDePP(const MoDePP &); ///<Private copy-constructor - singleton
-        MoDePP& operator=(const MoDePP &); ///<Private op= - singleton
-        ///Constructor
-	MoDePP():_port(4545),_stop(false), _readState(WaitingHeader),_expectedLength(0)
-	{
-	
-	}
-	
-	///d-tor
-	~MoDePP()
-	{
-	        stop();
-	}
-	
-	///Waits for commands and processes them
-	void doWork()
-	{
-	        char data[1024];
-	        error_code error;
-	        while(!_stop)
-	        {
-	                _socket = boost::shared_ptr <tcp::socket>( new tcp::socket(_service) );
-	                _acceptor->accept( *_socket );
-	                while(!_stop)
-	                {
-	
-	                        size_t length = _socket->read_some(buffer(data, sizeof(data)/sizeof(data[0])), error);
-	                        if (error)
-	                        {
-	                                break;
-	                        }
-	                        std::string readdata( data, length );
-	                        _data+=readdata;
-	                        while ( _data.length() >= HEADER_LEN )
-	                        {
-	                            int command=-1;
-	                            //std::cout << "DATA:["<<_data<<"]"<<std::endl;
-	                            if ( _readState == WaitingHeader  )
-	                            {
-	                                //std::cout << "WaitingHeader"<<std::endl;
-	                                std::string header(_data.begin(),_data.begin()+HEADER_LEN);
-	                                _data.erase(0,HEADER_LEN);
-	
-	                                std::stringstream s(header);
-	                                _expectedLength=0;
-	                                s >>hex;
-	                                FixedLengthValue(_expectedLength,4).process(s); 
-	                                s >> hex;
-	                                FixedLengthValue(command,4).process(s);
-	
-	
-	                                //std::cout << "DATA:["<<_data<<"]"<<_expectedLength<<std::endl;
-	                                if ( _expectedLength >= 0)
-	                                {
-	                                    _readState = WaitingMsgComplete;
-	                                }
-	                                else
-	                                {
-	                                    _data.clear();
-	                                    break; //todo: error in stream? an now?
-	                                }
-	
-	                            }
-	                            if ( _readState == WaitingMsgComplete  )
-	                            {
-	                                //std::cout << "WaitingMsgComplete"<<std::endl;
-	                                if( _data.length() >= (size_t)_expectedLength )
-	                                {
-	                                    _readState = ProcessingMessage;
-	                                }
-	                                else break;
-	                            }
-	                            if ( _readState == ProcessingMessage  )
-	                            {
-	                                std::string msgdata( _data.begin(), _data.begin()+_expectedLength );
-	
-	                                //std::cout << "DATA:["<<_data<<"]"<<_expectedLength<<std::endl;
-	                                //std::cout << "Processing:["<<msgdata<<"]"<<std::endl<<std::flush;
-	                                _data.erase( 0, _expectedLength );
-	                                _expectedLength=0;
-	                                _readState = WaitingHeader;
-	
-	                                if ( command == MsgGetVersion )
-	                                {
-	                                        send( MsgVersion, MoDePP_Version );
-	                                }
-	                                else if (command == MsgListFunctions)
-	                                {
-	                                    //std::cout << "Processing MsgListFunctions"<<std::endl;
-	                                    foreach (   FuncMapEntry fe, functionMap )
-	                                    {
-	                                        std::stringstream msgdata;
-	                                        msgdata<<hex << setw(4)<<setfill('0')<<fe.first.length()+fe.second->_parameters.length()+1 // fname+" "+params
-	                                                <<hex << setw(4)<<setfill('0')<<MsgAddFunction<<fe.first<<" "<<fe.second->_parameters;
-	                                        send( msgdata.str() );
-	                                    }
-	                                }
-	                                else if (command == MsgCallFunction)
-	                                {
-	                                    //std::cout << "Processing MsgCallFunction"<<std::endl;
-	                                    std::string fname;
-	                                    int len=0;
-	
-	                                    std::stringstream sstr(msgdata);
-	                                    FixedLengthValue(len,4).process( sstr );
-	                                    FixedLengthValue(fname,len).process( sstr );
-	                                    //std::cout << "   "<<len<<" "<<fname<<std::endl;
-	                                    std::string param1,param2,param3,param4,param5;
-	                                    std::string *params[]={&param1,&param2,&param3,&param4,&param5};
-	
-	                                    int pidx=0;
-	                                    while ( sstr.good() && !sstr.eof() && pidx < 5 )
-	                                    {
-	                                        FixedLengthValue(len,4).process( sstr );
-	                                        FixedLengthValue(*params[pidx++],len).process( sstr );
-	                                    }
-	                                    FuncMap::iterator it = functionMap.find( fname );
-	                                    if ( it != functionMap.end()  )
-	                                    {
-	                                            it->second->testFunction(param1,param2,param3,param4,param5);
-	                                    }
-	                                    else
-	                                    {
-	                                        cout << "Error! no such Function: "<<fname << endl;
-	                                    }                                    
-	                                }
-	                                else
-	                                {
-	                                    //todo error! unknown command
-	                                    std::cout << "error! unknown command"<<std::endl;
-	                                }
-	                            }
-	
-	                        }
-	                }
-	        }
-	        _thread->join();
-	}	 
-public:	
-	///Creates and returns singleton instance
-	static MoDePP & instance()
-	{
-			static 	boost::mutex _mx;
-	        static MoDePP inst;
-	        
-	        boost::mutex::scoped_lock lock(_mx);
-	        return inst;
-	}
-	
-	// Starts the server (return value is dummy, required for calling the function as static-initializer).
-	int start( unsigned short p )
-	{
-	         if (! _thread.get() )
-	         {
-	                _port = p;
-	                _acceptor = std::auto_ptr<tcp::acceptor>( new tcp::acceptor( _service, tcp::endpoint(tcp::v4(), _port )) );
-	                _thread =  std::auto_ptr<boost::thread>(  new boost::thread ( boost::bind( &MoDePP::doWork, this ) )  );
-	         }
-	         return 0;
-	}
-	
-	//Stops the server (hardly required in the praxis)
-	void stop()
-	{
-	        _stop=true;
-	        if ( _thread.get() )
-	        {
-	                _service.stop();
-	                _thread->join();
-	        }
-	}
-	
-	
-	void send( const std::string & data )
-	{
-	        if ( _socket.get() )
-	        {
-	                //std::cout << "SEND: "<<data << std::endl;
-	                write(*_socket, buffer(data));
-	        }
-	}
-	
-	
-	void send( CommandNumber cmd, int value )
-	{
-	        if ( _socket.get() )
-	        {
-	                std::stringstream s;
-	                s << value;
-	                send ( cmd, s.str() );
-	        }
-	}
+///Detects sorted associative containers (types with key_compare)
+template <class T> struct ModeppIsAssociative
+{
+        template <class U> static char test( typename U::key_compare * );
+        template <class U> static long test( ... );
+        enum { value = sizeof( test<T>( 0 ) ) == sizeof( char ) };
+};
+
+///Detects maps (types with mapped_type)
+template <class T> struct ModeppIsMap
+{
+        template <class U> static char test( typename U::mapped_type * );
+        template <class U> static long test( ... );
+        enum { value = sizeof( test<T>( 0 ) ) == sizeof( char ) };
+};
+
+///Detects hashed associative containers (types with hasher)
+template <class T> struct ModeppIsHashed
+{
+        template <class U> static char test( typename U::hasher * );
+        template <class U> static long test( ... );
+        enum { value = sizeof( test<T>( 0 ) ) == sizeof( char ) };
+};
+
+///Key of a container-entry: first of maps' entries, the entry of sets
+template <class C, bool IsMap> struct ModeppKeyOf
+{
+        static const typename C::key_type & get( const typename C::value_type & v ) { return v.first; }
+};
+template <class C> struct ModeppKeyOf<C, false>
+{
+        static const typename C::key_type & get( const typename C::value_type & v ) { return v; }
+};
+
+///Lock for objects exposed without mutex
+struct ModeppNullLock
+{
+        void lock() {}
+        void unlock() {}
+};
+inline ModeppNullLock & modeppNullLock() { static ModeppNullLock l; return l; }
+
+///Locks a mutex for one chunk of a dump
+template <class Lock> class ModeppChunkLock
+{
+        Lock & _l;
+public:
+        ModeppChunkLock( Lock & l ):_l(l) { _l.lock(); }
+        ~ModeppChunkLock() { _l.unlock(); }
+};
+
+///Running dump of an exposed object
+struct IDumpSession
+{
+        ///Writes next entries into chunk (at most MODEPP_DUMP_CHUNK_BYTES). Returns false if the object is complete
+        virtual bool next( std::string & chunk )=0;
+        virtual ~IDumpSession(){}
+};
+
+///Appends entry to chunk, truncated to fit. Returns false if the chunk is full
+template <class V> inline bool modeppAppendEntry( std::string & chunk, const V & v )
+{
+        std::stringstream s;
+        ModeppFormat<V>::write( s, v );
+        std::string e = s.str();
+        if ( !chunk.empty() )
+        {
+                if ( chunk.length() + 1 + e.length() > MODEPP_DUMP_CHUNK_BYTES )
+                        return false;
+                chunk += '\n';
+        }
+        chunk.append( e, 0, MODEPP_DUMP_CHUNK_BYTES - chunk.length() );
+        return true;
+}
+
+///Kinds of dumps: by ModeppFormat of the object, by index of entries, by key of entries, by key in hash-order
+enum { DumpValue, DumpSequence, DumpAssociative, DumpHashed };
+
+///Dump of a value, which is not a container: one chunk
+template <class T, class Lock, int Kind> class DumpSession: public IDumpSession
+{
+        const T & _obj;
+        Lock & _lock;
+public:
+        DumpSession( const T & obj, Lock & l ):_obj(obj),_lock(l){}
+        bool next( std::string & chunk )
+        {
+                ModeppChunkLock<Lock> lock( _lock );
+                modeppAppendEntry( chunk, _obj );
+                return false;
+        }
+};
+
+///Dump of a sequence. Position is kept as index
+template <class T, class Lock> class DumpSession<T, Lock, DumpSequence>: public IDumpSession
+{
+        const T & _obj;
+        Lock & _lock;
+        size_t _index;          ///<entries sent
+public:
+        DumpSession( const T & obj, Lock & l ):_obj(obj),_lock(l),_index(0){}
+        bool next( std::string & chunk )
+        {
+                ModeppChunkLock<Lock> lock( _lock );
+                if ( _index >= _obj.size() )
+                        return false;
+                typename T::const_iterator it = _obj.begin();
+                std::advance( it, _index );
+                for ( ; it != _obj.end(); ++it, ++_index )
+                        if ( !modeppAppendEntry( chunk, *it ) )
+                                return true;
+                return false;
+        }
+};
+
+///Dump of a sorted associative container. Position is kept as last key and number of entries sent with it
+template <class T, class Lock> class DumpSession<T, Lock, DumpAssociative>: public IDumpSession
+{
+        typedef ModeppKeyOf<T, ModeppIsMap<T>::value> KeyOf;
+        const T & _obj;
+        Lock & _lock;
+        bool _started;
+        typename T::key_type _last;     ///<key of last entry sent
+        size_t _sameKey;                ///<entries with key _last sent (multimaps)
+public:
+        DumpSession( const T & obj, Lock & l ):_obj(obj),_lock(l),_started(false),_last(),_sameKey(0){}
+        bool next( std::string & chunk )
+        {
+                ModeppChunkLock<Lock> lock( _lock );
+                typename T::const_iterator it = _obj.begin();
+                if ( _started )
+                {
+                        it = _obj.lower_bound( _last );
+                        for ( size_t i = 0; i < _sameKey && it != _obj.end() && !_obj.key_comp()( _last, KeyOf::get( *it ) ); ++i )
+                                ++it;
+                }
+                for ( ; it != _obj.end(); ++it )
+                {
+                        if ( !modeppAppendEntry( chunk, *it ) )
+                                return true;
+                        const typename T::key_type & k = KeyOf::get( *it );
+                        if ( _started && !_obj.key_comp()( _last, k ) && !_obj.key_comp()( k, _last ) )
+                                ++_sameKey;
+                        else
+                        {
+                                _last = k;
+                                _sameKey = 1;
+                        }
+                        _started = true;
+                }
+                return false;
+        }
+};
+
+///Dump of a hashed container (e.g. unordered maps). Position is kept as last key and number of entries sent with
+///it, the entries after it in hash-order follow. If the key was removed, the position is found by the number sent
+template <class T, class Lock> class DumpSession<T, Lock, DumpHashed>: public IDumpSession
+{
+        typedef ModeppKeyOf<T, ModeppIsMap<T>::value> KeyOf;
+        const T & _obj;
+        Lock & _lock;
+        size_t _index;                  ///<entries sent
+        typename T::key_type _last;     ///<key of last entry sent
+        size_t _sameKey;                ///<entries with key _last sent (multimaps)
+public:
+        DumpSession( const T & obj, Lock & l ):_obj(obj),_lock(l),_index(0),_last(),_sameKey(0){}
+        bool next( std::string & chunk )
+        {
+                ModeppChunkLock<Lock> lock( _lock );
+                typename T::const_iterator it = _obj.begin();
+                if ( _index )
+                {
+                        std::pair<typename T::const_iterator, typename T::const_iterator> same = _obj.equal_range( _last );
+                        if ( same.first != same.second )
+                        {
+                                it = same.first;
+                                for ( size_t i = 0; i < _sameKey && it != same.second; ++i )
+                                        ++it;
+                        }
+                        else if ( _index < _obj.size() )
+                                std::advance( it, _index );
+                        else
+                                return false;
+                }
+                for ( ; it != _obj.end(); ++it, ++_index )
+                {
+                        if ( !modeppAppendEntry( chunk, *it ) )
+                                return true;
+                        const typename T::key_type & k = KeyOf::get( *it );
+                        if ( _index && _obj.key_eq()( _last, k ) )
+                                ++_sameKey;
+                        else
+                        {
+                                _last = k;
+                                _sameKey = 1;
+                        }
+                }
+                return false;
+        }
+};
+
+///Object registered by MODEPP_EXPOSE
+struct IExposed
+{
+        virtual IDumpSession * dump()=0;
+        virtual ~IExposed(){}
+};
+
+template <class T, class Lock> class Exposed: public IExposed
+{
+        const T & _obj;
+        Lock & _lock;
+        enum { Kind = !ModeppIsContainer<T>::value ? DumpValue : ModeppIsAssociative<T>::value ? DumpAssociative :
+                      ModeppIsHashed<T>::value ? DumpHashed : DumpSequence };
+public:
+        Exposed( const T & obj, Lock & l ):_obj(obj),_lock(l){}
+        IDumpSession * dump() { return new DumpSession<T, Lock, Kind>( _obj, _lock ); }
+};
+
+///Returns monotonic time in nanoseconds. Used for time-stamping trace-records.
+inline unsigned long long modeppTimestamp()
+{
+#ifdef _WIN32
+        LARGE_INTEGER freq, cnt;
+        QueryPerformanceFrequency( &freq );
+        QueryPerformanceCounter( &cnt );
+        return (unsigned long long)( cnt.QuadPart / freq.QuadPart ) * 1000000000ULL
+                + (unsigned long long)( cnt.QuadPart % freq.QuadPart ) * 1000000000ULL / freq.QuadPart;
+#else
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+///Waits till given monotonic time. The last 100us are spun, so open-loop schedules stay accurate
+inline void modeppSleepUntil( unsigned long long t )
+{
+        unsigned long long now = modeppTimestamp();
+        if ( t > now + 200000 )
+        {
+#ifdef _WIN32
+                Sleep( (DWORD)( ( t - now - 100000 ) / 1000000 ) );
+#else
+                unsigned long long ns = t - now - 100000;
+                timespec ts = { (time_t)( ns / 1000000000ULL ), (long)( ns % 1000000000ULL ) };
+                nanosleep( &ts, 0 );
+#endif
+        }
+        while ( modeppTimestamp() < t )
+                ;
+}
+
+///Histogram of latencies in nanoseconds with log-linear buckets: 16 buckets per power of two,
+///so a value is known with 1/16 precision. Recording is a few shifts and an increment.
+class LatencyHistogram
+{
+        enum { SubBits = 4, Sub = 1 << SubBits, Buckets = ( 64 - SubBits + 1 ) * Sub };
+        unsigned long long _counts[Buckets];
+        unsigned long long _total;
+        unsigned long long _max;
+
+        static int msb( unsigned long long v )
+        {
+#ifdef __GNUC__
+                return 63 - __builtin_clzll( v );
+#else
+                int m = 0;
+                while ( v >>= 1 )
+                        ++m;
+                return m;
+#endif
+        }
+
+        static int bucket( unsigned long long v )
+        {
+                if ( v < Sub )
+                        return (int)v;
+                int m = msb( v );
+                return ( m - SubBits + 1 ) * Sub + (int)( ( v >> ( m - SubBits ) ) & ( Sub - 1 ) );
+        }
+
+        ///Lowest value of a bucket
+        static unsigned long long lowest( int b )
+        {
+                if ( b < Sub )
+                        return b;
+                return (unsigned long long)( Sub + b % Sub ) << ( b / Sub - 1 );
+        }
+public:
+        LatencyHistogram() { clear(); }
+
+        void clear()
+        {
+                memset( _counts, 0, sizeof(_counts) );
+                _total = 0;
+                _max = 0;
+        }
+
+        void record( unsigned long long v )
+        {
+                ++_counts[ bucket( v ) ];
+                ++_total;
+                if ( v > _max )
+                        _max = v;
+        }
+
+        void add( const LatencyHistogram & h )
+        {
+                for ( int i = 0; i < Buckets; ++i )
+                        _counts[i] += h._counts[i];
+                _total += h._total;
+                _max = std::max( _max, h._max );
+        }
+
+        unsigned long long count() const { return _total; }
+
+        unsigned long long max() const { return _max; }
+
+        ///Value below which given fraction of values lies
+        unsigned long long percentile( double q ) const
+        {
+                unsigned long long target = (unsigned long long)( q * _total + 0.5 ), sum = 0;
+                for ( int i = 0; i < Buckets; ++i )
+                {
+                        sum += _counts[i];
+                        if ( sum >= target && sum )
+                                return std::min( lowest( i ), _max );
+                }
+                return _max;
+        }
+
+        ///Writes statistics in the format of MsgLoadTest reports
+        void format( std::ostream & o, unsigned long long elapsedNs ) const
+        {
+                o << "n=" << _total << " rate=" << ( elapsedNs ? _total * 1000000000ULL / elapsedNs : 0 )
+                  << " p50=" << percentile( 0.5 ) << " p90=" << percentile( 0.9 ) << " p99=" << percentile( 0.99 )
+                  << " p999=" << percentile( 0.999 ) << " max=" << _max << " hist=";
+                const char * sep = "";
+                for ( int i = 0; i < Buckets; ++i )
+                {
+                        if ( _counts[i] )
+                        {
+                                o << sep << lowest( i ) << ":" << _counts[i];
+                                sep = ",";
+                        }
+                }
+        }
+};
+
+#ifndef _WIN32
+///Allocation tracking of MODEPP_TRACK_ALLOCATIONS. State is in function-local statics of POD-type, which are
+///zero-initialized before any constructor runs, so allocations during static initialization are counted too.
+///Tracked blocks have a header with size and allocation-site in front of the user's memory.
+class AllocTracker
+{
+public:
+        ///Allocation counters of one thread. Updated by relaxed atomic adds, read by the server-thread
+        struct Counters
+        {
+                unsigned long long allocs, frees, allocBytes, freeBytes;
+        };
+private:
+        enum { HeaderSize = 16, Frames = 8, SkipFrames = 2, NoSite = -1 };
+
+        struct BlockHeader
+        {
+                size_t size;
+                int site;               ///<index in sites-table or NoSite
+        };
+
+        ///Allocation-site: samples with the same call-stack
+        struct Site
+        {
+                unsigned long long hash;
+                void * frames[Frames];
+                int depth;
+                unsigned long long count, bytes, liveBytes;
+        };
+
+        static Counters * slots() { static Counters s[MODEPP_ALLOC_MAX_THREADS+1]; return s; }
+        static int & slotCount() { static int n; return n; }
+        static Site * sites() { static Site s[MODEPP_ALLOC_SITES]; return s; }
+        static int & sitesLock() { static int l; return l; }
+
+        static void add( unsigned long long & v, unsigned long long x ) { __atomic_fetch_add( &v, x, __ATOMIC_RELAXED ); }
+        static unsigned long long load( const unsigned long long & v ) { return __atomic_load_n( &v, __ATOMIC_RELAXED ); }
+
+        static void lockSites() { while ( __atomic_exchange_n( &sitesLock(), 1, __ATOMIC_ACQUIRE ) ) ; }
+        static void unlockSites() { __atomic_store_n( &sitesLock(), 0, __ATOMIC_RELEASE ); }
+
+        ///Records call-stack of an allocation. Returns index of its site or NoSite
+        static int sample( size_t size )
+        {
+                static __thread bool inSample;
+                if ( inSample )
+                        return NoSite;
+                inSample = true;
+                void * frames[Frames+SkipFrames];
+                int depth = backtrace( frames, Frames+SkipFrames ) - SkipFrames;
+                inSample = false;
+                if ( depth <= 0 )
+                        return NoSite;
+                unsigned long long hash = 14695981039346656037ULL;
+                for ( int i = 0; i < depth; ++i )
+                        hash = ( hash ^ (unsigned long long)(size_t)frames[i+SkipFrames] ) * 1099511628211ULL;
+                int idx = NoSite;
+                lockSites();
+                for ( int probe = 0; probe < MODEPP_ALLOC_SITES; ++probe )
+                {
+                        Site & s = sites()[ ( hash + probe ) % MODEPP_ALLOC_SITES ];
+                        if ( s.depth == 0 )
+                        {
+                                s.hash = hash;
+                                s.depth = depth;
+                                memcpy( s.frames, frames + SkipFrames, depth * sizeof(void*) );
+                        }
+                        if ( s.hash == hash )
+                        {
+                                ++s.count;
+                                s.bytes += size;
+                                s.liveBytes += size;
+                                idx = (int)( ( hash + probe ) % MODEPP_ALLOC_SITES );
+                                break;
+                        }
+                }
+                unlockSites();
+                return idx;
+        }
+
+        static bool bySampledBytes( const Site & a, const Site & b ) { return a.bytes > b.bytes; }
+public:
+        ///True if operator new is replaced and was called
+        static bool enabled() { return __atomic_load_n( &slotCount(), __ATOMIC_RELAXED ) > 0; }
+
+        ///Counters of calling thread. Claims a slot on first use
+        static Counters & threadCounters()
+        {
+                static __thread Counters * c;
+                if ( !c )
+                {
+                        int i = __atomic_fetch_add( &slotCount(), 1, __ATOMIC_RELAXED );
+                        c = &slots()[ std::min( i, MODEPP_ALLOC_MAX_THREADS ) ];
+                }
+                return *c;
+        }
+
+        ///Counters of calling thread at start of its current call, see markCall
+        static Counters & callStart() { static __thread Counters c; return c; }
+
+        ///Stores counters of calling thread as start of a call
+        static void markCall()
+        {
+                if ( enabled() )
+                        callStart() = threadCounters();
+        }
+
+        static void * allocate( size_t size )
+        {
+                char * p = (char*)malloc( size + HeaderSize );
+                if ( !p )
+                        return 0;
+                Counters & c = threadCounters();
+                add( c.allocs, 1 );
+                add( c.allocBytes, size );
+                BlockHeader * h = (BlockHeader*)p;
+                h->size = size;
+                h->site = NoSite;
+#if MODEPP_ALLOC_SAMPLE
+                if ( c.allocs % MODEPP_ALLOC_SAMPLE == 0 )
+                        h->site = sample( size );
+#endif
+                return p + HeaderSize;
+        }
+
+        static void release( void * ptr )
+        {
+                if ( !ptr )
+                        return;
+                char * p = (char*)ptr - HeaderSize;
+                BlockHeader * h = (BlockHeader*)p;
+                Counters & c = threadCounters();
+                add( c.frees, 1 );
+                add( c.freeBytes, h->size );
+                if ( h->site != NoSite )
+                {
+                        lockSites();
+                        sites()[h->site].liveBytes -= h->size;
+                        unlockSites();
+                }
+                free( p );
+        }
+
+        ///Statistics in the format of MsgAllocStats with given number of top allocation-sites
+        static std::string report( int topSites )
+        {
+                if ( !enabled() )
+                        return "allocation tracking disabled, define MODEPP_TRACK_ALLOCATIONS";
+                static unsigned long long lastTime, lastAllocs, lastBytes;
+                int threads = std::min( __atomic_load_n( &slotCount(), __ATOMIC_RELAXED ), MODEPP_ALLOC_MAX_THREADS + 1 );
+                Counters total = Counters();
+                std::stringstream lines;
+                for ( int i = 0; i < threads; ++i )
+                {
+                        const Counters & c = slots()[i];
+                        unsigned long long allocs = load( c.allocs ), bytes = load( c.allocBytes );
+                        total.allocs += allocs;
+                        total.frees += load( c.frees );
+                        total.allocBytes += bytes;
+                        total.freeBytes += load( c.freeBytes );
+                        lines << "\nthread " << i << " allocs=" << allocs << " frees=" << load( c.frees ) << " bytes=" << bytes;
+                }
+                unsigned long long now = modeppTimestamp();
+                unsigned long long elapsed = lastTime ? now - lastTime : 0;
+                std::stringstream s;
+                s << "live=" << (long long)( total.allocBytes - total.freeBytes )
+                  << " blocks=" << (long long)( total.allocs - total.frees )
+                  << " allocs=" << total.allocs << " frees=" << total.frees << " bytes=" << total.allocBytes
+                  << " alloc_rate=" << ( elapsed ? ( total.allocs - lastAllocs ) * 1000000000ULL / elapsed : 0 )
+                  << " byte_rate=" << ( elapsed ? ( total.allocBytes - lastBytes ) * 1000000000ULL / elapsed : 0 )
+                  << " threads=" << threads << lines.str();
+                lastTime = now;
+                lastAllocs = total.allocs;
+                lastBytes = total.allocBytes;
+
+                std::vector<Site> top;
+                top.reserve( MODEPP_ALLOC_SITES );      // an allocation under the lock may sample and lock again
+                lockSites();
+                for ( int i = 0; i < MODEPP_ALLOC_SITES; ++i )
+                        if ( sites()[i].depth )
+                                top.push_back( sites()[i] );
+                unlockSites();
+                std::sort( top.begin(), top.end(), bySampledBytes );
+                if ( (int)top.size() > topSites )
+                        top.resize( std::max( topSites, 0 ) );
+                for ( size_t i = 0; i < top.size(); ++i )
+                {
+                        const Site & t = top[i];
+                        s << "\nsite bytes=" << t.bytes * MODEPP_ALLOC_SAMPLE << " count=" << t.count * MODEPP_ALLOC_SAMPLE
+                          << " live=" << (long long)t.liveBytes * MODEPP_ALLOC_SAMPLE;
+                        char ** symbols = backtrace_symbols( t.frames, t.depth );
+                        for ( int f = 0; f < t.depth; ++f )
+                                s << " " << ( symbols ? symbols[f] : "?" );
+                        free( symbols );
+                }
+                return s.str().substr( 0, MAX_MSG_LEN );
+        }
+};
+#endif
+
+#ifdef __linux__
+///Process-statistics from /proc for MsgMetrics. Called in the server-thread
+class ProcessMetrics
+{
+        ///Reads small file of /proc
+        static std::string readFile( const std::string & path )
+        {
+                std::string content;
+                FILE * f = fopen( path.c_str(), "r" );
+                if ( !f )
+                        return content;
+                char buf[4096];
+                size_t n;
+                while ( ( n = fread( buf, 1, sizeof(buf), f ) ) > 0 )
+                        content.append( buf, n );
+                fclose( f );
+                return content;
+        }
+
+        ///Value of "key:" in a status-file
+        static unsigned long long statusValue( const std::string & status, const char * key )
+        {
+                size_t pos = status.find( key );
+                return pos == std::string::npos ? 0 : strtoull( status.c_str() + pos + strlen( key ), 0, 10 );
+        }
+
+        ///utime and stime of a stat-file in milliseconds. Fields are counted after the name in parentheses
+        static void cpuTimes( const std::string & stat, unsigned long long & user, unsigned long long & sys )
+        {
+                user = sys = 0;
+                size_t pos = stat.rfind( ')' );
+                if ( pos == std::string::npos )
+                        return;
+                std::stringstream s( stat.substr( pos + 2 ) );
+                std::string field;
+                for ( int i = 0; i < 11 && s >> field; ++i )
+                        ;
+                s >> user >> sys;
+                long tick = sysconf( _SC_CLK_TCK );
+                user = user * 1000 / tick;
+                sys = sys * 1000 / tick;
+        }
+public:
+        ///Writes metrics in the format of MsgMetrics, except queue-depths which belong to the transport
+        static void collect( std::ostream & o, size_t recvq, size_t sendq )
+        {
+                unsigned long long pages = 0, user = 0, sys = 0, vcsw = 0, nvcsw = 0;
+                std::stringstream( readFile( "/proc/self/statm" ) ) >> pages >> pages;
+                cpuTimes( readFile( "/proc/self/stat" ), user, sys );
+
+                int fds = 0;
+                if ( DIR * d = opendir( "/proc/self/fd" ) )
+                {
+                        while ( dirent * e = readdir( d ) )
+                                if ( e->d_name[0] != '.' )
+                                        ++fds;
+                        closedir( d );
+                        --fds; // descriptor of the directory itself
+                }
+
+                std::stringstream threads;
+                int count = 0;
+                if ( DIR * d = opendir( "/proc/self/task" ) )
+                {
+                        while ( dirent * e = readdir( d ) )
+                        {
+                                if ( e->d_name[0] == '.' )
+                                        continue;
+                                std::string task = std::string( "/proc/self/task/" ) + e->d_name;
+                                std::string status = readFile( task + "/status" );
+                                unsigned long long tu, ts, v = statusValue( status, "\nvoluntary_ctxt_switches:" ),
+                                        nv = statusValue( status, "nonvoluntary_ctxt_switches:" );
+                                cpuTimes( readFile( task + "/stat" ), tu, ts );
+                                std::string name = readFile( task + "/comm" );
+                                name.erase( name.find_last_not_of( "\n" ) + 1 );
+                                std::replace( name.begin(), name.end(), ' ', '_' );
+                                std::replace( name.begin(), name.end(), ',', '_' );
+                                threads << " thread=" << e->d_name << "," << name << "," << tu << "," << ts << "," << v << "," << nv;
+                                vcsw += v;
+                                nvcsw += nv;
+                                ++count;
+                        }
+                        closedir( d );
+                }
+                o << "ts=" << modeppTimestamp() << " rss=" << pages * sysconf( _SC_PAGESIZE ) << " user_ms=" << user
+                  << " sys_ms=" << sys << " vcsw=" << vcsw << " nvcsw=" << nvcsw << " fds=" << fds
+                  << " recvq=" << recvq << " sendq=" << sendq << " threads=" << count << threads.str();
+        }
+
+        ///Bytes in receive- and send-queue of a socket
+        static void socketQueues( int fd, size_t & recvq, size_t & sendq )
+        {
+                int in = 0, out = 0;
+                if ( fd >= 0 && ioctl( fd, SIOCINQ, &in ) == 0 && ioctl( fd, SIOCOUTQ, &out ) == 0 )
+                {
+                        recvq = in;
+                        sendq = out;
+                }
+        }
+};
+#endif
+
+///Condition of a rule (MsgAddRule), compiled into a postfix program. Grammar:
+///  or := and { "||" and }    and := unary { "&&" unary }    unary := "!" unary | primary
+///  primary := "(" or ")" | "trace" "~" '<text>' | operand [ ( < | <= | > | >= | == | != ) operand ]
+///  operand := <number> | <metric> | $<exposed object>
+///"(" and "!" nest at most MaxDepth deep, the program needs at most StackSize values on the stack of evaluate()
+class RulePredicate
+{
+public:
+        ///Values of metrics and exposed objects by name. A missing value makes comparisons false
+        typedef std::map< std::string, double > Values;
+private:
+        enum { MaxDepth = 64, StackSize = 2 * MaxDepth + 2 };   //per level "||" and "&&" keep a value
+        enum Op { Number, Value, Match, Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or, Not };
+        struct Instr
+        {
+                int op;
+                double number;
+                std::string text;       ///<name of value or text to search in trace-records
+                Instr( int o, double n = 0, const std::string & t = std::string() ):op(o),number(n),text(t){}
+        };
+        std::vector<Instr> _program;
+        bool _matchesTraces;    ///<condition contains trace ~ '<text>'
+        std::string _src;       ///<source while compiling
+        size_t _pos;
+        int _depth;             ///<nesting of "(" and "!" while compiling, limited by MaxDepth
+        std::string _error;
+
+        bool fail( const std::string & what )
+        {
+                if ( _error.empty() )
+                {
+                        std::stringstream s;
+                        s << what << " at " << _pos;
+                        _error = s.str();
+                }
+                return false;
+        }
+
+        void skipSpace()
+        {
+                while ( _pos < _src.length() && isspace( (unsigned char)_src[_pos] ) )
+                        ++_pos;
+        }
+
+        ///Consumes token if it follows
+        bool accept( const char * token )
+        {
+                skipSpace();
+                size_t n = strlen( token );
+                if ( _src.compare( _pos, n, token ) != 0 )
+                        return false;
+                _pos += n;
+                return true;
+        }
+
+        bool parseOr()
+        {
+                if ( !parseAnd() )
+                        return false;
+                while ( accept( "||" ) )
+                {
+                        if ( !parseAnd() )
+                                return false;
+                        _program.push_back( Instr( Or ) );
+                }
+                return true;
+        }
+
+        bool parseAnd()
+        {
+                if ( !parseUnary() )
+                        return false;
+                while ( accept( "&&" ) )
+                {
+                        if ( !parseUnary() )
+                                return false;
+                        _program.push_back( Instr( And ) );
+                }
+                return true;
+        }
+
+        ///The condition comes from the client: its nesting must not overflow the stack of the server-thread
+        bool parseUnary()
+        {
+                if ( _depth >= MaxDepth )
+                        return fail( "nesting too deep" );
+                ++_depth;
+                bool ok = parseNot();
+                --_depth;
+                return ok;
+        }
+
+        bool parseNot()
+        {
+                if ( accept( "!=" ) )
+                        return fail( "unexpected !=" );
+                if ( accept( "!" ) )
+                {
+                        if ( !parseUnary() )
+                                return false;
+                        _program.push_back( Instr( Not ) );
+                        return true;
+                }
+                return parsePrimary();
+        }
+
+        bool parsePrimary()
+        {
+                if ( accept( "(" ) )
+                        return parseOr() && ( accept( ")" ) || fail( "expected )" ) );
+                size_t start = _pos;
+                if ( accept( "trace" ) )
+                {
+                        if ( !accept( "~" ) )
+                                return fail( "expected ~" );
+                        skipSpace();
+                        if ( _pos >= _src.length() || ( _src[_pos] != '\'' && _src[_pos] != '"' ) )
+                                return fail( "expected quoted text" );
+                        size_t end = _src.find( _src[_pos], _pos + 1 );
+                        if ( end == std::string::npos )
+                                return fail( "unterminated text" );
+                        _program.push_back( Instr( Match, 0, _src.substr( _pos + 1, end - _pos - 1 ) ) );
+                        _pos = end + 1;
+                        _matchesTraces = true;
+                        return true;
+                }
+                _pos = start;
+                if ( !parseOperand() )
+                        return false;
+                static const char * ops[] = { "<=", ">=", "==", "!=", "<", ">" };
+                static const int codes[] = { LessEqual, GreaterEqual, Equal, NotEqual, Less, Greater };
+                for ( size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); ++i )
+                {
+                        if ( accept( ops[i] ) )
+                        {
+                                if ( !parseOperand() )
+                                        return false;
+                                _program.push_back( Instr( codes[i] ) );
+                                break;
+                        }
+                }
+                return true;
+        }
+
+        bool parseOperand()
+        {
+                skipSpace();
+                const char * begin = _src.c_str() + _pos;
+                char * end = 0;
+                double n = strtod( begin, &end );
+                if ( end != begin && !isalpha( (unsigned char)*begin ) )
+                {
+                        _pos += end - begin;
+                        _program.push_back( Instr( Number, n ) );
+                        return true;
+                }
+                size_t start = _pos;
+                if ( _pos < _src.length() && _src[_pos] == '$' )
+                        ++_pos;
+                while ( _pos < _src.length() && ( isalnum( (unsigned char)_src[_pos] ) || _src[_pos] == '_' ) )
+                        ++_pos;
+                if ( _pos == start || ( _pos == start + 1 && _src[start] == '$' ) )
+                        return fail( "expected number or name" );
+                _program.push_back( Instr( Value, 0, _src.substr( start, _pos - start ) ) );
+                return true;
+        }
+
+        ///Number of values the program keeps on the stack at most
+        size_t stackDepth() const
+        {
+                size_t top = 0, max = 0;
+                for ( size_t i = 0; i < _program.size(); ++i )
+                {
+                        int op = _program[i].op;
+                        if ( op == Number || op == Value || op == Match )
+                                max = std::max( max, ++top );
+                        else if ( op != Not )
+                                --top;
+                }
+                return max;
+        }
+
+        static bool truth( double v ) { return v != 0 && v == v; }
+public:
+        RulePredicate():_matchesTraces(false),_pos(0),_depth(0){}
+
+        ///Compiles condition. Returns false on syntax error, see error()
+        bool compile( const std::string & condition )
+        {
+                _program.clear();
+                _matchesTraces = false;
+                _error.clear();
+                _src = condition;
+                _pos = 0;
+                _depth = 0;
+                bool ok = parseOr();
+                skipSpace();
+                if ( ok && _pos < _src.length() )
+                        ok = fail( "unexpected text" );
+                if ( ok && stackDepth() > StackSize )
+                        ok = fail( "condition too complex" );
+                _src.clear();
+                return ok;
+        }
+
+        const std::string & error() const { return _error; }
+
+        ///True if the condition searches trace-records
+        bool matchesTraces() const { return _matchesTraces; }
+
+        ///Adds names of values, which the condition reads
+        void names( std::vector<std::string> & n ) const
+        {
+                for ( size_t i = 0; i < _program.size(); ++i )
+                        if ( _program[i].op == Value )
+                                n.push_back( _program[i].text );
+        }
+
+        ///Evaluates condition with values and text of a trace-record. Without record (text 0) trace-matches are false
+        bool evaluate( const Values & values, const char * text, size_t len ) const
+        {
+                double stack[StackSize];        //compile() rejects programs, which need more
+                size_t top = 0;
+                for ( size_t i = 0; i < _program.size(); ++i )
+                {
+                        const Instr & in = _program[i];
+                        if ( in.op == Number || in.op == Value || in.op == Match )
+                        {
+                                double v = in.number;
+                                if ( in.op == Value )
+                                {
+                                        Values::const_iterator it = values.find( in.text );
+                                        v = it != values.end() ? it->second : std::numeric_limits<double>::quiet_NaN();
+                                }
+                                else if ( in.op == Match )
+                                        v = text && std::search( text, text + len, in.text.begin(), in.text.end() ) != text + len;
+                                stack[top++] = v;
+                        }
+                        else if ( in.op == Not )
+                        {
+                                stack[top-1] = !truth( stack[top-1] );
+                        }
+                        else
+                        {
+                                double b = stack[--top], a = stack[top-1], r = 0;
+                                switch ( in.op )
+                                {
+                                case Less:         r = a < b; break;
+                                case LessEqual:    r = a <= b; break;
+                                case Greater:      r = a > b; break;
+                                case GreaterEqual: r = a >= b; break;
+                                case Equal:        r = a == b; break;
+                                case NotEqual:     r = a != b; break;
+                                case And:          r = truth( a ) && truth( b ); break;
+                                case Or:           r = truth( a ) || truth( b ); break;
+                                }
+                                stack[top-1] = r;
+                        }
+                }
+                return top == 1 && truth( stack[0] );
+        }
+};
+
+///Staging buffer for trace-records of one thread.
+///The mutex is shared only by the owning thread and by the server's periodic flush, so it is practically uncontended.
+class TraceBuffer
+{
+        modepp::mutex _mx;
+        std::string _records;   ///<encoded records, ready to be sent as MsgTraceBatch data
+        unsigned int _threadId; ///<MoDe++ thread-id, sent with each record
+        unsigned int _seq;      ///<sequence-nr of next record
+        unsigned int _callId;   ///<call the thread is running. Used by owning thread only
+        bool _quiet;            ///<thread runs a load test: traces and returns are dropped. Used by owning thread only
+        bool _detached;         ///<owning thread has finished. Buffer is removed after next flush
+        int _shard;             ///<trace-shard of the batches, -1 if the owning thread sends them itself
+        std::string _output;    ///<reusable buffer for returns of the owning thread
+#ifdef MODEPP_COROUTINES
+        std::string * _capture; ///<returns of the owning thread are appended here instead of being sent, see modeppCall
+#endif
+
+        TraceBuffer(const TraceBuffer &);
+        TraceBuffer& operator=(const TraceBuffer &);
+public:
+        TraceBuffer( unsigned int tid ):_threadId(tid),_seq(0),_callId(0),_quiet(false),_detached(false),_shard(-1)
+#ifdef MODEPP_COROUTINES
+                ,_capture(0)
+#endif
+        {
+                _records.reserve( MODEPP_TRACE_BATCH_BYTES + TRACE_RECORD_HEADER_LEN );
+        }
+
+        modepp::mutex & mutex() { return _mx; }
+
+        ///Appends time-stamped record. Call with locked mutex. Text is truncated to fit into one message.
+        void append( const std::string & text )
+        {
+                size_t len = std::min<size_t>( text.length(), MAX_MSG_LEN - TRACE_RECORD_HEADER_LEN );
+                char hdr[TRACE_RECORD_HEADER_LEN+1];
+                sprintf( hdr, "%016llx%08x%08x%08x%04x", modeppTimestamp(), _threadId, _seq++, _callId, (unsigned int)len );
+                _records.append( hdr, TRACE_RECORD_HEADER_LEN );
+                _records.append( text, 0, len );
+        }
+
+        ///True if record with given text-length would not fit into current batch. Call with locked mutex.
+        bool wouldOverflow( size_t textlen ) const
+        {
+                return !_records.empty() && _records.length() + TRACE_RECORD_HEADER_LEN + textlen > MAX_MSG_LEN;
+        }
+
+        ///True if batch should be sent. Call with locked mutex.
+        bool full() const { return _records.length() >= MODEPP_TRACE_BATCH_BYTES; }
+
+        bool empty() const { return _records.empty(); }
+
+        const std::string & records() const { return _records; }
+
+        void clear() { _records.clear(); }
+
+        unsigned int callId() const { return _callId; }
+
+        void setCallId( unsigned int id ) { _callId = id; }
+
+        bool quiet() const { return _quiet; }
+
+        void setQuiet( bool q ) { _quiet = q; }
+
+        int shard() const { return _shard; }
+
+        std::string & output() { return _output; }
+
+#ifdef MODEPP_COROUTINES
+        std::string * capture() const { return _capture; }
+
+        void setCapture( std::string * c ) { _capture = c; }
+#endif
+
+        ///Sets trace-shard. Call with locked mutex
+        void setShard( int s ) { _shard = s; }
+
+        void detach() { modepp::scoped_lock lock(_mx); _detached = true; }
+
+        bool detached() const { return _detached; }
+};
+
+#ifdef MODEPP_USE_EPOLL
+///Pointer to trace-buffer of calling thread. Buffer is detached when the thread finishes.
+class ThreadTraceBufferPtr
+{
+        struct Holder
+        {
+                TraceBuffer * b;
+                Holder():b(0){}
+                ~Holder(){ if (b) b->detach(); }
+        };
+        static Holder & holder() { static thread_local Holder h; return h; }
+public:
+        TraceBuffer * get() const { return holder().b; }
+        void reset( TraceBuffer * b ) { holder().b = b; }
+};
+#else
+///Pointer to trace-buffer of calling thread. Buffer is detached when the thread finishes.
+class ThreadTraceBufferPtr
+{
+        boost::thread_specific_ptr<TraceBuffer> _ptr;
+        static void release( TraceBuffer * b ) { b->detach(); }
+public:
+        ThreadTraceBufferPtr():_ptr(&ThreadTraceBufferPtr::release){}
+        TraceBuffer * get() const { return _ptr.get(); }
+        void reset( TraceBuffer * b ) { _ptr.reset( b ); }
+};
+#endif
+
+///Receiver of transport-events. Methods are called in the server-thread.
+struct ITransportHandler
+{
+        virtual void onConnected()=0;                                   ///<client connected
+        virtual void onData( const char * data, size_t length )=0;      ///<data received from client
+        virtual void onDisconnected()=0;                                ///<client closed connection
+        virtual void onTick()=0;                                        ///<called every MODEPP_TRACE_FLUSH_MS
+        virtual void onWake() {}                                        ///<ITransport::wake or wakeAfter is due
+        virtual void onReady( int ) {}                                  ///<descriptor of ITransport::watchDescriptor is ready
+        virtual ~ITransportHandler(){}
+};
+
+#ifndef _WIN32
+///Enables TCP-keepalive of client-socket, so a vanished client is detected. Fails silently for unix sockets
+inline void modeppKeepAlive( int fd )
+{
+        int on = 1;
+        setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on) );
+#ifdef TCP_KEEPIDLE
+        int idle = MODEPP_KEEPALIVE_S, probes = 3;
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle) );
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPINTVL, &idle, sizeof(idle) );
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes) );
+#endif
+}
+#endif
+
+///Connection of the server to its client. Transports are started by MoDePP::start... functions.
+class ITransport
+{
+protected:
+        volatile bool _connected;       ///<cheap check for sending threads
+        volatile bool _congested;       ///<client is slow: more than MODEPP_SEND_HIGH_WATERMARK bytes are queued
+
+        ///Updates _congested by bytes queued for the client. Returns false if the client has to be disconnected
+        bool checkQueue( size_t queued )
+        {
+                if ( queued > MODEPP_SEND_MAX_QUEUE )
+                        return false;
+                if ( queued > MODEPP_SEND_HIGH_WATERMARK )
+                        _congested = true;
+                else if ( queued <= MODEPP_SEND_LOW_WATERMARK )
+                        _congested = false;
+                return true;
+        }
+public:
+        ITransport():_connected(false),_congested(false){}
+        virtual ~ITransport(){}
+
+        bool connected() const { return _connected; }
+
+        bool congested() const { return _congested; }
+
+        ///Closes connection to the client, e.g. after idle timeout. The transport waits for the next client
+        virtual void disconnectClient() {}
+
+        ///Stops server-thread and closes connection
+        virtual void stop()=0;
+
+        ///Writes header and data to the client as one message. Does nothing if no client is connected.
+        virtual void send( const char * hdr, size_t hlen, const char * data, size_t dlen )=0;
+
+        ///Called in the child after fork. Closes inherited descriptors without touching the server-thread,
+        ///which doesn't exist in the child. The transport is not usable afterwards.
+        virtual void abandon()=0;
+
+        ///Mutex serializing sends, held over fork by the fork-handlers of MoDePP
+        virtual modepp::mutex & sendMutex()=0;
+
+        ///Bytes waiting in receive- and send-queue of the connection to the client
+        virtual void queueDepths( size_t & recvq, size_t & sendq ) { recvq = sendq = 0; }
+
+        ///Makes the server-thread call ITransportHandler::onWake soon. May be called by any thread
+        virtual void wake() {}
+
+        ///Makes the server-thread call ITransportHandler::onWake after given time. Replaces the time of an earlier
+        ///call. Call in the server-thread
+        virtual void wakeAfter( unsigned int /*ms*/ ) {}
+
+        ///Makes the server-thread call ITransportHandler::onReady once, when descriptor is readable (or writable).
+        ///Call in the server-thread. Returns false if the descriptor can't be watched
+        virtual bool watchDescriptor( int /*fd*/, bool /*write*/ ) { return false; }
+
+        ///Stops watching descriptor. Call in the server-thread
+        virtual void unwatchDescriptor( int /*fd*/ ) {}
+};
+
+///Queue of the trace-batches of threads on some CPUs (see Trace shards). Its sender-thread runs on these CPUs
+///and writes all queued batches with one send.
+class TraceShard
+{
+        modepp::mutex _mx;
+        modepp::condition _wake;
+        std::string _queued;            ///<MsgTraceBatch messages with header
+        modepp::mutex _drainMx;         ///<held while batches are written, so they keep their order
+        std::string _sending;
+        std::vector<int> _cpus;
+        bool _stop;
+        modepp::thread * _sender;
+
+        struct Runner
+        {
+                TraceShard * shard;
+                ITransport * transport;
+                void operator()() { shard->run( transport ); }
+        };
+
+        TraceShard(const TraceShard &);
+        TraceShard& operator=(const TraceShard &);
+public:
+        TraceShard( const std::vector<int> & cpus ):_cpus(cpus),_stop(false),_sender(0){}
+
+        ///Starts sender-thread, which writes to given transport
+        void start( ITransport * t )
+        {
+                Runner r = { this, t };
+                _sender = new modepp::thread( r );
+        }
+
+        ///Stops sender-thread. Batches queued afterwards are written by drain only
+        void stop()
+        {
+                {
+                        modepp::scoped_lock lock(_mx);
+                        _stop = true;
+                        _wake.notify_one();
+                }
+                if ( _sender )
+                        _sender->join();
+                delete _sender;
+                _sender = 0;
+        }
+
+        ///Queues batch of records. Called with locked buffer-mutex
+        void push( const std::string & records )
+        {
+                char hdr[HEADER_LEN+1];
+                sprintf( hdr, "%04x%04x", (unsigned int)records.length(), (unsigned int)MsgTraceBatch );
+                modepp::scoped_lock lock(_mx);
+                if ( _queued.empty() )
+                        _wake.notify_one();
+                _queued.append( hdr, HEADER_LEN );
+                _queued += records;
+        }
+
+        ///Writes queued batches to the client
+        void drain( ITransport * t )
+        {
+                modepp::scoped_lock dlock(_drainMx);
+                {
+                        modepp::scoped_lock lock(_mx);
+                        _queued.swap( _sending );
+                }
+                if ( t && !_sending.empty() )
+                        t->send( _sending.data(), _sending.length(), 0, 0 );
+                _sending.clear();
+        }
+
+        ///Body of sender-thread. Queues are allocated after binding the thread to the CPUs, so they are node-local
+        void run( ITransport * t )
+        {
+#ifdef __linux__
+                cpu_set_t set;
+                CPU_ZERO( &set );
+                for ( size_t i = 0; i < _cpus.size(); ++i )
+                        CPU_SET( _cpus[i], &set );
+                pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+#endif
+                {
+                        modepp::scoped_lock dlock(_drainMx);
+                        modepp::scoped_lock lock(_mx);
+                        _queued.reserve( 16 * MODEPP_TRACE_BATCH_BYTES );
+                        _sending.reserve( 16 * MODEPP_TRACE_BATCH_BYTES );
+                }
+                for (;;)
+                {
+                        {
+                                modepp::unique_lock lock(_mx);
+                                while ( _queued.empty() && !_stop )
+                                        _wake.wait( lock );
+                                if ( _stop )
+                                        return;
+                        }
+                        drain( t );
+                }
+        }
+};
+
+#ifndef _WIN32
+///CPUs of each trace-shard: one group per CPU, or per NUMA node (one group of all CPUs if nodes are unknown)
+inline std::vector< std::vector<int> > modeppCpuGroups( bool perCpu )
+{
+        std::vector< std::vector<int> > groups;
+        int cpus = (int)sysconf( _SC_NPROCESSORS_CONF );
+#ifdef __linux__
+        DIR * d = perCpu ? 0 : opendir( "/sys/devices/system/node" );
+        while ( dirent * e = d ? readdir( d ) : 0 )
+        {
+                if ( strncmp( e->d_name, "node", 4 ) != 0 || !isdigit( (unsigned char)e->d_name[4] ) )
+                        continue;
+                std::string path = std::string( "/sys/devices/system/node/" ) + e->d_name + "/cpulist";
+                FILE * f = fopen( path.c_str(), "r" );
+                if ( !f )
+                        continue;
+                std::vector<int> group;
+                int from, to;
+                char sep = ',';
+                while ( sep == ',' && fscanf( f, "%d", &from ) == 1 )
+                {
+                        to = from;
+                        if ( fscanf( f, "%c", &sep ) == 1 && sep == '-' && fscanf( f, "%d%c", &to, &sep ) < 1 )
+                                break;
+                        for ( int c = from; c <= to && c < cpus; ++c )
+                                group.push_back( c );
+                }
+                fclose( f );
+                if ( !group.empty() )
+                        groups.push_back( group );
+        }
+        if ( d )
+                closedir( d );
+#endif
+        if ( perCpu )
+                for ( int c = 0; c < cpus; ++c )
+                        groups.push_back( std::vector<int>( 1, c ) );
+        if ( groups.empty() )
+        {
+                groups.resize( 1 );
+                for ( int c = 0; c < cpus; ++c )
+                        groups[0].push_back( c );
+        }
+        return groups;
+}
+#endif
+
+#ifndef MODEPP_USE_EPOLL
+///Stream-server (TCP or unix domain socket) based on asio. Serves one client at a time in its own thread.
+class AsioTransport: public ITransport
+{
+        typedef generic::stream_protocol::socket Socket;
+        typedef basic_socket_acceptor<generic::stream_protocol> Acceptor;
+
+        ITransportHandler * _handler;
+        io_service _service;
+        boost::scoped_ptr<Acceptor> _acceptor;
+        boost::scoped_ptr<boost::thread> _thread;
+        boost::shared_ptr <Socket> _socket;
+        boost::shared_ptr <Socket> _pendingSocket;      ///<socket of pending accept
+        deadline_timer _tick;   ///<periodic call of ITransportHandler::onTick
+        deadline_timer _due;    ///<call of ITransportHandler::onWake of wakeAfter
+        modepp::mutex _wakeMutex;
+        bool _wakePosted;       ///<onWake of wake is posted and not yet called
+#if defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR) || defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+        typedef boost::shared_ptr<posix::stream_descriptor> Descriptor;
+        std::map<int, Descriptor> _watched;     ///<descriptors of watchDescriptor. They are released, not closed
+#endif
+        char _readBuf[1024];    ///<buffer for async reads
+        modepp::mutex _sendMutex;       ///<serializes writes to the socket and the queues below
+        std::string _pending;   ///<bytes the client did not take yet. Written by the server-thread
+        std::string _writing;   ///<bytes of running async write
+        bool _stop;
+        std::string _localPath; ///<path of unix domain socket, removed on stop
+
+        AsioTransport(const AsioTransport &);
+        AsioTransport& operator=(const AsioTransport &);
+
+        ///Runs event-loop of the server
+        void doWork()
+        {
+                startAccept();
+                startTick();
+                _service.run();
+        }
+
+        ///Waits asynchronously for a client
+        void startAccept()
+        {
+                _pendingSocket = boost::shared_ptr <Socket>( new Socket(_service) );
+                _acceptor->async_accept( *_pendingSocket, boost::bind( &AsioTransport::onAccept, this, placeholders::error ) );
+        }
+
+        void onAccept( const error_code & error )
+        {
+                if ( error )
+                {
+                        if ( !_stop && error != error::operation_aborted )
+                                startAccept();
+                        return;
+                }
+                {
+                        modepp::scoped_lock lock(_sendMutex);
+                        _socket = _pendingSocket;
+                        error_code ignored;
+                        _socket->non_blocking( true, ignored );
+#ifndef _WIN32
+                        modeppKeepAlive( _socket->native_handle() );
+#endif
+                }
+                _pendingSocket.reset();
+                _handler->onConnected();
+                _connected = true;
+                startRead();
+        }
+
+        ///Reads asynchronously from connected client
+        void startRead()
+        {
+                _socket->async_read_some( buffer(_readBuf, sizeof(_readBuf)),
+                        boost::bind( &AsioTransport::onRead, this, placeholders::error, placeholders::bytes_transferred ) );
+        }
+
+        void onRead( const error_code & error, size_t length )
+        {
+                if (error)
+                {
+                        _connected = false;
+                        {
+                                modepp::scoped_lock lock(_sendMutex);
+                                _socket.reset();
+                                _pending.clear();
+                                _congested = false;
+                        }
+                        _handler->onDisconnected();
+                        if ( !_stop )
+                                startAccept();
+                        return;
+                }
+                _handler->onData( _readBuf, length );
+                startRead();
+        }
+
+        ///Starts async write of queued bytes. Call with locked _sendMutex in the server-thread
+        void writePending()
+        {
+                if ( !_socket.get() || !_writing.empty() || _pending.empty() )
+                        return;
+                _writing.swap( _pending );
+                async_write( *_socket, buffer( _writing ), boost::bind( &AsioTransport::onWrite, this, placeholders::error ) );
+        }
+
+        void startWrite()
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                writePending();
+        }
+
+        void onWrite( const error_code & error )
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                _writing.clear();
+                if ( !error )
+                        checkQueue( _pending.size() );
+                writePending();
+        }
+
+        void startTick()
+        {
+                _tick.expires_from_now( boost::posix_time::milliseconds( MODEPP_TRACE_FLUSH_MS ) );
+                _tick.async_wait( boost::bind( &AsioTransport::onTick, this, placeholders::error ) );
+        }
+
+        void onTick( const error_code & error )
+        {
+                if ( error )
+                        return;
+                _handler->onTick();
+                startTick();
+        }
+
+        void onWake()
+        {
+                {
+                        modepp::scoped_lock lock(_wakeMutex);
+                        _wakePosted = false;
+                }
+                _handler->onWake();
+        }
+
+        void onDue( const error_code & error )
+        {
+                if ( !error )
+                        _handler->onWake();
+        }
+
+#if defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR) || defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+        void onDescriptor( Descriptor d, int fd, const error_code & error )
+        {
+                if ( error == error::operation_aborted )
+                        return;
+                std::map<int, Descriptor>::iterator it = _watched.find( fd );
+                if ( it == _watched.end() || it->second != d )
+                        return;
+                d->release();
+                _watched.erase( it );
+                _handler->onReady( fd );
+        }
+#endif
+
+        ///Opens acceptor and starts server-thread
+        void listen( const generic::stream_protocol::endpoint & ep, ITransportHandler * handler )
+        {
+                _handler = handler;
+                _acceptor.reset( new Acceptor( _service, ep ) );
+                _thread.reset( new boost::thread( boost::bind( &AsioTransport::doWork, this ) ) );
+        }
+
+public:
+        AsioTransport():_handler(0),_tick(_service),_due(_service),_wakePosted(false),_stop(false){}
+
+        ~AsioTransport() { stop(); }
+
+        ///Listens on TCP-port
+        void start( unsigned short port, ITransportHandler * handler )
+        {
+                listen( tcp::endpoint(tcp::v4(), port ), handler );
+        }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) || defined(ASIO_HAS_LOCAL_SOCKETS)
+        ///Listens on unix domain socket. An existing file at path is removed
+        void startLocal( const std::string & path, ITransportHandler * handler )
+        {
+                ::unlink( path.c_str() );
+                _localPath = path;
+                listen( local::stream_protocol::endpoint( path ), handler );
+        }
+#endif
+
+        void stop()
+        {
+                _stop=true;
+                if ( _thread.get() )
+                {
+                        _service.stop();
+                        _thread->join();
+                        _thread.reset();
+                }
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) || defined(ASIO_HAS_LOCAL_SOCKETS)
+                if ( !_localPath.empty() )
+                {
+                        ::unlink( _localPath.c_str() );
+                        _localPath.clear();
+                }
+#endif
+        }
+
+        void abandon()
+        {
+                _connected = false;
+#ifndef _WIN32
+                if ( _acceptor.get() )
+                        ::close( _acceptor->native_handle() );
+                if ( _socket.get() )
+                        ::close( _socket->native_handle() );
+#endif
+        }
+
+        modepp::mutex & sendMutex() { return _sendMutex; }
+
+        ///Writes as much as the socket takes without blocking, the rest is queued for the server-thread
+        void send( const char * hdr, size_t hlen, const char * data, size_t dlen )
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                if ( !_socket.get() )
+                        return;
+                size_t n = 0;
+                if ( _pending.empty() && _writing.empty() )
+                {
+                        boost::array<const_buffer, 2> bufs = {{ buffer(hdr, hlen), buffer(data, dlen) }};
+                        error_code ec;
+                        n = _socket->write_some( bufs, ec );
+                        if ( ec && ec != error::would_block && ec != error::try_again )
+                                return;
+                        if ( n == hlen + dlen )
+                                return;
+                        _service.post( boost::bind( &AsioTransport::startWrite, this ) );
+                }
+                if ( n < hlen )
+                        _pending.append( hdr + n, hlen - n );
+                _pending.append( data + ( n > hlen ? n - hlen : 0 ), dlen - ( n > hlen ? n - hlen : 0 ) );
+                if ( !checkQueue( _pending.size() + _writing.size() ) )
+                {
+                        _pending.clear();
+                        ::shutdown( _socket->native_handle(), 2 );      // read fails, server-thread disconnects
+                }
+        }
+
+        void disconnectClient()
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                if ( _socket.get() )
+                        ::shutdown( _socket->native_handle(), 2 );
+        }
+
+        void queueDepths( size_t & recvq, size_t & sendq )
+        {
+                recvq = sendq = 0;
+#ifdef __linux__
+                modepp::scoped_lock lock(_sendMutex);
+                if ( _socket.get() )
+                        ProcessMetrics::socketQueues( _socket->native_handle(), recvq, sendq );
+                sendq += _pending.size() + _writing.size();
+#endif
+        }
+
+        void wake()
+        {
+                modepp::scoped_lock lock(_wakeMutex);
+                if ( _wakePosted )
+                        return;
+                _wakePosted = true;
+                _service.post( boost::bind( &AsioTransport::onWake, this ) );
+        }
+
+        void wakeAfter( unsigned int ms )
+        {
+                _due.expires_from_now( boost::posix_time::milliseconds( ms ) );
+                _due.async_wait( boost::bind( &AsioTransport::onDue, this, placeholders::error ) );
+        }
+
+#if defined(BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR) || defined(ASIO_HAS_POSIX_STREAM_DESCRIPTOR)
+        bool watchDescriptor( int fd, bool write )
+        {
+                unwatchDescriptor( fd );
+                Descriptor d( new posix::stream_descriptor( _service ) );
+                error_code ec;
+                d->assign( fd, ec );
+                if ( ec )
+                        return false;
+                _watched[fd] = d;
+                if ( write )
+                        d->async_write_some( null_buffers(), boost::bind( &AsioTransport::onDescriptor, this, d, fd, placeholders::error ) );
+                else
+                        d->async_read_some( null_buffers(), boost::bind( &AsioTransport::onDescriptor, this, d, fd, placeholders::error ) );
+                return true;
+        }
+
+        void unwatchDescriptor( int fd )
+        {
+                std::map<int, Descriptor>::iterator it = _watched.find( fd );
+                if ( it == _watched.end() )
+                        return;
+                error_code ignored;
+                it->second->cancel( ignored );
+                it->second->release();
+                _watched.erase( it );
+        }
+#endif
+};
+
+typedef AsioTransport SocketTransport;
+
+#else // MODEPP_USE_EPOLL
+
+///Stream-server (TCP or unix domain socket) based on epoll. Serves one client at a time in its own std::thread.
+///Sending threads write directly to the socket with one sendmsg call per message. What a slow client does not take
+///is queued and written by the server-thread when the socket is writable.
+class EpollTransport: public ITransport
+{
+        ITransportHandler * _handler;
+        int _epoll;             ///<epoll instance of server-thread
+        int _listen;            ///<listening socket
+        int _client;            ///<connected client or -1
+        int _timer;             ///<timerfd for ITransportHandler::onTick
+        int _wakeup;            ///<eventfd which stops the server-thread
+        int _post;              ///<eventfd of wake
+        int _due;               ///<timerfd of wakeAfter
+        std::unique_ptr<std::thread> _thread;
+        modepp::mutex _sendMutex;       ///<serializes writes to the socket, _pending and closing of the socket
+        std::string _pending;           ///<bytes the client did not take yet
+        std::string _localPath;         ///<path of unix domain socket, removed on stop
+
+        EpollTransport(const EpollTransport &);
+        EpollTransport& operator=(const EpollTransport &);
+
+        static void check( int rc, const char * what )
+        {
+                if ( rc < 0 )
+                        throw std::system_error( errno, std::system_category(), what );
+        }
+
+        void watch( int fd )
+        {
+                epoll_event ev = epoll_event();
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl( _epoll, EPOLL_CTL_ADD, fd, &ev );
+        }
+
+        void unwatch( int fd )
+        {
+                epoll_ctl( _epoll, EPOLL_CTL_DEL, fd, 0 );
+        }
+
+        ///Watches client for writability too, while bytes are pending
+        void watchOutput( bool on )
+        {
+                epoll_event ev = epoll_event();
+                ev.events = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+                ev.data.fd = _client;
+                epoll_ctl( _epoll, EPOLL_CTL_MOD, _client, &ev );
+        }
+
+        ///Writes pending bytes as far as the socket takes them. Called in the server-thread
+        void writePending()
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                size_t done = 0;
+                while ( done < _pending.length() )
+                {
+                        ssize_t n = ::send( _client, _pending.data() + done, _pending.length() - done, MSG_NOSIGNAL | MSG_DONTWAIT );
+                        if ( n < 0 )
+                        {
+                                if ( errno == EINTR )
+                                        continue;
+                                if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                                        done = _pending.length();       // connection is broken, recv will tell
+                                break;
+                        }
+                        done += n;
+                }
+                _pending.erase( 0, done );
+                if ( _pending.empty() )
+                        watchOutput( false );
+                checkQueue( _pending.length() );
+        }
+
+        ///Accepts a client. Listening socket is not watched till the client disconnects
+        void accept()
+        {
+                int c = ::accept4( _listen, 0, 0, SOCK_CLOEXEC );
+                if ( c < 0 )
+                        return;
+                unwatch( _listen );
+                modeppKeepAlive( c );
+                {
+                        modepp::scoped_lock lock(_sendMutex);
+                        _client = c;
+                }
+                _handler->onConnected();
+                _connected = true;
+                watch( _client );
+        }
+
+        void disconnect()
+        {
+                _connected = false;
+                unwatch( _client );
+                {
+                        modepp::scoped_lock lock(_sendMutex);
+                        ::close( _client );
+                        _client = -1;
+                        _pending.clear();
+                        _congested = false;
+                }
+                _handler->onDisconnected();
+                watch( _listen );
+        }
+
+        ///Event-loop of the server
+        void doWork()
+        {
+                epoll_event events[4];
+                char buf[4096];
+                for (;;)
+                {
+                        int n = epoll_wait( _epoll, events, sizeof(events)/sizeof(events[0]), -1 );
+                        if ( n < 0 )
+                        {
+                                if ( errno == EINTR )
+                                        continue;
+                                return;
+                        }
+                        for ( int i = 0; i < n; ++i )
+                        {
+                                int fd = events[i].data.fd;
+                                if ( fd == _wakeup )
+                                {
+                                        return;
+                                }
+                                else if ( fd == _timer )
+                                {
+                                        unsigned long long expirations;
+                                        if ( ::read( _timer, &expirations, sizeof(expirations) ) > 0 )
+                                                _handler->onTick();
+                                }
+                                else if ( fd == _post || fd == _due )
+                                {
+                                        unsigned long long count;
+                                        if ( ::read( fd, &count, sizeof(count) ) > 0 )
+                                                _handler->onWake();
+                                }
+                                else if ( fd == _listen )
+                                {
+                                        accept();
+                                }
+                                else if ( fd == _client )
+                                {
+                                        if ( events[i].events & EPOLLOUT )
+                                                writePending();
+                                        if ( !( events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) )
+                                                continue;
+                                        ssize_t len = ::recv( _client, buf, sizeof(buf), 0 );
+                                        if ( len > 0 )
+                                                _handler->onData( buf, len );
+                                        else if ( len == 0 || errno != EINTR )
+                                                disconnect();
+                                }
+                                else
+                                {
+                                        unwatch( fd );
+                                        _handler->onReady( fd );
+                                }
+                        }
+                }
+        }
+
+        ///Opens listening socket and starts server-thread. Throws std::system_error on failure.
+        void listen( const sockaddr * addr, socklen_t addrlen, ITransportHandler * handler )
+        {
+                _handler = handler;
+                check( _listen = ::socket( addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0 ), "MoDe++ socket" );
+                int on = 1;
+                ::setsockopt( _listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+                check( ::bind( _listen, addr, addrlen ), "MoDe++ bind" );
+                check( ::listen( _listen, SOMAXCONN ), "MoDe++ listen" );
+
+                check( _epoll = epoll_create1( EPOLL_CLOEXEC ), "MoDe++ epoll_create1" );
+                check( _timer = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC ), "MoDe++ timerfd_create" );
+                itimerspec tick = itimerspec();
+                tick.it_interval.tv_sec = MODEPP_TRACE_FLUSH_MS / 1000;
+                tick.it_interval.tv_nsec = ( MODEPP_TRACE_FLUSH_MS % 1000 ) * 1000000L;
+                tick.it_value = tick.it_interval;
+                timerfd_settime( _timer, 0, &tick, 0 );
+                check( _wakeup = eventfd( 0, EFD_CLOEXEC ), "MoDe++ eventfd" );
+                check( _post = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ), "MoDe++ eventfd" );
+                check( _due = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK ), "MoDe++ timerfd_create" );
+
+                watch( _listen );
+                watch( _timer );
+                watch( _wakeup );
+                watch( _post );
+                watch( _due );
+                _thread.reset( new std::thread( &EpollTransport::doWork, this ) );
+        }
+
+public:
+        EpollTransport():_handler(0),_epoll(-1),_listen(-1),_client(-1),_timer(-1),_wakeup(-1),_post(-1),_due(-1){}
+
+        ~EpollTransport() { stop(); }
+
+        ///Listens on TCP-port
+        void start( unsigned short port, ITransportHandler * handler )
+        {
+                sockaddr_in addr = sockaddr_in();
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons( port );
+                addr.sin_addr.s_addr = htonl( INADDR_ANY );
+                listen( (sockaddr*)&addr, sizeof(addr), handler );
+        }
+
+        ///Listens on unix domain socket. An existing file at path is removed
+        void startLocal( const std::string & path, ITransportHandler * handler )
+        {
+                sockaddr_un addr = sockaddr_un();
+                addr.sun_family = AF_UNIX;
+                if ( path.length() >= sizeof(addr.sun_path) )
+                        throw std::system_error( ENAMETOOLONG, std::system_category(), "MoDe++ socket path" );
+                path.copy( addr.sun_path, path.length() );
+                ::unlink( path.c_str() );
+                _localPath = path;
+                listen( (sockaddr*)&addr, sizeof(addr), handler );
+        }
+
+        void abandon()
+        {
+                _connected = false;
+                int fds[] = { _client, _listen, _timer, _wakeup, _post, _due, _epoll };
+                for ( size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); ++i )
+                {
+                        if ( fds[i] >= 0 )
+                                ::close( fds[i] );
+                }
+        }
+
+        modepp::mutex & sendMutex() { return _sendMutex; }
+
+        void stop()
+        {
+                if ( _thread.get() )
+                {
+                        unsigned long long one = 1;
+                        if ( ::write( _wakeup, &one, sizeof(one) ) > 0 )
+                                _thread->join();
+                        else
+                                _thread->detach();
+                        _thread.reset();
+                }
+                _connected = false;
+                int * fds[] = { &_client, &_listen, &_timer, &_wakeup, &_post, &_due, &_epoll };
+                for ( size_t i = 0; i < sizeof(fds)/sizeof(fds[0]); ++i )
+                {
+                        if ( *fds[i] >= 0 )
+                                ::close( *fds[i] );
+                        *fds[i] = -1;
+                }
+                if ( !_localPath.empty() )
+                {
+                        ::unlink( _localPath.c_str() );
+                        _localPath.clear();
+                }
+        }
+
+        ///Writes as much as the socket takes without blocking, the rest is queued for the server-thread
+        void send( const char * hdr, size_t hlen, const char * data, size_t dlen )
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                if ( _client < 0 )
+                        return;
+                if ( !_pending.empty() )
+                {
+                        _pending.append( hdr, hlen );
+                        _pending.append( data, dlen );
+                        if ( !checkQueue( _pending.length() ) )
+                        {
+                                _pending.clear();
+                                ::shutdown( _client, SHUT_RDWR );      // recv fails, server-thread disconnects
+                        }
+                        return;
+                }
+                iovec iov[2];
+                iov[0].iov_base = const_cast<char*>( hdr );
+                iov[0].iov_len = hlen;
+                iov[1].iov_base = const_cast<char*>( data );
+                iov[1].iov_len = dlen;
+                msghdr msg = msghdr();
+                msg.msg_iov = iov;
+                msg.msg_iovlen = 2;
+                while ( iov[0].iov_len || iov[1].iov_len )
+                {
+                        ssize_t n = ::sendmsg( _client, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+                        if ( n < 0 )
+                        {
+                                if ( errno == EINTR )
+                                        continue;
+                                if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                                {
+                                        _pending.append( (const char*)iov[0].iov_base, iov[0].iov_len );
+                                        _pending.append( (const char*)iov[1].iov_base, iov[1].iov_len );
+                                        watchOutput( true );
+                                }
+                                return;
+                        }
+                        for ( int i = 0; i < 2; ++i )
+                        {
+                                size_t done = std::min<size_t>( n, iov[i].iov_len );
+                                iov[i].iov_base = (char*)iov[i].iov_base + done;
+                                iov[i].iov_len -= done;
+                                n -= done;
+                        }
+                }
+        }
+
+        void queueDepths( size_t & recvq, size_t & sendq )
+        {
+                recvq = sendq = 0;
+                modepp::scoped_lock lock(_sendMutex);
+                ProcessMetrics::socketQueues( _client, recvq, sendq );
+                sendq += _pending.length();
+        }
+
+        void disconnectClient()
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                if ( _client >= 0 )
+                        ::shutdown( _client, SHUT_RDWR );
+        }
+
+        void wake()
+        {
+                unsigned long long one = 1;
+                if ( ::write( _post, &one, sizeof(one) ) < 0 ) {}
+        }
+
+        void wakeAfter( unsigned int ms )
+        {
+                itimerspec due = itimerspec();
+                due.it_value.tv_sec = ms / 1000;
+                due.it_value.tv_nsec = ms % 1000 * 1000000L + 1;   // 0 would disarm it
+                timerfd_settime( _due, 0, &due, 0 );
+        }
+
+        ///Fails for regular files, which are always ready
+        bool watchDescriptor( int fd, bool write )
+        {
+                epoll_event ev = epoll_event();
+                ev.events = write ? EPOLLOUT : EPOLLIN;
+                ev.data.fd = fd;
+                return epoll_ctl( _epoll, EPOLL_CTL_ADD, fd, &ev ) == 0
+                        || ( errno == EEXIST && epoll_ctl( _epoll, EPOLL_CTL_MOD, fd, &ev ) == 0 );
+        }
+
+        void unwatchDescriptor( int fd )
+        {
+                unwatch( fd );
+        }
+};
+
+typedef EpollTransport SocketTransport;
+
+#endif // MODEPP_USE_EPOLL
+
+#ifndef _WIN32
+///Transport over POSIX shared-memory for a client on the same host. No kernel socket-stack in the message path:
+///messages are copied straight into the mapped out-ring. If the ring is full, the message is dropped, the
+///instrumented program never waits for the client. Server-thread polls the in-ring every MODEPP_SHM_POLL_MS.
+class ShmTransport: public ITransport
+{
+        ITransportHandler * _handler;
+        std::string _name;
+        size_t _size;           ///<size of mapped segment
+        ShmControl * _ctl;
+        char * _out;            ///<server-to-client ring
+        char * _in;             ///<client-to-server ring
+        modepp::shared_ptr<modepp::thread> _thread;
+        modepp::mutex _sendMutex;       ///<makes sending threads the single producer of the out-ring
+        volatile bool _stop;
+        modepp::mutex _wakeMutex;
+        bool _woken;                    ///<wake was called
+        unsigned long long _due;        ///<time of wakeAfter, 0 if none. Used by server-thread only
+        std::vector<pollfd> _watched;   ///<descriptors of watchDescriptor. Used by server-thread only
+
+        ShmTransport(const ShmTransport &);
+        ShmTransport& operator=(const ShmTransport &);
+
+        ///Copies data to out-ring at given position
+        void put( unsigned long long pos, const char * data, size_t len )
+        {
+                size_t off = pos % _ctl->outSize;
+                size_t first = std::min<size_t>( len, _ctl->outSize - off );
+                memcpy( _out + off, data, first );
+                memcpy( _out, data + first, len - first );
+        }
+
+        ///Passes all data of in-ring to the handler
+        void receive()
+        {
+                unsigned long long head = shmLoad( _ctl->inHead );
+                unsigned long long tail = _ctl->inTail;
+                while ( tail != head )
+                {
+                        size_t off = tail % _ctl->inSize;
+                        size_t len = std::min<unsigned long long>( head - tail, _ctl->inSize - off );
+                        _handler->onData( _in + off, len );
+                        tail += len;
+                        shmStore( _ctl->inTail, tail );
+                }
+        }
+
+        ///Calls ITransportHandler::onWake and onReady for what is due
+        void wakeHandler()
+        {
+                bool woken;
+                {
+                        modepp::scoped_lock lock(_wakeMutex);
+                        woken = _woken;
+                        _woken = false;
+                }
+                if ( _due && modeppTimestamp() >= _due )
+                {
+                        _due = 0;
+                        woken = true;
+                }
+                if ( woken )
+                        _handler->onWake();
+                if ( _watched.empty() || ::poll( &_watched[0], _watched.size(), 0 ) <= 0 )
+                        return;
+                std::vector<int> ready;
+                for ( size_t i = 0; i < _watched.size(); ++i )
+                {
+                        if ( _watched[i].revents )
+                                ready.push_back( _watched[i].fd );
+                }
+                for ( size_t i = 0; i < ready.size(); ++i )
+                {
+                        unwatchDescriptor( ready[i] );
+                        _handler->onReady( ready[i] );
+                }
+        }
+
+        ///Polls client-state and in-ring
+        void doWork()
+        {
+                unsigned int waited = 0;
+                while ( !_stop )
+                {
+                        bool attached = shmLoad( _ctl->attached ) != 0;
+                        if ( attached && !_connected )
+                        {
+                                _handler->onConnected();
+                                _connected = true;
+                        }
+                        else if ( !attached && _connected )
+                        {
+                                _connected = false;
+                                _handler->onDisconnected();
+                        }
+                        if ( attached )
+                                receive();
+                        wakeHandler();
+
+                        timespec ts = { 0, MODEPP_SHM_POLL_MS * 1000000L };
+                        nanosleep( &ts, 0 );
+                        waited += MODEPP_SHM_POLL_MS;
+                        if ( waited >= MODEPP_TRACE_FLUSH_MS )
+                        {
+                                waited = 0;
+                                _handler->onTick();
+                        }
+                }
+        }
+
+public:
+        ShmTransport():_handler(0),_size(0),_ctl(0),_out(0),_in(0),_stop(false),_woken(false),_due(0){}
+
+        ~ShmTransport() { stop(); }
+
+        ///Creates and maps the segment and starts server-thread. Throws std::runtime_error on failure.
+        void start( const std::string & name, ITransportHandler * handler )
+        {
+                _handler = handler;
+                _name = name;
+                const unsigned int insize = 2 * ( MAX_MSG_LEN + 1 );
+                _size = sizeof(ShmControl) + MODEPP_SHM_RING_BYTES + insize;
+                int fd = shm_open( name.c_str(), O_CREAT | O_RDWR, 0600 );
+                if ( fd < 0 || ftruncate( fd, _size ) < 0 )
+                {
+                        if ( fd >= 0 )
+                                ::close( fd );
+                        throw std::runtime_error( "MoDe++: cannot create shared memory " + name );
+                }
+                void * seg = mmap( 0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+                ::close( fd );
+                if ( seg == MAP_FAILED )
+                        throw std::runtime_error( "MoDe++: cannot map shared memory " + name );
+                memset( seg, 0, sizeof(ShmControl) );
+                _ctl = (ShmControl*)seg;
+                _out = (char*)seg + sizeof(ShmControl);
+                _in = _out + MODEPP_SHM_RING_BYTES;
+                _ctl->outSize = MODEPP_SHM_RING_BYTES;
+                _ctl->inSize = insize;
+                shmStore( _ctl->magic, (unsigned int)SHM_MAGIC );
+                _thread = modepp::shared_ptr<modepp::thread>( new modepp::thread( &ShmTransport::doWork, this ) );
+        }
+
+        void stop()
+        {
+                _stop = true;
+                if ( _thread.get() )
+                {
+                        _thread->join();
+                        _thread.reset();
+                }
+                _connected = false;
+                if ( _ctl )
+                {
+                        modepp::scoped_lock lock(_sendMutex);
+                        munmap( _ctl, _size );
+                        shm_unlink( _name.c_str() );
+                        _ctl = 0;
+                }
+        }
+
+        ///Unmaps the segment. It is still owned by the parent
+        void abandon()
+        {
+                _connected = false;
+                if ( _ctl )
+                        munmap( _ctl, _size );
+        }
+
+        modepp::mutex & sendMutex() { return _sendMutex; }
+
+        void send( const char * hdr, size_t hlen, const char * data, size_t dlen )
+        {
+                modepp::scoped_lock lock(_sendMutex);
+                if ( !_ctl || !_connected )
+                        return;
+                unsigned long long head = _ctl->outHead;
+                unsigned long long tail = shmLoad( _ctl->outTail );
+                if ( _ctl->outSize - ( head - tail ) < hlen + dlen )
+                {
+                        shmStore( _ctl->dropped, _ctl->dropped + 1 );
+                        return;
+                }
+                put( head, hdr, hlen );
+                put( head + hlen, data, dlen );
+                shmStore( _ctl->outHead, head + hlen + dlen );
+        }
+
+        ///Fill-levels of the rings
+        void queueDepths( size_t & recvq, size_t & sendq )
+        {
+                recvq = sendq = 0;
+                if ( _ctl )
+                {
+                        recvq = shmLoad( _ctl->inHead ) - _ctl->inTail;
+                        sendq = _ctl->outHead - shmLoad( _ctl->outTail );
+                }
+        }
+
+        ///The server-thread calls ITransportHandler::onWake at its next poll, after at most MODEPP_SHM_POLL_MS
+        void wake()
+        {
+                modepp::scoped_lock lock(_wakeMutex);
+                _woken = true;
+        }
+
+        void wakeAfter( unsigned int ms )
+        {
+                _due = modeppTimestamp() + ms * 1000000ULL;
+        }
+
+        ///Descriptors are polled along with the in-ring
+        bool watchDescriptor( int fd, bool write )
+        {
+                unwatchDescriptor( fd );
+                pollfd p = { fd, (short)( write ? POLLOUT : POLLIN ), 0 };
+                _watched.push_back( p );
+                return true;
+        }
+
+        void unwatchDescriptor( int fd )
+        {
+                for ( size_t i = 0; i < _watched.size(); ++i )
+                {
+                        if ( _watched[i].fd == fd )
+                        {
+                                _watched.erase( _watched.begin() + i );
+                                return;
+                        }
+                }
+        }
+};
+#endif
+
+#ifdef MODEPP_COROUTINES
+struct CoroScript;
+
+///Timers of sleeping coroutines by due time
+typedef std::multimap<unsigned long long, CoroScript*> CoroTimers;
+
+///Running call of a coroutine test-function. Used in the server-thread only
+struct CoroScript
+{
+        CoroTask::Handle root;                  ///<frame of the test-function
+        ITestFunctionWrapper * function;
+        unsigned int id;                        ///<call-id
+        std::coroutine_handle<> waiting;        ///<suspended coroutine: the test-function or a task it awaits
+        std::string * capture;                  ///<returns of a test-function awaited by modeppCall, or 0
+        CoroTimers::iterator timer;             ///<valid while sleeping
+        bool sleeping;
+        int fd;                                 ///<awaited descriptor or -1
+        bool inThread;                          ///<awaits an asynchronous test-function, which runs in an own thread
+        bool cancelled;                         ///<client cancelled the call
+
+        CoroScript():function(0),id(0),capture(0),sleeping(false),fd(-1),inThread(false),cancelled(false){}
+};
+
+///Runs coroutine test-functions in the server-thread. A suspended coroutine costs its frame, no thread and no
+///stack. The event-loop of the transport resumes it when its timer is due or its descriptor is ready, or
+///when another thread posts it.
+class CoroExecutor
+{
+        ITransport * _transport;
+        std::set<CoroScript*> _scripts;
+        CoroTimers _timers;
+        unsigned long long _armed;              ///<time ITransport::wakeAfter was called for, 0 if none
+        std::map<int, CoroScript*> _descriptors;        ///<scripts by awaited descriptor
+        std::vector<CoroScript*> _posted;       ///<scripts posted by other threads
+        std::vector<CoroScript*> _resuming;     ///<posted scripts, which are resumed now
+        modepp::mutex _postedMutex;
+        CoroScript * _current;                  ///<script which runs now
+
+        CoroExecutor(const CoroExecutor &);
+        CoroExecutor& operator=(const CoroExecutor &);
+
+        ///Lets the transport wake the server-thread for the next timer
+        void schedule()
+        {
+                if ( _timers.empty() || !_transport || _timers.begin()->first == _armed )
+                        return;
+                _armed = _timers.begin()->first;
+                unsigned long long now = modeppTimestamp();
+                _transport->wakeAfter( _armed > now ? (unsigned int)( ( _armed - now + 999999 ) / 1000000 ) : 0 );
+        }
+
+        void resume( CoroScript * s );
+        void finish( CoroScript * s );
+public:
+        CoroExecutor():_transport(0),_armed(0),_current(0){}
+
+        ~CoroExecutor() { clear(); }
+
+        ///Sets transport, which runs the server-thread
+        void start( ITransport * t ) { _transport = t; }
+
+        ///Script running in the calling thread, 0 outside of a coroutine test-function
+        CoroScript * current() const { return _current; }
+
+        ///True if the running script was cancelled by the client
+        bool cancelled() const { return _current && _current->cancelled; }
+
+        ///Number of running scripts
+        size_t size() const { return _scripts.size(); }
+
+        ///Starts test-function and runs it till it suspends first. Call in the server-thread
+        void spawn( ITestFunctionWrapper * f, CoroTask task, unsigned int id )
+        {
+                CoroScript * s = new CoroScript;
+                s->root = task.release();
+                s->function = f;
+                s->id = id;
+                s->waiting = s->root;
+                _scripts.insert( s );
+                resume( s );
+                schedule();
+        }
+
+        ///Suspends running script for given time. Returns false if it is cancelled, then it is not suspended
+        bool sleep( std::coroutine_handle<> h, unsigned int ms )
+        {
+                CoroScript * s = _current;
+                if ( !s || s->cancelled )
+                        return false;
+                s->waiting = h;
+                s->timer = _timers.insert( CoroTimers::value_type( modeppTimestamp() + ms * 1000000ULL, s ) );
+                s->sleeping = true;
+                schedule();
+                return true;
+        }
+
+        ///Suspends running script till descriptor is readable (or writable). Returns false if it is not suspended:
+        ///cancelled, the descriptor is awaited already or can't be watched (e.g. a regular file, which is ready)
+        bool await( std::coroutine_handle<> h, int fd, bool write )
+        {
+                CoroScript * s = _current;
+                if ( !s || s->cancelled || _descriptors.count( fd ) || !_transport || !_transport->watchDescriptor( fd, write ) )
+                        return false;
+                _descriptors[fd] = s;
+                s->fd = fd;
+                s->waiting = h;
+                return true;
+        }
+
+        ///Suspends running script till another thread posts it
+        void suspend( std::coroutine_handle<> h )
+        {
+                _current->waiting = h;
+                _current->inThread = true;
+        }
+
+        ///Resumes script in the server-thread. May be called by any thread
+        void post( CoroScript * s )
+        {
+                {
+                        modepp::scoped_lock lock(_postedMutex);
+                        _posted.push_back( s );
+                }
+                if ( _transport )
+                        _transport->wake();
+        }
+
+        ///Resumes posted scripts and those with due timers. Called by ITransportHandler::onWake
+        void run()
+        {
+                _armed = 0;
+                {
+                        modepp::scoped_lock lock(_postedMutex);
+                        _resuming.swap( _posted );
+                }
+                for ( size_t i = 0; i < _resuming.size(); ++i )
+                {
+                        _resuming[i]->inThread = false;
+                        resume( _resuming[i] );
+                }
+                _resuming.clear();
+                unsigned long long now = modeppTimestamp();
+                while ( !_timers.empty() && _timers.begin()->first <= now )
+                {
+                        CoroScript * s = _timers.begin()->second;
+                        _timers.erase( _timers.begin() );
+                        s->sleeping = false;
+                        resume( s );
+                }
+                schedule();
+        }
+
+        ///Resumes script awaiting the descriptor. Called by ITransportHandler::onReady
+        void ready( int fd )
+        {
+                std::map<int, CoroScript*>::iterator it = _descriptors.find( fd );
+                if ( it == _descriptors.end() )
+                        return;
+                CoroScript * s = it->second;
+                _descriptors.erase( it );
+                s->fd = -1;
+                resume( s );
+                schedule();
+        }
+
+        ///Marks scripts of the call cancelled and ends their sleep or wait for a descriptor at once
+        void cancel( unsigned int id )
+        {
+                std::vector<CoroScript*> wake;
+                for ( std::set<CoroScript*>::const_iterator it = _scripts.begin(); it != _scripts.end(); ++it )
+                {
+                        CoroScript * s = *it;
+                        if ( !id || s->id != id )
+                                continue;
+                        s->cancelled = true;
+                        if ( s->sleeping )
+                        {
+                                _timers.erase( s->timer );
+                                s->sleeping = false;
+                                wake.push_back( s );
+                        }
+                        else if ( s->fd >= 0 )
+                        {
+                                if ( _transport )
+                                        _transport->unwatchDescriptor( s->fd );
+                                _descriptors.erase( s->fd );
+                                s->fd = -1;
+                                wake.push_back( s );
+                        }
+                }
+                for ( size_t i = 0; i < wake.size(); ++i )
+                        resume( wake[i] );
+                schedule();
+        }
+
+        ///Destroys suspended scripts. Scripts awaiting a thread are left, the thread still uses them
+        void clear()
+        {
+                for ( std::set<CoroScript*>::const_iterator it = _scripts.begin(); it != _scripts.end(); ++it )
+                {
+                        if ( !(*it)->inThread )
+                        {
+                                (*it)->root.destroy();
+                                delete *it;
+                        }
+                }
+                _scripts.clear();
+                _timers.clear();
+                _descriptors.clear();
+                _armed = 0;
+        }
+
+        ///Forgets scripts in the child after fork. Their frames are leaked, they belong to the parent's server-thread
+        void abandon()
+        {
+                _scripts.clear();
+                _timers.clear();
+                _descriptors.clear();
+                _posted.clear();
+                _transport = 0;
+                _armed = 0;
+        }
+
+        modepp::mutex & postedMutex() { return _postedMutex; }
+};
+#endif
+
+///Main MoDe++ singleton-class. Contains Lists of test-functions, tcp-server.
+class MoDePP: public ITransportHandler
+{	
+        ///Endpoint of the server, given by start-macro or by environment-variable MODEPP
+        struct Endpoint
+        {
+                enum Kind { None, Tcp, Local, Shm } kind;
+                unsigned short port;
+                std::string path;       ///<socket-path or shm-name
+                Endpoint():kind(None),port(0){}
+        };
+
+	modepp::shared_ptr<ITransport> _transport;     ///<owns running transport
+	ITransport * volatile _active;  ///<running transport, read without lock by tracing threads
+	Endpoint _endpoint;             ///<configured endpoint. None if not configured or disabled
+	int _startup;                   ///<one of MODEPP_STARTUP_...
+	volatile bool _startPending;    ///<server starts on next trace
+	modepp::mutex _startMutex;
+
+        ///Trace-buffers of all threads, which traced at least once
+        typedef std::list< modepp::shared_ptr<TraceBuffer> > TraceBuffers;
+        TraceBuffers _traceBuffers;
+        modepp::mutex _traceBuffersMutex;
+        unsigned int _nextThreadId;
+        int _shardLayout;                       ///<one of MODEPP_TRACE_SHARDS_...
+        std::vector<TraceShard*> _shards;       ///<set up before the transport is active, then read without lock
+        std::vector<int> _cpuShard;             ///<trace-shard of each CPU
+        ///Buffer of current thread. Declared after _traceBuffers, so it is released before them
+        ThreadTraceBufferPtr _threadTraceBuffer;
+
+        ///Pairs of value-name and value. A list, so values keep their address while others are added
+        typedef std::list< std::pair<std::string, VarParam> > TVarValues;
+
+        ///Map of parameters and their valid lists of values
+        typedef std::map< std::string, TVarValues > TParVarValues;
+
+        ///Enums of MODEPP_ADD_PARAM_ENUM by parameter-name. Values are never removed
+	TParVarValues _paramValues;
+	modepp::mutex _paramValuesMutex;
+
+        ///Test-functions sorted by name. A published table is never modified: the dispatch reads the current one
+        ///without lock, changes copy it and swap the pointer. A replaced table is freed by a later change, which
+        ///finds no reader (see FunctionTableReader).
+        typedef std::vector<ITestFunctionWrapper*> FuncTable;
+	const FuncTable * _functions;
+	volatile unsigned long _functionReaders;        ///<threads reading a function-table now
+	std::vector<const FuncTable*> _retiredTables;   ///<replaced tables, which may still be read
+	modepp::mutex _functionsMutex;          ///<serializes changes of the function-table
+	ITestFunctionWrapper * _scanned;        ///<head of registrations, when they were added to the table last time
+	std::set<std::string> _functionNames;   ///<names of functions added by addFunction(s)
+
+        ///Objects of MODEPP_EXPOSE by name
+        typedef std::map< std::string, modepp::shared_ptr<IExposed> > ExposedObjects;
+        ExposedObjects _exposed;
+        modepp::mutex _exposedMutex;
+
+        ///Rules of MsgAddRule by call-id. Changed and evaluated by the server-thread, trace-conditions are checked
+        ///by the thread which sends a trace-batch. _rulesMutex guards what both use
+        struct Rule
+        {
+                RulePredicate condition;
+                std::string action;
+                bool holds;             ///<condition was true at last evaluation
+                unsigned long matches;  ///<trace-records matched since last evaluation
+                std::string matchText;  ///<text of first of them
+                Rule():holds(false),matches(0){}
+        };
+        typedef std::map< unsigned int, Rule > Rules;
+        Rules _rules;
+        RulePredicate::Values _ruleValues;      ///<values of last evaluation, used for trace-conditions
+        modepp::mutex _rulesMutex;
+        volatile bool _traceRules;              ///<a rule has a trace-condition
+
+        ///Running asynchronous calls by call-id. The flag is set by MsgCancel
+        typedef std::map< unsigned int, bool > AsyncCalls;
+        AsyncCalls _asyncCalls;
+        modepp::mutex _asyncCallsMutex;
+#ifdef MODEPP_COROUTINES
+        CoroExecutor _coro;                     ///<runs coroutine test-functions in the server-thread
+#endif
+
+        FILE * volatile _record;                ///<recording of calls and returns, 0 if not recording
+        unsigned long long _recordStart;        ///<time recording started
+        volatile bool _recordDirty;             ///<records written since last flush
+        modepp::mutex _recordMutex;
+	
+        std::string _data;      ///<Buffer of received data
+        std::string _msg;       ///<data of current message
+        std::string _fname;     ///<function-name of current call
+        VarParam _params[5];    ///<parameters of current call. Buffers of the server-thread are reused, once they have
+                                ///<grown a call allocates nothing
+
+        unsigned int _metricsMs;                ///<interval of MsgMetrics, 0 if not subscribed
+        unsigned long long _lastMetrics;        ///<time of last MsgMetrics
+
+        volatile bool _sent;                    ///<something was sent since last tick
+        unsigned long long _lastSent;           ///<time of tick, in which _sent was found set
+        unsigned long long _lastReceived;       ///<time of last data from the client
+        unsigned long _droppedBatches;          ///<trace-batches dropped while the client was congested
+
+
+        MoDePP(const MoDePP &); ///<Private copy-constructor - singleton
+        MoDePP& operator=(const MoDePP &); ///<Private op= - singleton
+        ///Constructor
+	MoDePP():_active(0),_startup(MODEPP_STARTUP),_startPending(false),_nextThreadId(0),_shardLayout(MODEPP_TRACE_SHARDS),_functions(0),_functionReaders(0),_scanned(0),_traceRules(false),_record(0),_recordStart(0),_recordDirty(false),_metricsMs(MODEPP_METRICS_MS),_lastMetrics(0),_sent(false),_lastSent(0),_lastReceived(0),_droppedBatches(0)
+	{
+#ifndef _WIN32
+	        pthread_atfork( &MoDePP::forkPrepare, &MoDePP::forkParent, &MoDePP::forkChild );
+#endif
+	}
+	
+	///d-tor
+	~MoDePP()
+	{
+	        stop();
+#ifdef MODEPP_COROUTINES
+	        _coro.clear();
+#endif
+	        record( "" );
+	        for ( size_t i = 0; i < _shards.size(); ++i )
+	                delete _shards[i];
+	        for ( size_t i = 0; i < _retiredTables.size(); ++i )
+	                delete _retiredTables[i];
+	        delete _functions;
+	}
+
+	///Applies environment-variables MODEPP, MODEPP_STARTUP and MODEPP_TRACE_SHARDS to configured endpoint and policy
+	void applyEnvironment()
+	{
+	        const char * rec = getenv( "MODEPP_RECORD" );
+	        if ( rec && *rec && !record( rec ) )
+	                std::cerr << "MoDe++: can't record to " << rec << std::endl;
+	        const char * startup = getenv( "MODEPP_STARTUP" );
+	        if ( startup )
+	        {
+	                std::string s( startup );
+	                if ( s == "static" ) _startup = MODEPP_STARTUP_STATIC;
+	                else if ( s == "lazy" ) _startup = MODEPP_STARTUP_LAZY;
+	                else if ( s == "explicit" ) _startup = MODEPP_STARTUP_EXPLICIT;
+	        }
+	        const char * shards = getenv( "MODEPP_TRACE_SHARDS" );
+	        if ( shards )
+	        {
+	                std::string s( shards );
+	                if ( s == "none" ) _shardLayout = MODEPP_TRACE_SHARDS_NONE;
+	                else if ( s == "node" ) _shardLayout = MODEPP_TRACE_SHARDS_NODE;
+	                else if ( s == "cpu" ) _shardLayout = MODEPP_TRACE_SHARDS_CPU;
+	        }
+	        const char * env = getenv( "MODEPP" );
+	        if ( !env )
+	                return;
+	        std::string e( env );
+	        if ( e == "off" || e == "0" )
+	        {
+	                _endpoint = Endpoint();
+	        }
+	        else if ( e.compare( 0, 6, "local:" ) == 0 )
+	        {
+	                _endpoint.kind = Endpoint::Local;
+	                _endpoint.path = e.substr( 6 );
+	        }
+	        else if ( e.compare( 0, 4, "shm:" ) == 0 )
+	        {
+	                _endpoint.kind = Endpoint::Shm;
+	                _endpoint.path = e.substr( 4 );
+	        }
+	        else if ( atoi( env ) > 0 )
+	        {
+	                _endpoint.kind = Endpoint::Tcp;
+	                _endpoint.port = (unsigned short)atoi( env );
+	        }
+	}
+
+	///Stores endpoint and starts the server according to startup-policy
+	int configure( const Endpoint & ep )
+	{
+	        modepp::scoped_lock lock(_startMutex);
+	        if ( _transport.get() || _endpoint.kind != Endpoint::None )
+	                return 0;
+	        _endpoint = ep;
+	        applyEnvironment();
+	        if ( _endpoint.kind == Endpoint::None )
+	                return 0;
+	        if ( _startup == MODEPP_STARTUP_STATIC )
+	                startTransport();
+	        else if ( _startup == MODEPP_STARTUP_LAZY )
+	                _startPending = true;
+	        return 0;
+	}
+
+	///Creates and starts transport for configured endpoint. Call with locked _startMutex.
+	void startTransport()
+	{
+	        if ( _transport.get() || _endpoint.kind == Endpoint::None )
+	                return;
+	        modepp::shared_ptr<ITransport> t;
+	        if ( _endpoint.kind == Endpoint::Tcp )
+	        {
+	                SocketTransport * st = new SocketTransport;
+	                t = modepp::shared_ptr<ITransport>( st );
+	                st->start( _endpoint.port, this );
+	        }
+#ifndef _WIN32
+	        else if ( _endpoint.kind == Endpoint::Local )
+	        {
+	                SocketTransport * st = new SocketTransport;
+	                t = modepp::shared_ptr<ITransport>( st );
+	                st->startLocal( _endpoint.path, this );
+	        }
+	        else if ( _endpoint.kind == Endpoint::Shm )
+	        {
+	                ShmTransport * st = new ShmTransport;
+	                t = modepp::shared_ptr<ITransport>( st );
+	                st->start( _endpoint.path, this );
+	        }
+#endif
+	        startShards( t.get() );
+#ifdef MODEPP_COROUTINES
+	        _coro.start( t.get() );
+#endif
+	        _transport = t;
+	        _active = t.get();
+	}
+
+	///Creates trace-shards of the configured layout and starts their sender-threads
+	void startShards( ITransport * t )
+	{
+#ifndef _WIN32
+	        if ( _shardLayout == MODEPP_TRACE_SHARDS_NONE || !_shards.empty() )
+	                return;
+	        std::vector< std::vector<int> > groups = modeppCpuGroups( _shardLayout == MODEPP_TRACE_SHARDS_CPU );
+	        _cpuShard.assign( sysconf( _SC_NPROCESSORS_CONF ), 0 );
+	        for ( size_t i = 0; i < groups.size(); ++i )
+	        {
+	                for ( size_t c = 0; c < groups[i].size(); ++c )
+	                        _cpuShard[groups[i][c]] = (int)i;
+	                _shards.push_back( new TraceShard( groups[i] ) );
+	                _shards.back()->start( t );
+	        }
+#endif
+	}
+
+	///Trace-shard of the CPU the calling thread runs on
+	int currentShard() const
+	{
+	        int cpu = 0;
+#ifdef __linux__
+	        cpu = sched_getcpu();
+#endif
+	        return cpu >= 0 && cpu < (int)_cpuShard.size() ? _cpuShard[cpu] : 0;
+	}
+
+	///Lazy start on first trace. Errors are reported but don't reach the tracing code
+	void startDeferred()
+	{
+	        _startPending = false;
+	        try
+	        {
+	                startNow();
+	        }
+	        catch ( std::exception & e )
+	        {
+	                std::cerr << "MoDe++: server not started: " << e.what() << std::endl;
+	        }
+	}
+
+#ifndef _WIN32
+	///pthread_atfork-handlers. Locks are held over fork, so the child gets consistent state
+	static void forkPrepare()
+	{
+	        instance()._startMutex.lock();
+	        instance()._traceBuffersMutex.lock();
+	        instance()._asyncCallsMutex.lock();
+	        instance()._functionsMutex.lock();
+	        instance()._recordMutex.lock();
+	        instance()._paramValuesMutex.lock();
+	        instance()._rulesMutex.lock();
+	        instance()._exposedMutex.lock();
+#ifdef MODEPP_COROUTINES
+	        instance()._coro.postedMutex().lock();
+#endif
+	        if ( instance()._transport.get() )      // kept by _startMutex
+	                instance()._transport->sendMutex().lock();
+	}
+
+	static void forkParent()
+	{
+	        if ( instance()._transport.get() )
+	                instance()._transport->sendMutex().unlock();
+#ifdef MODEPP_COROUTINES
+	        instance()._coro.postedMutex().unlock();
+#endif
+	        instance()._exposedMutex.unlock();
+	        instance()._rulesMutex.unlock();
+	        instance()._paramValuesMutex.unlock();
+	        instance()._recordMutex.unlock();
+	        instance()._functionsMutex.unlock();
+	        instance()._asyncCallsMutex.unlock();
+	        instance()._traceBuffersMutex.unlock();
+	        instance()._startMutex.unlock();
+	}
+
+	///Only the forking thread exists in the child. Server-thread and buffers of other threads are abandoned,
+	///the server is started again on the next trace (or by MODEPP_START_NOW in MODEPP_STARTUP_EXPLICIT mode).
+	static void forkChild()
+	{
+	        MoDePP & m = instance();
+	        if ( m._transport.get() )
+	        {
+	                m._transport->sendMutex().unlock();
+	                m._active = 0;
+	                m._transport->abandon();
+	                new modepp::shared_ptr<ITransport>( m._transport ); // intentionally leaked: can't be stopped in the child
+	                m._transport.reset();
+	                m._startPending = m._startup != MODEPP_STARTUP_EXPLICIT;
+	        }
+	        new TraceBuffers( m._traceBuffers );   // intentionally leaked: mutexes may be held by threads of the parent
+	        m._traceBuffers.clear();
+	        m._threadTraceBuffer.reset( 0 );
+	        m._shards.clear();      // intentionally leaked: their sender-threads don't exist in the child
+	        m._cpuShard.clear();
+	        m._asyncCalls.clear();  // their threads don't exist in the child
+	        m._functionReaders = 0; // readers of the parent don't exist in the child either
+	        m._record = 0;          // intentionally leaked: closing it would write records of the parent again
+#ifdef MODEPP_COROUTINES
+	        m._coro.abandon();
+	        m._coro.postedMutex().unlock();
+#endif
+	        m._exposedMutex.unlock();
+	        m._rulesMutex.unlock();
+	        m._paramValuesMutex.unlock();
+	        m._recordMutex.unlock();
+	        m._functionsMutex.unlock();
+	        m._asyncCallsMutex.unlock();
+	        m._traceBuffersMutex.unlock();
+	        m._startMutex.unlock();
+	}
+#endif
+
+	virtual void onConnected()
+	{
+	        _data.clear();
+	        _metricsMs = MODEPP_METRICS_MS;
+	        _lastSent = _lastReceived = modeppTimestamp();
+	        modepp::scoped_lock lock(_rulesMutex);
+	        _rules.clear();
+	        _traceRules = false;
+	}
+
+	virtual void onData( const char * data, size_t length )
+	{
+	        _lastReceived = modeppTimestamp();
+	        _data.append( data, length );
+	        processData();
+	}
+
+	virtual void onDisconnected()
+	{
+	}
+
+	virtual void onTick()
+	{
+	        flushTraceBuffers();
+	        flushRecord();
+	        sendMetrics();
+	        evaluateRules();
+	        checkSession();
+	}
+
+#ifdef MODEPP_COROUTINES
+	virtual void onWake()
+	{
+	        _coro.run();
+	}
+
+	virtual void onReady( int fd )
+	{
+	        _coro.ready( fd );
+	}
+#endif
+
+	///Compiles rule of MsgAddRule
+	void addRule( const std::string & msgdata )
+	{
+	        if ( msgdata.length() < CALL_ID_LEN )
+	                return;
+	        unsigned int id = strtoul( msgdata.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 );
+	        std::string rule = msgdata.substr( CALL_ID_LEN );
+	        size_t arrow = rule.find( "=>" );
+	        Rule r;
+	        if ( !r.condition.compile( rule.substr( 0, arrow ) ) )
+	        {
+	                unsigned int prev = setCallId( id );
+	                sendReturn( "Error! invalid rule: " + r.condition.error() );
+	                setCallId( prev );
+	                return;
+	        }
+	        if ( arrow != std::string::npos )
+	        {
+	                r.action = rule.substr( arrow + 2 );
+	                r.action.erase( 0, r.action.find_first_not_of( " \t" ) );
+	        }
+	        modepp::scoped_lock lock(_rulesMutex);
+	        _rules[id] = r;
+	        _traceRules = _traceRules || r.condition.matchesTraces();
+	}
+
+	///Removes rule. Returns false if there is none with this id
+	bool removeRule( unsigned int id )
+	{
+	        modepp::scoped_lock lock(_rulesMutex);
+	        if ( !_rules.erase( id ) )
+	                return false;
+	        _traceRules = false;
+	        for ( Rules::const_iterator it = _rules.begin(); it != _rules.end(); ++it )
+	                _traceRules = _traceRules || it->second.condition.matchesTraces();
+	        return true;
+	}
+
+	///Checks trace-records of a batch against trace-conditions. Called by the thread sending the batch
+	void matchRules( const std::string & records )
+	{
+	        modepp::scoped_lock lock(_rulesMutex);
+	        for ( size_t pos = 0; pos + TRACE_RECORD_HEADER_LEN <= records.length(); )
+	        {
+	                size_t len = strtoul( records.substr( pos + TRACE_RECORD_HEADER_LEN - 4, 4 ).c_str(), 0, 16 );
+	                const char * text = records.data() + pos + TRACE_RECORD_HEADER_LEN;
+	                for ( Rules::iterator it = _rules.begin(); it != _rules.end(); ++it )
+	                {
+	                        Rule & r = it->second;
+	                        if ( r.condition.matchesTraces() && r.condition.evaluate( _ruleValues, text, len ) && !r.matches++ )
+	                                r.matchText.assign( text, len );
+	                }
+	                pos += TRACE_RECORD_HEADER_LEN + len;
+	        }
+	}
+
+	///Numeric value of exposed object, NaN if there is none
+	double exposedValue( const std::string & name )
+	{
+	        modepp::shared_ptr<IExposed> e;
+	        {
+	                modepp::scoped_lock lock(_exposedMutex);
+	                ExposedObjects::const_iterator it = _exposed.find( name );
+	                if ( it != _exposed.end() )
+	                        e = it->second;
+	        }
+	        std::string chunk;
+	        if ( e.get() )
+	                modepp::shared_ptr<IDumpSession>( e->dump() )->next( chunk );
+	        char * end = 0;
+	        double v = strtod( chunk.c_str(), &end );
+	        return e.get() && end != chunk.c_str() ? v : std::numeric_limits<double>::quiet_NaN();
+	}
+
+	///Reads values used by rules, evaluates them and runs actions of fired ones. Called in the server-thread
+	void evaluateRules()
+	{
+	        if ( _rules.empty() )
+	                return;
+	        std::vector<std::string> names;
+	        for ( Rules::const_iterator it = _rules.begin(); it != _rules.end(); ++it )
+	                it->second.condition.names( names );
+	        RulePredicate::Values values;
+	        bool metrics = false;
+	        for ( size_t i = 0; i < names.size(); ++i )
+	        {
+	                if ( names[i][0] == '$' )
+	                        values[names[i]] = exposedValue( names[i].substr( 1 ) );
+	                else
+	                        metrics = true;
+	        }
+#ifdef __linux__
+	        if ( metrics && connected() )
+	        {
+	                size_t recvq = 0, sendq = 0;
+	                _active->queueDepths( recvq, sendq );
+	                std::stringstream m;
+	                ProcessMetrics::collect( m, recvq, sendq );
+	                std::string w;
+	                while ( m >> w )
+	                {
+	                        size_t eq = w.find( '=' );
+	                        if ( eq != std::string::npos && w.compare( 0, eq, "thread" ) != 0 )
+	                                values[w.substr( 0, eq )] = strtod( w.c_str() + eq + 1, 0 );
+	                }
+	        }
+#endif
+	        std::vector< std::pair<unsigned int, std::string> > fired;
+	        {
+	                modepp::scoped_lock lock(_rulesMutex);
+	                _ruleValues.swap( values );
+	                for ( Rules::iterator it = _rules.begin(); it != _rules.end(); ++it )
+	                {
+	                        Rule & r = it->second;
+	                        bool holds = r.condition.evaluate( _ruleValues, 0, 0 );
+	                        if ( r.matches )
+	                        {
+	                                std::stringstream s;
+	                                s << "fired n=" << r.matches << " " << r.matchText;
+	                                fired.push_back( std::make_pair( it->first, s.str() ) );
+	                                r.matches = 0;
+	                                r.matchText.clear();
+	                        }
+	                        else if ( holds && !r.holds )
+	                        {
+	                                fired.push_back( std::make_pair( it->first, std::string( "fired" ) ) );
+	                        }
+	                        r.holds = holds;
+	                }
+	        }
+	        for ( size_t i = 0; i < fired.size(); ++i )
+	                fireRule( fired[i].first, fired[i].second );
+	}
+
+	///Reports firing of rule and runs its action
+	void fireRule( unsigned int id, const std::string & report )
+	{
+	        Rules::const_iterator it = _rules.find( id );
+	        if ( it == _rules.end() )
+	                return;
+	        std::string action = it->second.action;
+	        unsigned int prev = setCallId( id );
+	        sendProgress( report );
+	        std::stringstream a( action );
+	        std::string verb, name;
+	        a >> verb >> name;
+	        if ( verb == "call" )
+	        {
+	                VarParam p[5] = { VarParam(""), VarParam(""), VarParam(""), VarParam(""), VarParam("") };
+	                std::string w;
+	                for ( int i = 0; i < 5 && a >> w; ++i )
+	                        p[i] = VarParam( w );
+	                callFunction( id, true, name, p );
+	        }
+	        else if ( verb == "dump" )
+	        {
+	                char hdr[CALL_ID_LEN+1];
+	                sprintf( hdr, "%08x", id );
+	                startDump( hdr + name );
+	        }
+#ifdef __linux__
+	        else if ( verb == "metrics" )
+	        {
+	                size_t recvq = 0, sendq = 0;
+	                _active->queueDepths( recvq, sendq );
+	                std::stringstream m;
+	                ProcessMetrics::collect( m, recvq, sendq );
+	                send( MsgMetrics, m.str() );
+	        }
+#endif
+	        setCallId( prev );
+	}
+
+	///Reports dropped traces, sends heartbeat to a quiet connection and disconnects an idle client
+	void checkSession()
+	{
+	        ITransport * t = _active;
+	        if ( !t || !t->connected() )
+	                return;
+	        unsigned long dropped = modepp::atomicLoad( _droppedBatches );
+	        if ( dropped && !t->congested() )
+	        {
+	                modepp::atomicAdd( _droppedBatches, 0UL - dropped );
+	                std::stringstream s;
+	                s << "MoDe++: " << dropped << " trace-batches dropped, client was too slow";
+	                send( MsgTrace, s.str() );
+	        }
+	        unsigned long long now = modeppTimestamp();
+	        if ( _sent )
+	        {
+	                _sent = false;
+	                _lastSent = now;
+	        }
+	        else if ( MODEPP_HEARTBEAT_MS && now - _lastSent >= MODEPP_HEARTBEAT_MS * 1000000ULL )
+	        {
+	                send( MsgHeartbeat, "" );
+	        }
+	        if ( MODEPP_IDLE_TIMEOUT_MS && now - _lastReceived >= MODEPP_IDLE_TIMEOUT_MS * 1000000ULL )
+	        {
+	                t->disconnectClient();
+	        }
+	}
+
+	///Sends MsgMetrics if subscribed and interval is over
+	void sendMetrics()
+	{
+#ifdef __linux__
+	        unsigned long long now = modeppTimestamp();
+	        if ( !_metricsMs || now - _lastMetrics < _metricsMs * 1000000ULL || !connected() )
+	                return;
+	        _lastMetrics = now;
+	        size_t recvq = 0, sendq = 0;
+	        _active->queueDepths( recvq, sendq );
+	        std::stringstream s;
+	        ProcessMetrics::collect( s, recvq, sendq );
+	        send( MsgMetrics, s.str() );
+#endif
+	}
+
+	///Sends staged records of a buffer, or queues them in its trace-shard. Called with locked buffer-mutex, so batches
+	///of one thread keep their order
+	void sendTraceBuffer( TraceBuffer & b )
+	{
+	        if ( !b.empty() )
+	        {
+	                if ( _traceRules )
+	                        matchRules( b.records() );
+	                ITransport * t = _active;
+	                if ( t && t->congested() )
+	                {
+	                        modepp::atomicAdd( _droppedBatches, 1 );
+	                }
+	                else if ( b.shard() >= 0 && t && t->connected() )
+	                {
+	                        _shards[b.shard()]->push( b.records() );
+	                        _sent = true;
+	                }
+	                else
+	                {
+	                        send( MsgTraceBatch, b.records() );
+	                }
+	                b.clear();
+	        }
+	}
+
+	///Sends trace-buffers of all threads and removes buffers of finished threads
+	void flushTraceBuffers()
+	{
+	        modepp::scoped_lock lock(_traceBuffersMutex);
+	        for ( TraceBuffers::iterator it = _traceBuffers.begin(); it != _traceBuffers.end(); )
+	        {
+	                bool detached;
+	                {
+	                        modepp::scoped_lock block( (*it)->mutex() );
+	                        sendTraceBuffer( **it );
+	                        detached = (*it)->detached();
+	                }
+	                if ( detached )
+	                        it = _traceBuffers.erase( it );
+	                else
+	                        ++it;
+	        }
+	}
+
+	///Returns trace-buffer of calling thread. Creates and registers it on first use
+	TraceBuffer & threadTraceBuffer()
+	{
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        if ( !b )
+	        {
+	                modepp::scoped_lock lock(_traceBuffersMutex);
+	                modepp::shared_ptr<TraceBuffer> nb( new TraceBuffer( _nextThreadId++ ) );
+	                _traceBuffers.push_back( nb );
+	                b = nb.get();
+	                _threadTraceBuffer.reset( b );
+	        }
+	        return *b;
+	}
+
+	///Reads function-name and up to 5 parameters of a call-message, missing ones are empty. Returns false if
+	///a length is not hex or longer than the rest of the message
+	static bool readCall( const std::string & msgdata, std::string & fname, std::string * params[5] )
+	{
+	        fname.clear();
+	        for ( int i = 0; i < 5; ++i )
+	                params[i]->clear();
+	        size_t pos = 0;
+	        for ( int i = -1; i < 5 && pos < msgdata.length(); ++i )
+	        {
+	                long len = pos + 4 <= msgdata.length() ? parseHex( msgdata.data() + pos, 4 ) : -1;
+	                if ( len < 0 || pos + 4 + len > msgdata.length() )
+	                        return false;
+	                ( i < 0 ? fname : *params[i] ).assign( msgdata, pos + 4, len );
+	                pos += 4 + len;
+	        }
+	        return true;
+	}
+
+	///Starts dump of MsgDump in an own thread. Without name, the names of exposed objects are sent
+	void startDump( const std::string & msgdata );
+
+	///Starts load test of MsgLoadTest in an own thread. Invalid requests are answered by an error-return
+	void startLoadTest( const std::string & msgdata );
+
+	///Parses given number of hex digits. Returns -1 if one is invalid
+	static long parseHex( const char * p, int digits )
+	{
+	        long v = 0;
+	        for ( int i = 0; i < digits; ++i )
+	        {
+	                char ch = p[i];
+	                int d;
+	                if ( ch >= '0' && ch <= '9' ) d = ch - '0';
+	                else if ( ch >= 'a' && ch <= 'f' ) d = ch - 'a' + 10;
+	                else if ( ch >= 'A' && ch <= 'F' ) d = ch - 'A' + 10;
+	                else return -1;
+	                v = v * 16 + d;
+	        }
+	        return v;
+	}
+
+	///Processes all complete messages in received data. The header is parsed again till its message is complete,
+	///so no state is kept between calls. A header which is not hex can't be resynchronized: the received data
+	///is dropped and the client disconnected
+	void processData()
+	{
+	        size_t pos = 0;
+	        while ( pos + HEADER_LEN <= _data.length() )
+	        {
+	                long len = parseHex( _data.data() + pos, 4 );
+	                long command = parseHex( _data.data() + pos + 4, 4 );
+	                if ( len < 0 || command < 0 )
+	                {
+	                        _data.clear();
+	                        if ( _active )
+	                                _active->disconnectClient();
+	                        return;
+	                }
+	                if ( pos + HEADER_LEN + len > _data.length() )
+	                        break;
+	                _msg.assign( _data, pos + HEADER_LEN, len );
+	                pos += HEADER_LEN + len;
+	                dispatch( (int)command, _msg );
+	        }
+	        _data.erase( 0, std::min( pos, _data.length() ) );
+	}
+
+	///Processes one message of the client. Unknown commands are ignored, so newer clients may probe for features
+	void dispatch( int command, std::string & msgdata )
+	{
+	        if ( command == MsgGetVersion )
+	        {
+	                send( MsgVersion, MoDePP_Version );
+	        }
+	        else if (command == MsgListFunctions)
+	        {
+	            //std::cout << "Processing MsgListFunctions"<<std::endl;
+	            FunctionTableReader functions( *this );
+	            for ( FuncTable::const_iterator fe = functions.table.begin(); fe != functions.table.end(); ++fe )
+	            {
+	                send( MsgAddFunction, std::string( (*fe)->_name ) + " " + (*fe)->_parameters );
+	            }
+	        }
+	        else if ( command == MsgHeartbeat )
+	        {
+	        }
+	        else if ( command == MsgGetFunctionList )
+	        {
+	            sendFunctionList( msgdata );
+	        }
+	        else if (command == MsgCallFunction || command == MsgCallFunctionId)
+	        {
+	            //std::cout << "Processing MsgCallFunction"<<std::endl;
+	            unsigned int callId = 0;
+	            if ( _record )
+	                recordMessage( command, msgdata.data(), msgdata.length() );
+	            if ( command == MsgCallFunctionId )
+	            {
+	                char id[CALL_ID_LEN+1] = "";
+	                strncat( id, msgdata.c_str(), CALL_ID_LEN );
+	                callId = strtoul( id, 0, 16 );
+	                msgdata.erase( 0, std::min<size_t>( CALL_ID_LEN, msgdata.length() ) );
+	            }
+	            std::string *params[]={&_params[0].str(),&_params[1].str(),&_params[2].str(),&_params[3].str(),&_params[4].str()};
+	            bool valid = readCall( msgdata, _fname, params );
+	            callFunction( callId, valid, _fname, _params );
+	        }
+#ifndef _WIN32
+	        else if ( command == MsgGetAllocStats )
+	        {
+	            send( MsgAllocStats, AllocTracker::report( msgdata.empty() ? 10 : atoi( msgdata.c_str() ) ) );
+	        }
+#endif
+	        else if ( command == MsgSetMetrics )
+	        {
+	            _metricsMs = atoi( msgdata.c_str() );
+	            _lastMetrics = 0;
+	        }
+	        else if ( command == MsgDump )
+	        {
+	            startDump( msgdata );
+	        }
+	        else if ( command == MsgLoadTest )
+	        {
+	            startLoadTest( msgdata );
+	        }
+	        else if ( command == MsgCancel )
+	        {
+	            unsigned int id = strtoul( msgdata.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 );
+	            cancel( id );
+#ifdef MODEPP_COROUTINES
+	            _coro.cancel( id );
+#endif
+	            if ( removeRule( id ) )
+	            {
+	                unsigned int prev = setCallId( id );
+	                sendWithCallId( MsgCallDone, "cancelled" );
+	                setCallId( prev );
+	            }
+	        }
+	        else if ( command == MsgAddRule )
+	        {
+	            addRule( msgdata );
+	        }
+	}
+public:	
+	///Creates and returns singleton instance. Called on each trace, so it takes no lock.
+	static MoDePP & instance()
+	{
+	        static MoDePP inst;
+	        return inst;
+	}
+	
+	// Starts the server (return value is dummy, required for calling the function as static-initializer).
+	// Depending on MODEPP_STARTUP the server is started now, on first trace or by MODEPP_START_NOW.
+	int start( unsigned short p )
+	{
+	         Endpoint ep;
+	         ep.kind = Endpoint::Tcp;
+	         ep.port = p;
+	         return configure( ep );
+	}
+
+#ifndef _WIN32
+	///Starts the server on a unix domain socket
+	int startLocal( const std::string & path )
+	{
+	         Endpoint ep;
+	         ep.kind = Endpoint::Local;
+	         ep.path = path;
+	         return configure( ep );
+	}
+
+	///Starts the server on a shared-memory segment
+	int startShm( const std::string & name )
+	{
+	         Endpoint ep;
+	         ep.kind = Endpoint::Shm;
+	         ep.path = name;
+	         return configure( ep );
+	}
+#endif
+
+	///Starts configured server immediately, regardless of startup-policy
+	int startNow()
+	{
+	        modepp::scoped_lock lock(_startMutex);
+	        startTransport();
+	        return 0;
+	}
+	
+	//Stops the server (hardly required in the praxis)
+	void stop()
+	{
+	        for ( size_t i = 0; i < _shards.size(); ++i )
+	                _shards[i]->stop();
+	        if ( _transport.get() )
+	                _transport->stop();
+	}
+
+	///True if a client is connected
+	bool connected() const
+	{
+	        ITransport * t = _active;
+	        return t && t->connected();
+	}
+	
+	
+	void send( const std::string & data )
+	{
+	        if ( connected() )
+	                _active->send( data.data(), data.length(), 0, 0 );
+	}
+
+	///Stages time-stamped trace-record in buffer of calling thread. Buffer is sent when full.
+	void trace( const std::string & text )
+	{
+	        if ( !connected() )
+	        {
+	                if ( _startPending )
+	                        startDeferred();
+	                return;
+	        }
+	        TraceBuffer & b = threadTraceBuffer();
+	        if ( b.quiet() )
+	                return;
+	        modepp::scoped_lock lock( b.mutex() );
+	        if ( b.shard() < 0 && !_shards.empty() )
+	                b.setShard( currentShard() );
+	        if ( b.wouldOverflow( text.length() ) )
+	                sendTraceBuffer( b );
+	        b.append( text );
+	        if ( b.full() )
+	                sendTraceBuffer( b );
+	}
+
+	///Call-id of calling thread
+	unsigned int callId()
+	{
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        return b ? b->callId() : 0;
+	}
+
+	///Sets call-id of calling thread and returns previous one
+	unsigned int setCallId( unsigned int id )
+	{
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        if ( !b && !id )
+	                return 0;
+	        TraceBuffer & tb = b ? *b : threadTraceBuffer();
+	        unsigned int prev = tb.callId();
+	        tb.setCallId( id );
+	        return prev;
+	}
+
+	///Makes traces and returns of calling thread dropped (or sent again)
+	void setQuiet( bool q )
+	{
+	        threadTraceBuffer().setQuiet( q );
+	}
+
+	///True if traces and returns of calling thread are dropped
+	bool quiet()
+	{
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        return b && b->quiet();
+	}
+
+	///Sends return of a test-function. Tagged with call-id of calling thread if it has one
+	void sendReturn( const std::string & data )
+	{
+	        if ( quiet() )
+	                return;
+#ifndef _WIN32
+	        if ( AllocTracker::enabled() )
+	        {
+	                const AllocTracker::Counters & now = AllocTracker::threadCounters(), & start = AllocTracker::callStart();
+	                unsigned long long allocs = now.allocs - start.allocs, bytes = now.allocBytes - start.allocBytes;
+	                char suffix[64];
+	                sprintf( suffix, " allocs=%llu bytes=%llu", allocs, bytes );
+	                std::string & out = outputBuffer();
+	                out.assign( data );
+	                out += suffix;
+	                sendReturnText( out );
+	                return;
+	        }
+#endif
+	        sendReturnText( data );
+	}
+
+	///Sends return as MsgReturn or, with call-id of calling thread, as MsgReturnId
+	void sendReturnText( const std::string & data )
+	{
+#ifdef MODEPP_COROUTINES
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        if ( b && b->capture() )
+	        {
+	                if ( !b->capture()->empty() )
+	                        *b->capture() += '\n';
+	                *b->capture() += data;
+	                return;
+	        }
+#endif
+	        unsigned int id = callId();
+	        if ( !id )
+	        {
+	                send( MsgReturn, data );
+	                return;
+	        }
+	        send( MsgReturnId, id, data );
+	}
+
+	///Sends message with call-id of calling thread before data
+	void sendWithCallId( CommandNumber cmd, const std::string & data )
+	{
+	        send( cmd, callId(), data );
+	}
+
+	///Reusable buffer of calling thread for formatting a return, see MODEPP_RETURN_TEST_FUNCTION
+	std::string & outputBuffer()
+	{
+	        return threadTraceBuffer().output();
+	}
+
+#ifdef MODEPP_COROUTINES
+	///Executor of coroutine test-functions
+	CoroExecutor & coroutines() { return _coro; }
+
+	///Makes returns of calling thread appended to given string (0: sent) and returns previous one
+	std::string * setCapture( std::string * c )
+	{
+	        TraceBuffer & b = threadTraceBuffer();
+	        std::string * prev = b.capture();
+	        b.setCapture( c );
+	        return prev;
+	}
+#endif
+
+	///Sends progress of running call
+	void sendProgress( const std::string & data )
+	{
+	        if ( !quiet() )
+	                sendWithCallId( MsgProgress, data );
+	}
+
+	///Registers asynchronous call. Calls without id can't be cancelled, so they are not registered
+	void beginAsync( unsigned int id )
+	{
+	        if ( !id )
+	                return;
+	        modepp::scoped_lock lock(_asyncCallsMutex);
+	        _asyncCalls[id] = false;
+	}
+
+	///Removes asynchronous call of calling thread and sends MsgCallDone
+	void endAsync()
+	{
+	        bool wasCancelled = cancelled();
+	        {
+	                modepp::scoped_lock lock(_asyncCallsMutex);
+	                _asyncCalls.erase( callId() );
+	        }
+	        flushThreadTraces();
+	        sendWithCallId( MsgCallDone, wasCancelled ? "cancelled" : "done" );
+	}
+
+	///Sets cancel-flag of running asynchronous call
+	void cancel( unsigned int id )
+	{
+	        modepp::scoped_lock lock(_asyncCallsMutex);
+	        AsyncCalls::iterator it = _asyncCalls.find( id );
+	        if ( it != _asyncCalls.end() )
+	                it->second = true;
+	}
+
+	///True if the call of calling thread was cancelled by client
+	bool cancelled()
+	{
+	        unsigned int id = callId();
+	        if ( !id )
+	                return false;
+	        modepp::scoped_lock lock(_asyncCallsMutex);
+	        AsyncCalls::const_iterator it = _asyncCalls.find( id );
+	        return it != _asyncCalls.end() && it->second;
+	}
+
+	///Sends staged trace-records of calling thread, together with the other batches queued in its trace-shard
+	void flushThreadTraces()
+	{
+	        TraceBuffer * b = _threadTraceBuffer.get();
+	        if ( b )
+	        {
+	                {
+	                        modepp::scoped_lock lock( b->mutex() );
+	                        sendTraceBuffer( *b );
+	                }
+	                if ( b->shard() >= 0 )
+	                        _shards[b->shard()]->drain( _active );
+	        }
+	}
+	
+	
+	void send( CommandNumber cmd, int value )
+	{
+	        if ( connected() )
+	        {
+	                std::stringstream s;
+	                s << value;
+	                send ( cmd, s.str() );
+	        }
+	}
 	
+	///Sends message with call-id before data. The id is formatted on the stack along with the header, so data is
+	///not copied.
+	void send( CommandNumber cmd, unsigned int id, const std::string & data )
+	{
+	        if ( connected() )
+	        {
+	                size_t len = std::min<size_t>( data.length(), MAX_MSG_LEN - CALL_ID_LEN );
+	                char hdr[HEADER_LEN+CALL_ID_LEN+1];
+	                sprintf( hdr, "%04x%04x%08x", (unsigned int)( len + CALL_ID_LEN ), (unsigned int)cmd, id );
+	                _active->send( hdr, HEADER_LEN + CALL_ID_LEN, data.data(), len );
+	                _sent = true;
+	                if ( _record && ( cmd == MsgReturnId || cmd == MsgCallDone ) )
+	                        recordMessage( cmd, data.data(), len, hdr + HEADER_LEN );
+	        }
+	}
+
+	///Sends message. Header is formatted on the stack and written together with data, data is not copied.
 	void send( CommandNumber cmd, const std::string & data )
 	{
-	        if ( _socket.get() )
+	        if ( connected() )
+	        {
+	                size_t len = std::min<size_t>( data.length(), MAX_MSG_LEN );
+	                char hdr[HEADER_LEN+1];
+	                sprintf( hdr, "%04x%04x", (unsigned int)len, (unsigned int)cmd );
+	                _active->send( hdr, HEADER_LEN, data.data(), len );
+	                _sent = true;
+	                if ( _record && ( cmd == MsgReturn || cmd == MsgReturnId || cmd == MsgCallDone ) )
+	                        recordMessage( cmd, data.data(), len );
+	        }
+	}
+
+	///Starts recording of calls and returns into file (see Recording), empty path stops it.
+	///Returns false if the file can't be opened
+	bool record( const std::string & path )
+	{
+	        modepp::scoped_lock lock(_recordMutex);
+	        if ( _record )
 	        {
-	                std::stringstream msgdata;
-	    			msgdata<< hex << setw(4) << setfill('0') << data.length()
-	                       << hex << setw(4) << setfill('0') << cmd <<data;
-	                send( msgdata.str() );
+	                fclose( _record );
+	                _record = 0;
 	        }
+	        if ( path.empty() )
+	                return true;
+	        FILE * f = fopen( path.c_str(), "wb" );
+	        if ( !f )
+	                return false;
+	        fputs( MODEPP_RECORD_MAGIC, f );
+	        _recordStart = modeppTimestamp();
+	        _record = f;
+	        return true;
+	}
+
+	///Appends message to the recording, optionally with call-id before data
+	void recordMessage( int cmd, const char * data, size_t len, const char * id = 0 )
+	{
+	        modepp::scoped_lock lock(_recordMutex);
+	        if ( !_record )
+	                return;
+	        unsigned long long t = modeppTimestamp() - _recordStart;
+	        size_t total = len + ( id ? CALL_ID_LEN : 0 );
+	        unsigned char hdr[11];
+	        hdr[0] = (unsigned char)cmd;
+	        for ( int i = 0; i < 8; ++i )
+	                hdr[1+i] = (unsigned char)( t >> ( 8 * i ) );
+	        hdr[9] = (unsigned char)total;
+	        hdr[10] = (unsigned char)( total >> 8 );
+	        fwrite( hdr, 1, sizeof(hdr), _record );
+	        if ( id )
+	                fwrite( id, 1, CALL_ID_LEN, _record );
+	        fwrite( data, 1, len, _record );
+	        _recordDirty = true;
+	}
+
+	///Writes buffered records to the file. Called by the server-thread periodically
+	void flushRecord()
+	{
+	        if ( !_recordDirty )
+	                return;
+	        modepp::scoped_lock lock(_recordMutex);
+	        _recordDirty = false;
+	        if ( _record )
+	                fflush( _record );
 	}
 	
 	
-	//adds a test function to the list
+	///Sends message received from another MoDe++ server, preceded by MsgSource with its name. Both are written
+	///at once, so messages of other threads don't come between them. Used by the relay
+	void sendFromSource( const std::string & source, int cmd, const char * data, size_t len )
+	{
+	        ITransport * t = _active;
+	        if ( !t || !t->connected() )
+	                return;
+	        if ( cmd == MsgTraceBatch && t->congested() )
+	        {
+	                modepp::atomicAdd( _droppedBatches, 1 );
+	                return;
+	        }
+	        size_t slen = std::min<size_t>( source.length(), MAX_MSG_LEN );
+	        len = std::min<size_t>( len, MAX_MSG_LEN );
+	        char hdr[HEADER_LEN+1];
+	        std::string head;
+	        head.reserve( 2 * HEADER_LEN + slen );
+	        sprintf( hdr, "%04x%04x", (unsigned int)slen, (unsigned int)MsgSource );
+	        head.append( hdr, HEADER_LEN );
+	        head.append( source, 0, slen );
+	        sprintf( hdr, "%04x%04x", (unsigned int)len, (unsigned int)cmd );
+	        head.append( hdr, HEADER_LEN );
+	        t->send( head.data(), head.length(), data, len );
+	        _sent = true;
+	}
+
+	///Sends current function-table as MsgFunctionList, only its hash if it is the one of the client's cached list
+	void sendFunctionList( const std::string & cachedHash )
+	{
+	        FunctionTableReader functions( *this );
+	        std::string entries;
+	        entries.reserve( functions.table.size() * 32 );
+	        for ( FuncTable::const_iterator fe = functions.table.begin(); fe != functions.table.end(); ++fe )
+	        {
+	                if ( !entries.empty() )
+	                        entries += '\n';
+	                entries += asynchronous( *fe ) ? "a " : "s ";
+	                entries += (*fe)->_name;
+	                if ( *(*fe)->_parameters )
+	                {
+	                        entries += ' ';
+	                        entries += (*fe)->_parameters;
+	                }
+	        }
+	        {
+	                modepp::scoped_lock lock(_paramValuesMutex);
+	                for ( TParVarValues::const_iterator pv = _paramValues.begin(); pv != _paramValues.end(); ++pv )
+	                {
+	                        if ( !entries.empty() )
+	                                entries += '\n';
+	                        entries += "e " + pv->first;
+	                        for ( TVarValues::const_iterator v = pv->second.begin(); v != pv->second.end(); ++v )
+	                                entries += " " + v->first;
+	                }
+	        }
+	        unsigned long long h = 14695981039346656037ULL;
+	        for ( size_t i = 0; i < entries.length(); ++i )
+	                h = ( h ^ (unsigned char)entries[i] ) * 1099511628211ULL;
+	        char hash[17];
+	        sprintf( hash, "%016llx", h );
+	        if ( cachedHash == hash )
+	        {
+	                send( MsgFunctionList, std::string( hash ) + "1" );
+	                return;
+	        }
+	        const size_t room = MAX_MSG_LEN - 17;
+	        size_t pos = 0;
+	        do
+	        {
+	                size_t end = entries.length();
+	                if ( end - pos > room )
+	                {
+	                        end = entries.rfind( '\n', pos + room );
+	                        if ( end == std::string::npos || end <= pos )
+	                                end = pos + room;
+	                }
+	                std::string msg( hash );
+	                msg += end < entries.length() ? '0' : '1';
+	                msg.append( entries, pos, end - pos );
+	                send( MsgFunctionList, msg );
+	                pos = end < entries.length() && entries[end] == '\n' ? end + 1 : end;
+	        }
+	        while ( pos < entries.length() );
+	}
+
+	///Current function-table while the reader exists. Wait-free after the first one, which builds the table
+	///from the registrations. A change does not free replaced tables while there is a reader
+	class FunctionTableReader
+	{
+	        MoDePP & _m;
+	        FunctionTableReader( const FunctionTableReader & );
+	        FunctionTableReader & operator=( const FunctionTableReader & );
+	        static const FuncTable & current( MoDePP & m )
+	        {
+	                modepp::atomicAdd( m._functionReaders, 1UL );
+	                const FuncTable * t = modepp::atomicLoad( m._functions );
+	                if ( t )
+	                        return *t;
+	                m.addRegistrations();
+	                return *modepp::atomicLoad( m._functions );
+	        }
+	public:
+	        const FuncTable & table;
+	        FunctionTableReader( MoDePP & m ) : _m( m ), table( current( m ) ) {}
+	        ~FunctionTableReader() { modepp::atomicAdd( _m._functionReaders, 0UL - 1 ); }
+	};
+
+	///Returns test-function with given name or 0
+	ITestFunctionWrapper * findFunction( const std::string & fname )
+	{
+	        FunctionTableReader functions( *this );
+	        FuncTable::const_iterator it = std::lower_bound( functions.table.begin(), functions.table.end(), fname, NameLess() );
+	        if ( it != functions.table.end() && fname == (*it)->_name )
+	                return *it;
+	        return 0;
+	}
+
+	///True if function does not end with its call: it sends MsgCallDone, may send progress and can be cancelled
+	static bool asynchronous( ITestFunctionWrapper * f )
+	{
+#ifdef MODEPP_COROUTINES
+	        if ( dynamic_cast<ICoroTestFunctionWrapper*>( f ) )
+	                return true;
+#endif
+	        return dynamic_cast<IAsyncTestFunctionWrapper*>( f ) != 0;
+	}
+
+	///Copy of the current function-table for a change. Call with _functionsMutex locked
+	FuncTable * copyFunctionTable()
+	{
+	        return _functions ? new FuncTable( *_functions ) : new FuncTable;
+	}
+
+	///Makes t the current function-table and frees the replaced ones, if nobody reads. Call with _functionsMutex locked.
+	///A reader, which is counted after the store, gets t; one counted before keeps all replaced tables.
+	void publishFunctionTable( FuncTable * t )
+	{
+	        if ( _functions )
+	                _retiredTables.push_back( _functions );
+	        modepp::atomicStore( _functions, (const FuncTable *)t );
+	        if ( modepp::atomicLoad( _functionReaders ) != 0 )
+	                return;
+	        for ( size_t i = 0; i < _retiredTables.size(); ++i )
+	                delete _retiredTables[i];
+	        _retiredTables.clear();
+	}
+
+	///Inserts f into sorted table t, if there is no function with its name. Returns false if there is one
+	static bool insertFunction( FuncTable & t, ITestFunctionWrapper * f )
+	{
+	        FuncTable::iterator it = std::lower_bound( t.begin(), t.end(), std::string( f->_name ), NameLess() );
+	        if ( it != t.end() && !strcmp( f->_name, (*it)->_name ) )
+	                return false;
+	        t.insert( it, f );
+	        return true;
+	}
+
+	///Compares table-entry with a name for binary search
+	struct NameLess
+	{
+	        bool operator()( const ITestFunctionWrapper * f, const std::string & name ) const { return name.compare( f->_name ) > 0; }
+	};
+
+	typedef std::pair<std::string, ITestFunctionWrapper*> NamedFunction;      ///<name and function for addFunctions
+
+	///Adds a test function at runtime. Not required for functions declared by macros. Ignored if the name exists
 	void addFunction( const std::string & fname, ITestFunctionWrapper*  fptr )
 	{
-	        functionMap.insert(std::make_pair(fname, fptr));
+	        addFunctions( std::vector<NamedFunction>( 1, NamedFunction( fname, fptr ) ) );
+	}
+
+	///Adds test functions at runtime by one change of the function-table. Functions with existing names are ignored
+	void addFunctions( const std::vector<NamedFunction> & functions )
+	{
+	        { FunctionTableReader init( *this ); }
+	        modepp::scoped_lock lock(_functionsMutex);
+	        FuncTable * t = copyFunctionTable();
+	        std::vector<ITestFunctionWrapper*> added;
+	        for ( size_t i = 0; i < functions.size(); ++i )
+	        {
+	                FuncTable::iterator it = std::lower_bound( t->begin(), t->end(), functions[i].first, NameLess() );
+	                if ( it != t->end() && functions[i].first == (*it)->_name )
+	                        continue;
+	                functions[i].second->_name = _functionNames.insert( functions[i].first ).first->c_str();
+	                t->insert( it, functions[i].second );
+	                added.push_back( functions[i].second );
+	        }
+	        if ( added.empty() )
+	        {
+	                delete t;
+	                return;
+	        }
+	        publishFunctionTable( t );
+	        for ( size_t i = 0; i < added.size(); ++i )
+	                send( MsgFunctionsChanged, std::string( "+" ) + added[i]->_name + " " + added[i]->_parameters );
+	}
+
+	///Removes a test function at runtime, e.g. before its plugin is unloaded. A running call of it is not affected
+	bool removeFunction( const std::string & fname )
+	{
+	        return removeFunctions( std::vector<std::string>( 1, fname ) ) != 0;
+	}
+
+	///Removes test functions at runtime by one change of the function-table. Returns the number of removed ones
+	size_t removeFunctions( const std::vector<std::string> & fnames )
+	{
+	        { FunctionTableReader init( *this ); }
+	        modepp::scoped_lock lock(_functionsMutex);
+	        FuncTable * t = copyFunctionTable();
+	        std::vector<std::string> removed;
+	        for ( size_t i = 0; i < fnames.size(); ++i )
+	        {
+	                FuncTable::iterator it = std::lower_bound( t->begin(), t->end(), fnames[i], NameLess() );
+	                if ( it == t->end() || fnames[i] != (*it)->_name )
+	                        continue;
+	                t->erase( it );
+	                removed.push_back( fnames[i] );
+	        }
+	        if ( removed.empty() )
+	        {
+	                delete t;
+	                return 0;
+	        }
+	        publishFunctionTable( t );
+	        for ( size_t i = 0; i < removed.size(); ++i )
+	                send( MsgFunctionsChanged, "-" + removed[i] );
+	        return removed.size();
+	}
+
+	///Adds functions of the macros, which were registered since the last call, e.g. by a plugin just loaded.
+	///Called on first use for the functions of the program
+	void addRegistrations()
+	{
+	        modepp::scoped_lock lock(_functionsMutex);
+	        ITestFunctionWrapper * head = ITestFunctionWrapper::registrations();
+	        if ( _functions && head == _scanned )
+	                return;
+	        bool notify = _functions != 0;
+	        FuncTable * t = copyFunctionTable();
+	        std::vector<ITestFunctionWrapper*> added;
+	        for ( ITestFunctionWrapper * f = head; f != _scanned; f = f->_next )
+	                if ( insertFunction( *t, f ) )
+	                        added.push_back( f );
+	        _scanned = head;
+	        publishFunctionTable( t );
+	        for ( size_t i = 0; notify && i < added.size(); ++i )
+	                send( MsgFunctionsChanged, std::string( "+" ) + added[i]->_name + " " + added[i]->_parameters );
 	}
 	
+	///Registers object for MsgDump, see MODEPP_EXPOSE
+	void expose( const std::string & name, IExposed * e )
+	{
+	        modepp::scoped_lock lock(_exposedMutex);
+	        _exposed[name] = modepp::shared_ptr<IExposed>( e );
+	}
+
+	///Adds valid value of parameters named param, see MODEPP_ADD_PARAM_ENUM. Blanks in names are replaced by '_'
 	void addParamEnum( const std::string & param, const std::string & ename, const VarParam & evalue  )
 	{
-		_paramValues[param].push_back( std::make_pair( ename, evalue ) );
+	        std::string p( param ), e( ename );
+	        for ( size_t i = 0; i < p.length(); ++i )
+	                if ( isspace( (unsigned char)p[i] ) ) p[i] = '_';
+	        for ( size_t i = 0; i < e.length(); ++i )
+	                if ( isspace( (unsigned char)e[i] ) ) e[i] = '_';
+	        modepp::scoped_lock lock(_paramValuesMutex);
+	        _paramValues[p].push_back( std::make_pair( e, evalue ) );
+	}
+
+	///Calls function of MsgCallFunction or of a rule's action with call-id. p are the texts of the parameters as
+	///the client sends them, enum-indexes are resolved. Errors, also of an invalid call, are answered by a return
+	void callFunction( unsigned int id, bool valid, const std::string & fname, VarParam p[5] )
+	{
+	        unsigned int prev = setCallId( id );
+#ifndef _WIN32
+	        AllocTracker::markCall();
+#endif
+	        ITestFunctionWrapper * f = valid ? findFunction( fname ) : 0;
+	        std::string *params[]={&p[0].str(),&p[1].str(),&p[2].str(),&p[3].str(),&p[4].str()};
+	        VarParam *text[]={&p[0],&p[1],&p[2],&p[3],&p[4]};
+	        const VarParam *args[5];
+	        std::string error;
+	        if ( !valid )
+	                sendReturn( "Error! invalid call" );
+	        else if ( !f )
+	                sendReturn( "Error! no such function: " + fname );
+	        else if ( !callParams( f, params, text, args, error ) )
+	                sendReturn( error );
+	        else
+	                f->testFunction(*args[0],*args[1],*args[2],*args[3],*args[4]);
+	        setCallId( prev );
+	}
+
+	///Resolves parameters of a call, which are enum-indexes, to their values. Others are taken from text.
+	///Returns false with error if an index is invalid
+	bool callParams( const ITestFunctionWrapper * f, std::string * params[5], VarParam * text[5], const VarParam * args[5],
+	                 std::string & error )
+	{
+	        const char * names = f->_parameters;
+	        for ( int i = 0; i < 5; ++i )
+	        {
+	                while ( *names == ' ' )
+	                        ++names;
+	                const char * end = names + strcspn( names, " " );
+	                const char * begin = names;
+	                names = end;
+	                args[i] = text[i];
+	                const std::string & p = *params[i];
+	                if ( p.empty() || p[0] != MODEPP_ENUM_PARAM )
+	                        continue;
+	                std::string name( begin, end );
+	                unsigned long idx = strtoul( p.c_str() + 1, 0, 10 );
+	                modepp::scoped_lock lock(_paramValuesMutex);
+	                TParVarValues::const_iterator pv = _paramValues.find( name );
+	                if ( pv == _paramValues.end() || idx >= pv->second.size() )
+	                {
+	                        error = "Error! invalid enum " + p.substr( 1 ) + " of parameter " + name;
+	                        return false;
+	                }
+	                TVarValues::const_iterator v = pv->second.begin();
+	                std::advance( v, idx );
+	                args[i] = &v->second;
+	        }
+	        return true;
 	}
 };
 
+///Sets call-id of the calling thread for a scope, see MODEPP_CALL_SCOPE
+class CallScope
+{
+        unsigned int _prev;
+        CallScope(const CallScope &);
+        CallScope& operator=(const CallScope &);
+public:
+        CallScope( unsigned int id ):_prev( MoDePP::instance().setCallId( id ) )
+        {
+#ifndef _WIN32
+                AllocTracker::markCall();
+#endif
+        }
+        ~CallScope() { MoDePP::instance().setCallId( _prev ); }
+};
+
+///Body of the thread of an asynchronous call. Parameters are copied, the call's message is gone when it runs
+class AsyncCallRunner
+{
+        IAsyncTestFunctionWrapper * _f;
+        unsigned int _id;
+        VarParam _p1, _p2, _p3, _p4, _p5;
+public:
+        AsyncCallRunner( IAsyncTestFunctionWrapper * f, unsigned int id, const VarParam & p1, const VarParam & p2,
+                         const VarParam & p3, const VarParam & p4, const VarParam & p5 )
+                :_f(f),_id(id),_p1(p1),_p2(p2),_p3(p3),_p4(p4),_p5(p5){}
+
+        void operator()()
+        {
+                CallScope scope( _id );
+                try
+                {
+                        _f->asyncTestFunction( _p1, _p2, _p3, _p4, _p5 );
+                }
+                catch ( std::exception & e )
+                {
+                        MoDePP::instance().sendReturn( std::string( "Error! " ) + _f->_name + ": " + e.what() );
+                }
+                MoDePP::instance().endAsync();
+        }
+};
+
+///Load test of MsgLoadTest. run() is the body of the controlling thread, which starts the load-threads,
+///sends statistics while they run and joins them. Each load-thread records into an own histogram.
+class LoadTest
+{
+        struct Worker
+        {
+                modepp::mutex mx;       ///<shared only with the controlling thread, which takes the histogram
+                LatencyHistogram hist;  ///<latencies since last report
+        };
+        typedef std::vector< modepp::shared_ptr<Worker> > Workers;
+
+        ITestFunctionWrapper * _f;
+        unsigned int _id;
+        unsigned int _threads;
+        unsigned int _rate;             ///<total calls per second, 0 for closed-loop
+        unsigned long long _duration;   ///<nanoseconds
+        std::string _p[5];
+        Workers _workers;
+        unsigned long long _start;
+        volatile bool _stop;
+
+        LoadTest(const LoadTest &);
+        LoadTest& operator=(const LoadTest &);
+
+        ///Body of load-thread
+        struct Runner
+        {
+                LoadTest * t;
+                unsigned int i;
+                Runner( LoadTest * lt, unsigned int idx ):t(lt),i(idx){}
+                void operator()() { t->work( i ); }
+        };
+
+        void work( unsigned int idx )
+        {
+                CallScope scope( _id );
+                MoDePP::instance().setQuiet( true );
+                Worker & w = *_workers[idx];
+                VarParam p1(_p[0]), p2(_p[1]), p3(_p[2]), p4(_p[3]), p5(_p[4]);
+                unsigned long long end = _start + _duration;
+                //open-loop: each thread keeps an own schedule, threads are staggered within one interval
+                unsigned long long interval = _rate ? 1000000000ULL * _threads / _rate : 0;
+                unsigned long long next = _start + interval * idx / _threads;
+                while ( !_stop )
+                {
+                        unsigned long long begin;
+                        if ( interval )
+                        {
+                                if ( next >= end )
+                                        break;
+                                modeppSleepUntil( next );
+                                begin = next;
+                                next += interval;
+                        }
+                        else
+                        {
+                                begin = modeppTimestamp();
+                                if ( begin >= end )
+                                        break;
+                        }
+                        _f->testFunction( p1, p2, p3, p4, p5 );
+                        unsigned long long lat = modeppTimestamp() - begin;
+                        modepp::scoped_lock lock( w.mx );
+                        w.hist.record( lat );
+                }
+                MoDePP::instance().setQuiet( false );
+        }
+
+        ///Moves histograms of load-threads into given one
+        void collect( LatencyHistogram & interval )
+        {
+                for ( size_t i = 0; i < _workers.size(); ++i )
+                {
+                        modepp::scoped_lock lock( _workers[i]->mx );
+                        interval.add( _workers[i]->hist );
+                        _workers[i]->hist.clear();
+                }
+        }
+public:
+        LoadTest( ITestFunctionWrapper * f, unsigned int id, unsigned int threads, unsigned int rate,
+                  unsigned int durationMs, std::string * params[5] )
+                :_f(f),_id(id),_threads(threads),_rate(rate),_duration(durationMs*1000000ULL),_start(0),_stop(false)
+        {
+                for ( int i = 0; i < 5; ++i )
+                        _p[i] = *params[i];
+                for ( unsigned int i = 0; i < _threads; ++i )
+                        _workers.push_back( modepp::shared_ptr<Worker>( new Worker ) );
+        }
+
+        void run()
+        {
+                CallScope scope( _id );
+                std::vector< modepp::shared_ptr<modepp::thread> > threads;
+                _start = modeppTimestamp() + 1000000;
+                for ( unsigned int i = 0; i < _threads; ++i )
+                        threads.push_back( modepp::shared_ptr<modepp::thread>( new modepp::thread( Runner( this, i ) ) ) );
+
+                LatencyHistogram total, interval;
+                unsigned long long last = _start, end = _start + _duration;
+                for ( bool running = true; running; )
+                {
+                        unsigned long long report = std::min( last + MODEPP_LOAD_REPORT_MS * 1000000ULL, end );
+                        while ( modeppTimestamp() < report && !_stop )
+                        {
+                                modeppSleepUntil( std::min( modeppTimestamp() + 10000000ULL, report ) );
+                                _stop = MoDePP::instance().cancelled();
+                        }
+                        running = !_stop && report < end;
+                        if ( !running )
+                        {
+                                _stop = true;
+                                for ( size_t i = 0; i < threads.size(); ++i )
+                                        threads[i]->join();
+                        }
+                        unsigned long long now = modeppTimestamp();
+                        interval.clear();
+                        collect( interval );
+                        total.add( interval );
+                        std::stringstream s;
+                        s << "t=" << ( now - _start ) / 1000000 << "ms ";
+                        interval.format( s, now - last );
+                        MoDePP::instance().sendProgress( s.str() );
+                        last = now;
+                }
+                std::stringstream s;
+                s << _f->_name << " threads=" << _threads << " target=" << _rate << " t=" << ( last - _start ) / 1000000 << "ms ";
+                total.format( s, last - _start );
+                MoDePP::instance().sendReturn( s.str() );
+                MoDePP::instance().endAsync();
+        }
+};
+
+///Body of controlling thread of a load test
+struct LoadTestRunner
+{
+        modepp::shared_ptr<LoadTest> t;
+        LoadTestRunner( LoadTest * lt ):t(lt){}
+        void operator()() { t->run(); }
+};
+
+inline void MoDePP::startLoadTest( const std::string & msgdata )
+{
+        if ( msgdata.length() < CALL_ID_LEN + 20 )
+                return;
+        unsigned int id = strtoul( msgdata.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 );
+        unsigned int threads = strtoul( msgdata.substr( CALL_ID_LEN, 4 ).c_str(), 0, 16 );
+        unsigned int rate = strtoul( msgdata.substr( CALL_ID_LEN + 4, 8 ).c_str(), 0, 16 );
+        unsigned int duration = strtoul( msgdata.substr( CALL_ID_LEN + 12, 8 ).c_str(), 0, 16 );
+        std::string fname;
+        std::string param1,param2,param3,param4,param5;
+        std::string *params[]={&param1,&param2,&param3,&param4,&param5};
+        bool valid = readCall( msgdata.substr( CALL_ID_LEN + 20 ), fname, params );
+        ITestFunctionWrapper * f = valid ? findFunction( fname ) : 0;
+        CallScope scope( id );
+        VarParam v1(param1), v2(param2), v3(param3), v4(param4), v5(param5);
+        VarParam *text[]={&v1,&v2,&v3,&v4,&v5};
+        const VarParam *args[5];
+        std::string error;
+        if ( !valid )
+                sendReturn( "Error! invalid call" );
+        else if ( !f || asynchronous( f ) )
+                sendReturn( "Error! no such synchronous function: " + fname );
+        else if ( !callParams( f, params, text, args, error ) )
+                sendReturn( error );
+        else if ( threads < 1 || threads > MODEPP_LOAD_MAX_THREADS )
+                sendReturn( "Error! invalid number of threads" );
+        else if ( rate && 1000000000ULL * threads / rate == 0 )     //interval of a thread below 1ns: not open-loop
+                sendReturn( "Error! rate above 1000000000 calls/s per thread" );
+        else
+        {
+                for ( int i = 0; i < 5; ++i )
+                        *params[i] = args[i]->toString();
+                beginAsync( id );
+                modepp::thread t( LoadTestRunner( new LoadTest( f, id, threads, rate, duration, params ) ) );
+                t.detach();
+        }
+}
+
+///Body of the thread of a dump
+class DumpRunner
+{
+        modepp::shared_ptr<IDumpSession> _session;
+        unsigned int _id;
+public:
+        DumpRunner( IDumpSession * s, unsigned int id ):_session(s),_id(id){}
+        void operator()()
+        {
+                CallScope scope( _id );
+                std::string chunk;
+                chunk.reserve( MODEPP_DUMP_CHUNK_BYTES );
+                bool more = true;
+                while ( more && !MoDePP::instance().cancelled() )
+                {
+                        chunk.clear();
+                        more = _session->next( chunk );
+                        MoDePP::instance().sendWithCallId( MsgDumpChunk, chunk );
+                }
+                MoDePP::instance().endAsync();
+        }
+};
+
+inline void MoDePP::startDump( const std::string & msgdata )
+{
+        if ( msgdata.length() < CALL_ID_LEN )
+                return;
+        unsigned int id = strtoul( msgdata.substr( 0, CALL_ID_LEN ).c_str(), 0, 16 );
+        std::string name = msgdata.substr( CALL_ID_LEN );
+        CallScope scope( id );
+        modepp::shared_ptr<IExposed> e;
+        std::string names;
+        {
+                modepp::scoped_lock lock(_exposedMutex);        //not held while sending, see forkPrepare
+                for ( ExposedObjects::const_iterator it = _exposed.begin(); name.empty() && it != _exposed.end(); ++it )
+                        names += ( names.empty() ? "" : "\n" ) + it->first;
+                ExposedObjects::const_iterator it = _exposed.find( name );
+                if ( it != _exposed.end() )
+                        e = it->second;
+        }
+        if ( name.empty() )
+        {
+                sendWithCallId( MsgDumpChunk, names );
+                sendWithCallId( MsgCallDone, "done" );
+                return;
+        }
+        if ( !e.get() )
+        {
+                sendReturn( "Error! no such object: " + name );
+                return;
+        }
+        beginAsync( id );
+        modepp::thread t( DumpRunner( e->dump(), id ) );
+        t.detach();
+}
+
+///Registers object for MsgDump. Returns dummy value for static initialization, see MODEPP_EXPOSE
+template <class T, class Lock> inline int modeppExpose( const char * name, const T & obj, Lock & l )
+{
+        MoDePP::instance().expose( name, new Exposed<T, Lock>( obj, l ) );
+        return 0;
+}
+
+inline void IAsyncTestFunctionWrapper::testFunction(const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5)
+{
+        unsigned int id = MoDePP::instance().callId();
+        MoDePP::instance().beginAsync( id );
+        modepp::thread t( AsyncCallRunner( this, id, p1, p2, p3, p4, p5 ) );
+        t.detach();
+}
+
+#ifdef MODEPP_COROUTINES
+///Makes returns of the calling thread appended to given string for a scope, see modeppCall
+class CaptureScope
+{
+        std::string * _prev;
+        CaptureScope(const CaptureScope &);
+        CaptureScope& operator=(const CaptureScope &);
+public:
+        CaptureScope( std::string * c ):_prev( MoDePP::instance().setCapture( c ) ){}
+        ~CaptureScope() { MoDePP::instance().setCapture( _prev ); }
+};
+
+inline void ICoroTestFunctionWrapper::testFunction(const VarParam & p1, const VarParam & p2, const VarParam & p3, const VarParam & p4, const VarParam & p5)
+{
+        unsigned int id = MoDePP::instance().callId();
+        MoDePP::instance().beginAsync( id );
+        MoDePP::instance().coroutines().spawn( this, coroTestFunction( p1, p2, p3, p4, p5 ), id );
+}
+
+///Resumes script in the scope of its call-id, returns go where the script captures them
+inline void CoroExecutor::resume( CoroScript * s )
+{
+        std::coroutine_handle<> h = s->waiting;
+        s->waiting = std::coroutine_handle<>();
+        CoroScript * prev = _current;
+        _current = s;
+        {
+                CallScope scope( s->id );
+                CaptureScope capture( s->capture );
+                h.resume();
+        }
+        _current = prev;
+        if ( s->root.done() )
+                finish( s );
+}
+
+///Sends the error which ended the test-function and MsgCallDone, then destroys the script
+inline void CoroExecutor::finish( CoroScript * s )
+{
+        {
+                CallScope scope( s->id );
+                if ( s->root.promise().error )
+                {
+                        try
+                        {
+                                std::rethrow_exception( s->root.promise().error );
+                        }
+                        catch ( std::exception & e )
+                        {
+                                MoDePP::instance().sendReturn( std::string( "Error! " ) + s->function->_name + ": " + e.what() );
+                        }
+                        catch ( ... )
+                        {
+                                MoDePP::instance().sendReturn( std::string( "Error! " ) + s->function->_name + ": exception" );
+                        }
+                }
+                MoDePP::instance().endAsync();
+        }
+        _scripts.erase( s );
+        s->root.destroy();
+        delete s;
+}
+
+///Body of the thread of an asynchronous test-function awaited by modeppCall. It runs in the scope of the
+///awaiting script's call, captures the returns and posts the script back to the server-thread
+class CoroThreadRunner
+{
+        IAsyncTestFunctionWrapper * _f;
+        CoroScript * _script;
+        std::string * _result;
+        VarParam _p1, _p2, _p3, _p4, _p5;
+public:
+        CoroThreadRunner( IAsyncTestFunctionWrapper * f, CoroScript * s, std::string * result, const VarParam * p )
+                :_f(f),_script(s),_result(result),_p1(p[0]),_p2(p[1]),_p3(p[2]),_p4(p[3]),_p5(p[4]){}
+
+        void operator()()
+        {
+                {
+                        CallScope scope( _script->id );
+                        CaptureScope capture( _result );
+                        try
+                        {
+                                _f->asyncTestFunction( _p1, _p2, _p3, _p4, _p5 );
+                        }
+                        catch ( std::exception & e )
+                        {
+                                MoDePP::instance().sendReturn( std::string( "Error! " ) + _f->_name + ": " + e.what() );
+                        }
+                        MoDePP::instance().flushThreadTraces();
+                }
+                MoDePP::instance().coroutines().post( _script );
+        }
+};
+
+///Awaitable of modeppSleep. Result is false if the call was cancelled, then the sleep ends at once
+class CoroSleep
+{
+        unsigned int _ms;
+public:
+        explicit CoroSleep( unsigned int ms ):_ms(ms){}
+        bool await_ready() const { return false; }
+        bool await_suspend( std::coroutine_handle<> h ) { return MoDePP::instance().coroutines().sleep( h, _ms ); }
+        bool await_resume() const { return !MoDePP::instance().coroutines().cancelled(); }
+};
+
+///Awaitable of modeppReadable and modeppWritable. Result is false if the call was cancelled
+class CoroDescriptor
+{
+        int _fd;
+        bool _write;
+public:
+        CoroDescriptor( int fd, bool write ):_fd(fd),_write(write){}
+        bool await_ready() const { return false; }
+        bool await_suspend( std::coroutine_handle<> h ) { return MoDePP::instance().coroutines().await( h, _fd, _write ); }
+        bool await_resume() const { return !MoDePP::instance().coroutines().cancelled(); }
+};
+
+///Awaitable of modeppCall. Result are the returns of the called function, separated by newlines
+class CoroCall
+{
+        std::string _name;
+        VarParam _p[5];
+        std::string _result;
+        ITestFunctionWrapper * _f;
+        CoroTask::Handle _child;        ///<frame of a called coroutine test-function
+        std::string * _outer;           ///<capture of the script before the call
+
+        CoroCall(const CoroCall &);
+        CoroCall& operator=(const CoroCall &);
+public:
+        CoroCall( const std::string & name, const VarParam & p1, const VarParam & p2, const VarParam & p3,
+                  const VarParam & p4, const VarParam & p5 ):_name(name),_f(0),_outer(0)
+        {
+                _p[0] = p1; _p[1] = p2; _p[2] = p3; _p[3] = p4; _p[4] = p5;
+        }
+
+        ~CoroCall()
+        {
+                if ( _child )
+                        _child.destroy();
+        }
+
+        ///A synchronous function is called right here
+        bool await_ready()
+        {
+                _f = MoDePP::instance().findFunction( _name );
+                if ( !_f )
+                {
+                        _result = "Error! no such function: " + _name;
+                        return true;
+                }
+                if ( dynamic_cast<ICoroTestFunctionWrapper*>( _f ) || dynamic_cast<IAsyncTestFunctionWrapper*>( _f ) )
+                        return false;
+                CaptureScope capture( &_result );
+                _f->testFunction( _p[0], _p[1], _p[2], _p[3], _p[4] );
+                return true;
+        }
+
+        ///A coroutine test-function runs in place of the awaiting one, an asynchronous one in its own thread
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<> h )
+        {
+                CoroExecutor & e = MoDePP::instance().coroutines();
+                if ( ICoroTestFunctionWrapper * c = dynamic_cast<ICoroTestFunctionWrapper*>( _f ) )
+                {
+                        _child = c->coroTestFunction( _p[0], _p[1], _p[2], _p[3], _p[4] ).release();
+                        _child.promise().continuation = h;
+                        _outer = e.current()->capture;
+                        e.current()->capture = &_result;
+                        MoDePP::instance().setCapture( &_result );
+                        return _child;
+                }
+                e.suspend( h );
+                modepp::thread t( CoroThreadRunner( static_cast<IAsyncTestFunctionWrapper*>( _f ), e.current(), &_result, _p ) );
+                t.detach();
+                return std::noop_coroutine();
+        }
+
+        std::string await_resume()
+        {
+                if ( _child )
+                {
+                        if ( _child.promise().error )
+                        {
+                                try
+                                {
+                                        std::rethrow_exception( _child.promise().error );
+                                }
+                                catch ( std::exception & e )
+                                {
+                                        MoDePP::instance().sendReturn( "Error! " + _name + ": " + e.what() );
+                                }
+                                catch ( ... )
+                                {
+                                        MoDePP::instance().sendReturn( "Error! " + _name + ": exception" );
+                                }
+                        }
+                        MoDePP::instance().coroutines().current()->capture = _outer;
+                        MoDePP::instance().setCapture( _outer );
+                }
+                return std::move( _result );
+        }
+};
+
+///Suspends the coroutine test-function for given milliseconds: co_await modeppSleep( 100 ).
+///Result is false if the call was cancelled, then it returns at once
+inline CoroSleep modeppSleep( unsigned int ms )
+{
+        return CoroSleep( ms );
+}
+
+///Suspends the coroutine test-function till descriptor is readable: co_await modeppReadable( fd ).
+///One coroutine at a time may await a descriptor. Result is false if the call was cancelled
+inline CoroDescriptor modeppReadable( int fd )
+{
+        return CoroDescriptor( fd, false );
+}
+
+///Suspends the coroutine test-function till descriptor is writable: co_await modeppWritable( fd )
+inline CoroDescriptor modeppWritable( int fd )
+{
+        return CoroDescriptor( fd, true );
+}
+
+///Calls registered test-function and results in its returns: std::string r = co_await modeppCall( "add", 1, 2 ).
+///It runs in the scope of the awaiting call, its returns are not sent to the client
+inline CoroCall modeppCall( const std::string & name, const VarParam & p1 = VarParam(), const VarParam & p2 = VarParam(),
+                            const VarParam & p3 = VarParam(), const VarParam & p4 = VarParam(), const VarParam & p5 = VarParam() )
+{
+        return CoroCall( name, p1, p2, p3, p4, p5 );
+}
+#endif
+
+#if defined(MODEPP_TRACK_ALLOCATIONS) && !defined(_WIN32)
+#if __cplusplus >= 201103L
+  #define MODEPP_NOEXCEPT noexcept
+#else
+  #define MODEPP_NOEXCEPT throw()
+#endif
+///Replaced global allocation functions, see AllocTracker. Defined in the one source-file with MODEPP_TRACK_ALLOCATIONS
+void * operator new( size_t size )
+{
+        void * p = AllocTracker::allocate( size );
+        if ( !p )
+                throw std::bad_alloc();
+        return p;
+}
+
+void * operator new[]( size_t size )
+{
+        void * p = AllocTracker::allocate( size );
+        if ( !p )
+                throw std::bad_alloc();
+        return p;
+}
+
+void * operator new( size_t size, const std::nothrow_t & ) MODEPP_NOEXCEPT { return AllocTracker::allocate( size ); }
+void * operator new[]( size_t size, const std::nothrow_t & ) MODEPP_NOEXCEPT { return AllocTracker::allocate( size ); }
+void operator delete( void * p ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+void operator delete[]( void * p ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+void operator delete( void * p, const std::nothrow_t & ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+void operator delete[]( void * p, const std::nothrow_t & ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+//Sized forms are used since C++14, but also by libraries built for it, e.g. an ASan runtime in a C++11 program
+void operator delete( void * p, size_t ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+void operator delete[]( void * p, size_t ) MODEPP_NOEXCEPT { AllocTracker::release( p ); }
+#endif
+
 #endif //MODEPP_INCLUDE_MESSAGE_TYPES_ONLY
 #endif //HG
 
@@ -0,0 +1,71 @@
+#include "framedecoder.h"
+
+FrameDecoder::FrameDecoder()
+    : _pos(0), _error(false)
+{
+}
+
+void FrameDecoder::readFrom( QIODevice * dev )
+{
+    qint64 avail = dev->bytesAvailable();
+    if ( avail <= 0 )
+        return;
+    int old = _buf.size();
+    _buf.resize( old + avail );
+    qint64 n = dev->read( _buf.data() + old, avail );
+    _buf.resize( old + ( n > 0 ? n : 0 ) );
+}
+
+bool FrameDecoder::next( int & cmd, const char *& data, int & len )
+{
+    if ( _buf.size() - _pos < HEADER_LEN )
+        return false;
+    const char * p = _buf.constData() + _pos;
+    bool ok = true;
+    int l = hex( p, 4, ok );
+    int c = hex( p + 4, 4, ok );
+    if ( !ok )
+    {
+        clear();
+        _error = true;
+        return false;
+    }
+    if ( _buf.size() - _pos - HEADER_LEN < l )
+        return false;
+    cmd = c;
+    data = p + HEADER_LEN;
+    len = l;
+    _pos += HEADER_LEN + l;
+    return true;
+}
+
+void FrameDecoder::compact()
+{
+    if ( _pos )
+    {
+        _buf.remove( 0, _pos );
+        _pos = 0;
+    }
+}
+
+void FrameDecoder::clear()
+{
+    _buf.clear();
+    _pos = 0;
+}
+
+quint64 FrameDecoder::hex( const char * p, int digits, bool & ok )
+{
+    quint64 v = 0;
+    for ( int i = 0; i < digits; ++i )
+    {
+        char ch = p[i];
+        int d;
+        if ( ch >= '0' && ch <= '9' ) d = ch - '0';
+        else if ( ch >= 'a' && ch <= 'f' ) d = ch - 'a' + 10;
+        else if ( ch >= 'A' && ch <= 'F' ) d = ch - 'A' + 10;
+        else { ok = false; return 0; }
+        v = ( v << 4 ) | d;
+    }
+    return v;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+#define MODEPP_INCLUDE_MESSAGE_TYPES_ONLY //prevent including implementations
+#include "MoDePP.h"
+
+///Incremental decoder of MoDe++ messages.
+///Keeps incomplete messages between readyRead-signals. Complete messages are returned as pointers
+///into the receive-buffer, so they are not copied. Consumed data is dropped by compact(), which
+///moves only the rest of an incomplete message, so each byte is handled in amortised O(1).
+class FrameDecoder
+{
+public:
+    FrameDecoder();
+
+    ///Appends all available data of device to the receive-buffer
+    void readFrom( QIODevice * dev );
+
+    ///Returns next complete message. Data is valid till next call of readFrom or compact.
+    bool next( int & cmd, const char *& data, int & len );
+
+    ///Drops consumed messages. Call after all messages returned by next are processed.
+    void compact();
+
+    ///Drops all data. Call on new connection.
+    void clear();
+
+    ///True if received data was not a valid header since last call. Buffer was dropped.
+    bool takeError() { bool e = _error; _error = false; return e; }
+
+    ///Parses given number of hex digits. Sets ok to false on invalid digit.
+    static quint64 hex( const char * p, int digits, bool & ok );
+
+private:
+    QByteArray _buf;    ///<received data
+    int _pos;           ///<start of first unprocessed message in _buf
+    bool _error;
+};
+
+#endif // FRAMEDECODER_H
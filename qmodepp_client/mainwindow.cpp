@@ -6,21 +6,39 @@
 #include <QTimer>
 #include <QTextStream>
 #include <QFileDialog>
+#include <QHeaderView>
+#include <QScrollBar>
 
 const static int DEBUG_PORT = 4545;
 
+///Records are shown when they are older than newest record minus this time (ns). Gives other threads time to flush.
+const static quint64 TRACE_HOLDBACK_NS = 200000000ULL;
+
+///Rows kept by trace-view. Older rows are dropped
+const static int TRACE_VIEW_ROWS = 200000;
+
 QStringList Responses;
 Ui::MainWindow *GlobUi=0;
 
 
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), ui(new Ui::MainWindow),_connected(false), _socket(0)
+    : QMainWindow(parent), ui(new Ui::MainWindow),_connected(false), _socket(0),
+      _newestTrace(0), _firstTrace(0), _tracesReceived(false)
 {
     ui->setupUi(this);
     GlobUi = ui;
+    _traces = new TraceModel( TRACE_VIEW_ROWS, this );
+    ui->tTraces->setModel( _traces );
+    ui->tTraces->verticalHeader()->hide();
+    ui->tTraces->verticalHeader()->setDefaultSectionSize( fontMetrics().height() + 2 );
+    ui->tTraces->horizontalHeader()->setStretchLastSection( true );
+    connect( _traces, SIGNAL(found(int)), this, SLOT(onFound(int)) );
+    QComboBox* paramEnums[]={ ui->cbParam1,ui->cbParam2,ui->cbParam3,ui->cbParam4,ui->cbParam5 };
+    for (int j=0; j<5; ++j)
+        paramEnums[j]->hide();
     QTimer *t=new QTimer(this);
-   // connect(t, SIGNAL(timeout()), this, SLOT(pollResponse()));
-    t->start(1000);
+    connect(t, SIGNAL(timeout()), this, SLOT(flushTraces()));
+    t->start(100);
 }
 
 MainWindow::~MainWindow()
@@ -78,6 +96,14 @@ void MainWindow::on_bExecute_clicked()
         p3=ui->eParam3->text();
         p4=ui->eParam4->text();
         p5=ui->eParam5->text();
+        //parameters with enum are sent as index of the selected value
+        QString *params[]={ &p1,&p2,&p3,&p4,&p5 };
+        QComboBox* paramEnums[]={ ui->cbParam1,ui->cbParam2,ui->cbParam3,ui->cbParam4,ui->cbParam5 };
+        for (int j=0; j<5; ++j)
+        {
+            if (!paramEnums[j]->isHidden())
+                *params[j] = QChar(MODEPP_ENUM_PARAM) + QString::number(paramEnums[j]->currentIndex());
+        }
         int len=fname.length();
         int entirelen = fname.length()+p1.length()+p2.length()+p3.length()+p4.length()+p5.length()+4*6;
 
@@ -135,10 +161,12 @@ void MainWindow::on_cbFunction_activated ( const QString & fname )
     ui->eParam5->setText( _functionValues[fname][5].toString());
     static QLineEdit* paramContainers[]={ ui->eParam1,ui->eParam2,ui->eParam3,ui->eParam4,ui->eParam5 };
     static QLabel* paramNames[]={ ui->label_p1,ui->label_p2,ui->label_p3,ui->label_p4,ui->label_p5 };
+    static QComboBox* paramEnums[]={ ui->cbParam1,ui->cbParam2,ui->cbParam3,ui->cbParam4,ui->cbParam5 };
     QList<QString> params = _functions[fname];    
     for (int j=0; j<5; ++j)
     {
         paramContainers[j]->hide();
+        paramEnums[j]->hide();
     }
     int i=0;
     foreach ( QString p, params  )
@@ -149,7 +177,14 @@ void MainWindow::on_cbFunction_activated ( const QString & fname )
 			static QLineEdit* paramContainers[]={ ui->eParam1,ui->eParam2,ui->eParam3,ui->eParam4,ui->eParam5 };
     static QLabel* paramNames[]={ ui->label_p1,ui->label_p2,ui->label_p3,ui->label_p4,ui->label_p5 };
             //ui->tResponse->append(p+", ");
-            paramContainers[i]->show();
+            if (_paramEnums.contains(p))
+            {
+                paramEnums[i]->clear();
+                paramEnums[i]->addItems(_paramEnums[p]);
+                paramEnums[i]->show();
+            }
+            else
+                paramContainers[i]->show();
             paramNames[i]->setText(p);
         }
         ++i;
@@ -161,16 +196,35 @@ void MainWindow::onConnected()
     if(_socket)
     {
         ui->cbFunction->clear();
+        _functions.clear();
+        _paramEnums.clear();
+        _functionList.clear();
+        _decoder.clear();
+        _source.clear();
+        //records of the previous connection are shown, times of this one get a new base
+        showTraces( _newestTrace );
+        _pendingTraces.clear();
+        _newestTrace = 0;
+        _firstTrace = 0;
+        _tracesReceived = false;
+        addRow( TraceRow::Return, "---- connected ----" );
+        QByteArray hash;
+        QFile cache( functionCacheFile() );
+        if ( cache.open( QIODevice::ReadOnly ) )
+            hash = cache.readLine().trimmed();
         QTextStream ts(_socket);
-        ts << "0000";
-        ts.setFieldWidth(4); ts.setIntegerBase(16);
-        ts<<MsgListFunctions;
+        ts.setFieldWidth(4); ts.setPadChar( QChar('0') ); ts.setIntegerBase(16);
+        ts << hash.length() << MsgGetFunctionList;
+        ts.setFieldWidth(0);
+        ts << hash;
         for (int j=0; j<5; ++j)
         {
 			static QLineEdit* paramContainers[]={ ui->eParam1,ui->eParam2,ui->eParam3,ui->eParam4,ui->eParam5 };
     static QLabel* paramNames[]={ ui->label_p1,ui->label_p2,ui->label_p3,ui->label_p4,ui->label_p5 };
+    static QComboBox* paramEnums[]={ ui->cbParam1,ui->cbParam2,ui->cbParam3,ui->cbParam4,ui->cbParam5 };
             paramContainers[j]->hide();
 			paramNames[j]->hide();
+            paramEnums[j]->hide();
         }
     }
 }
@@ -179,48 +233,228 @@ void MainWindow::onDataAvailable()
 {
     if(_socket)
     {
-       _data+= _socket->readAll();
-       //ui->tResponse->append(_data+"\n");
-       if (_data.size() >=HEADER_LEN )
-       {
-           QTextStream ts(_data);
-           while( !ts.atEnd() )
-           {
-               int cmd=0,len=0;
-               bool ok;
-               len = ts.read(4).toInt(&ok,16);
-               cmd = ts.read(4).toInt(0,16);
-               if (cmd == MsgAddFunction)
-               {
-                   QString tmp = ts.read(len);
-                   QTextStream ts(&tmp);
-                   QString fn,tmpparam;
-                   QList<QString> fp;
-                   ts >> fn;
-                   while(!ts.atEnd())
-                   {
-                       ts >> tmpparam;
-                       fp.append(tmpparam);
-                   }
-                   _functions.insert(fn, fp);
-                   ui->cbFunction->addItem(fn);
-               }
-               else if (cmd == MsgTrace)
-               {
-                   QString tmp = ts.read(len);
-                   ui->tResponse->append( QString("TRC: ")+tmp );
-               }
-               else if (cmd == MsgReturn)
-               {
-                   QString tmp = ts.read(len);
-                   ui->tResponse->append( QString("RET: ")+tmp );
-               }
-               else
-               {
-                    ui->tResponse->append( QString("ERROR: Unknown message[") + cmd + "] " +ts.readAll() );
-               }
-           }
-           _data.clear();
-       }
+        _decoder.readFrom( _socket );
+        int cmd=0, len=0;
+        const char * data;
+        while ( _decoder.next( cmd, data, len ) )
+        {
+            if (cmd == MsgSource)
+            {
+                _source = QString("[%1] ").arg( QString::fromUtf8( data, len ) );
+                continue;
+            }
+            if (cmd == MsgAddFunction || (cmd == MsgFunctionsChanged && len > 0 && *data == '+'))
+            {
+                if (cmd == MsgFunctionsChanged)
+                {
+                    ++data;
+                    --len;
+                }
+                QString tmp = QString::fromUtf8( data, len );
+                QTextStream ts(&tmp);
+                QString fn,tmpparam;
+                QList<QString> fp;
+                ts >> fn;
+                while(!ts.atEnd())
+                {
+                    ts >> tmpparam;
+                    fp.append(tmpparam);
+                }
+                if (!_functions.contains(fn))
+                    ui->cbFunction->addItem(fn);
+                _functions.insert(fn, fp);
+            }
+            else if (cmd == MsgFunctionsChanged && len > 0)
+            {
+                QString fn = QString::fromUtf8( data + 1, len - 1 );
+                _functions.remove(fn);
+                int idx = ui->cbFunction->findText(fn);
+                if (idx >= 0)
+                    ui->cbFunction->removeItem(idx);
+            }
+            else if (cmd == MsgFunctionList)
+            {
+                addFunctionList( data, len );
+            }
+            else if (cmd == MsgHeartbeat)
+            {
+                QTextStream ts(_socket);
+                ts.setFieldWidth(4); ts.setPadChar( QChar('0') ); ts.setIntegerBase(16);
+                ts << 0 << MsgHeartbeat;
+            }
+            else if (cmd == MsgTrace)
+            {
+                addRow( TraceRow::Trace, QString::fromUtf8( data, len ) );
+            }
+            else if (cmd == MsgTraceBatch)
+            {
+                addTraceBatch( data, len );
+            }
+            else if (cmd == MsgReturn)
+            {
+                addRow( TraceRow::Return, QString::fromUtf8( data, len ) );
+            }
+            else if (cmd == MsgCallDone)
+            {
+            }
+            else if ((cmd == MsgReturnId || cmd == MsgProgress) && len >= CALL_ID_LEN)
+            {
+                addRow( TraceRow::Return, QString::fromUtf8( data + CALL_ID_LEN, len - CALL_ID_LEN ) );
+            }
+            else
+            {
+                addRow( TraceRow::Error, QString("Unknown message[%1] ").arg(cmd) + QString::fromUtf8( data, len ) );
+            }
+            _source.clear();
+        }
+        if ( _decoder.takeError() )
+        {
+            addRow( TraceRow::Error, "invalid message header, received data dropped" );
+        }
+        _decoder.compact();
+    }
+}
+
+///File of cached function-list of the server
+QString MainWindow::functionCacheFile() const
+{
+    return QDir::home().filePath( QString(".qmodepp_functions_%1_%2").arg( ui->eAddress->text() ).arg( ui->ePort->text() ) );
+}
+
+///Collects MsgFunctionList. When complete, the functions are taken from the server or from the cache-file
+void MainWindow::addFunctionList( const char * data, int len )
+{
+    if ( len < 17 )
+        return;
+    if ( !_functionList.isEmpty() && len > 17 )
+        _functionList.append( '\n' );
+    _functionList.append( data + 17, len - 17 );
+    if ( data[16] != '1' )
+        return;
+    QByteArray hash( data, 16 );
+    QFile cache( functionCacheFile() );
+    if ( _functionList.isEmpty() && cache.open( QIODevice::ReadOnly ) && cache.readLine().trimmed() == hash )
+    {
+        _functionList = cache.readAll();
+    }
+    else
+    {
+        cache.close();
+        if ( cache.open( QIODevice::WriteOnly ) )
+        {
+            cache.write( hash + "\n" );
+            cache.write( _functionList );
+        }
+    }
+    QStringList names;
+    foreach ( QString entry, QString::fromUtf8( _functionList ).split( '\n', QString::SkipEmptyParts ) )
+    {
+        QStringList words = entry.split( ' ', QString::SkipEmptyParts );
+        if ( words.size() < 2 )
+            continue;
+        if ( words[0] == "e" )
+        {
+            _paramEnums.insert( words[1], words.mid( 2 ) );
+            continue;
+        }
+        QString fn = words[1];
+        if ( !_functions.contains( fn ) )
+            names.append( fn );
+        _functions.insert( fn, words.mid( 2 ) );
+    }
+    ui->cbFunction->addItems( names );
+    _functionList.clear();
+}
+
+void MainWindow::addTraceBatch( const char * records, int size )
+{
+    int pos=0;
+    while ( pos + TRACE_RECORD_HEADER_LEN <= size )
+    {
+        const char * r = records + pos;
+        bool ok = true;
+        TraceRow e;
+        e.kind = TraceRow::Trace;
+        quint64 stamp = FrameDecoder::hex( r, 16, ok );
+        e.thread = FrameDecoder::hex( r+16, 8, ok );
+        e.seq = FrameDecoder::hex( r+24, 8, ok );
+        int len = FrameDecoder::hex( r+40, 4, ok );
+        if ( !ok || pos + TRACE_RECORD_HEADER_LEN + len > size )
+            break;
+        e.text = _source + QString::fromUtf8( r + TRACE_RECORD_HEADER_LEN, len );
+        pos += TRACE_RECORD_HEADER_LEN + len;
+
+        if ( stamp > _newestTrace )
+            _newestTrace = stamp;
+        _pendingTraces.insert( stamp, e );
+    }
+    _tracesReceived = true;
+    if ( _newestTrace > TRACE_HOLDBACK_NS )
+        showTraces( _newestTrace - TRACE_HOLDBACK_NS );
+}
+
+///Shows pending records with timestamp up to given one, ordered by timestamp. Times are relative to the first
+///shown record, the earliest after the holdback merge. An older record, which arrives later, is shown at time 0
+void MainWindow::showTraces( quint64 upto )
+{
+    TraceEntries::iterator it = _pendingTraces.begin();
+    if ( !_firstTrace && it != _pendingTraces.end() && it.key() <= upto )
+        _firstTrace = it.key();
+    while ( it != _pendingTraces.end() && it.key() <= upto )
+    {
+        it.value().time = it.key() > _firstTrace ? (it.key()-_firstTrace)/1000 : 0;
+        _traces->add( it.value() );
+        it = _pendingTraces.erase( it );
+    }
+}
+
+///Adds a row, which is not a trace-record
+void MainWindow::addRow( TraceRow::Kind kind, const QString & text )
+{
+    TraceRow r;
+    r.kind = kind;
+    r.time = 0;
+    r.thread = 0;
+    r.seq = 0;
+    r.text = _source + text;
+    _traces->add( r );
+}
+
+///Timer-tick. If nothing arrived since last tick, all threads have flushed and all pending records are shown.
+///Rows added since last tick are passed to the view in one batch.
+void MainWindow::flushTraces()
+{
+    if ( !_tracesReceived && !_pendingTraces.isEmpty() )
+    {
+        showTraces( _newestTrace );
+    }
+    _tracesReceived = false;
+
+    QScrollBar * sb = ui->tTraces->verticalScrollBar();
+    bool atBottom = sb->value() == sb->maximum();
+    if ( _traces->commit() && atBottom )
+        ui->tTraces->scrollToBottom();
+}
+
+void MainWindow::on_eFilter_returnPressed()
+{
+    _traces->setFilter( ui->eFilter->text() );
+}
+
+void MainWindow::on_bFind_clicked()
+{
+    if ( !ui->eFind->text().isEmpty() )
+        _traces->find( ui->eFind->text(), ui->tTraces->currentIndex().row() );
+}
+
+void MainWindow::onFound( int row )
+{
+    if ( row < 0 )
+    {
+        statusBar()->showMessage( "Not found: " + ui->eFind->text(), 3000 );
+        return;
     }
+    QModelIndex idx = _traces->index( row, 3 );
+    ui->tTraces->setCurrentIndex( idx );
+    ui->tTraces->scrollTo( idx );
 }
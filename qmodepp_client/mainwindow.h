@@ -5,8 +5,8 @@
 #include <QTcpSocket>
 #include <QtCore>
 
-#define MODEPP_INCLUDE_MESSAGE_TYPES_ONLY //prevent including implementations
-#include "MoDePP.h"
+#include "framedecoder.h"
+#include "tracemodel.h"
 
 namespace Ui
 {
@@ -15,6 +15,9 @@ namespace Ui
 
 typedef QMap< QString,QList<QString> > FunctionsMap;
 
+///Trace-records ordered by timestamp
+typedef QMultiMap< quint64, TraceRow > TraceEntries;
+
 
 class MainWindow : public QMainWindow
 {
@@ -34,14 +37,32 @@ public slots:
 
     void onDataAvailable();
     void onConnected();
+    void flushTraces();
+    void on_eFilter_returnPressed();
+    void on_bFind_clicked();
+    void onFound( int row );
 
 private:
+    void addTraceBatch( const char * records, int size );
+    void showTraces( quint64 upto );
+    void addRow( TraceRow::Kind kind, const QString & text );
+    void addFunctionList( const char * data, int len );
+    QString functionCacheFile() const;
+
     Ui::MainWindow *ui;
     bool _connected;
     QTcpSocket *_socket;
-    QByteArray _data;
+    FrameDecoder _decoder;
     QMap<QString,QMap<int, QVariant> > _functionValues;
     FunctionsMap _functions;
+    QMap<QString,QStringList> _paramEnums;  ///<names of valid values by parameter-name, see Parameter enums
+    QByteArray _functionList;       ///<entries of MsgFunctionList received so far
+    TraceModel * _traces;           ///<model of trace-view
+    TraceEntries _pendingTraces;    ///<records waiting for merge with records of other threads
+    quint64 _newestTrace;           ///<newest timestamp received
+    quint64 _firstTrace;            ///<timestamp of first shown record, shown times are relative to it
+    bool _tracesReceived;           ///<records arrived since last timer-tick
+    QString _source;                ///<"[server] " of current message, when connected to a relay
 };
 
 #endif // MAINWINDOW_H
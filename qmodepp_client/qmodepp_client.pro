@@ -6,6 +6,6 @@ DEFINES += MODEPP_INCLUDE_MESSAGE_TYPES_ONLY
 INCLUDEPATH +=  ../modepp_server
 RESOURCES += src.qrc 
 
-SOURCES += main.cpp mainwindow.cpp about.cpp
-HEADERS += mainwindow.h  about.h
+SOURCES += main.cpp mainwindow.cpp about.cpp framedecoder.cpp tracemodel.cpp
+HEADERS += mainwindow.h  about.h framedecoder.h tracemodel.h
 FORMS += mainwindow.ui about.ui
@@ -0,0 +1,202 @@
+#include "tracemodel.h"
+#include <QtConcurrentRun>
+#include <algorithm>
+
+TraceModel::TraceModel( int capacity, QObject * parent )
+    : QAbstractTableModel(parent), _capacity(capacity), _first(0), _end(0), _pendingFilterEnd(0)
+{
+    _ring.resize( _capacity );
+    connect( &_filterWatcher, SIGNAL(finished()), this, SLOT(filterFinished()) );
+    connect( &_findWatcher, SIGNAL(finished()), this, SLOT(findFinished()) );
+}
+
+void TraceModel::add( const TraceRow & row )
+{
+    _staged.append( row );
+}
+
+bool TraceModel::commit()
+{
+    if ( _staged.isEmpty() )
+        return false;
+    int skip = qMax( 0, _staged.size() - _capacity );
+    int n = _staged.size() - skip;
+    qint64 evict = qMax<qint64>( 0, ( _end - _first ) + n - _capacity );
+
+    if ( _filter.isEmpty() )
+    {
+        if ( evict )
+        {
+            beginRemoveRows( QModelIndex(), 0, evict - 1 );
+            _first += evict;
+            endRemoveRows();
+        }
+        beginInsertRows( QModelIndex(), _end - _first, _end - _first + n - 1 );
+        for ( int i = skip; i < _staged.size(); ++i )
+            _ring[ _end++ % _capacity ] = _staged[i];
+        endInsertRows();
+    }
+    else
+    {
+        _first += evict;
+        int gone = std::lower_bound( _visible.begin(), _visible.end(), _first ) - _visible.begin();
+        if ( gone )
+        {
+            beginRemoveRows( QModelIndex(), 0, gone - 1 );
+            _visible.remove( 0, gone );
+            endRemoveRows();
+        }
+        QVector<qint64> added;
+        for ( int i = skip; i < _staged.size(); ++i )
+        {
+            if ( matches( _staged[i], _filter ) )
+                added.append( _end );
+            _ring[ _end++ % _capacity ] = _staged[i];
+        }
+        if ( !added.isEmpty() )
+        {
+            beginInsertRows( QModelIndex(), _visible.size(), _visible.size() + added.size() - 1 );
+            _visible += added;
+            endInsertRows();
+        }
+    }
+    _staged.clear();
+    return true;
+}
+
+void TraceModel::clear()
+{
+    beginResetModel();
+    _ring = QVector<TraceRow>( _capacity );
+    _first = _end = 0;
+    _staged.clear();
+    _visible.clear();
+    endResetModel();
+}
+
+void TraceModel::setFilter( const QString & pattern )
+{
+    _pendingFilter = pattern;
+    _pendingFilterEnd = _end;
+    _filterWatcher.setFuture( QtConcurrent::run( &TraceModel::filterRows, _ring, _first, _end, pattern ) );
+}
+
+void TraceModel::filterFinished()
+{
+    if ( _filterWatcher.future().isCanceled() )
+        return;
+    QVector<qint64> visible = _filterWatcher.result();
+    int gone = std::lower_bound( visible.begin(), visible.end(), _first ) - visible.begin();
+    visible.remove( 0, gone );
+    for ( qint64 i = qMax( _first, _pendingFilterEnd ); i < _end; ++i )
+    {
+        if ( matches( at(i), _pendingFilter ) )
+            visible.append( i );
+    }
+    beginResetModel();
+    _filter = _pendingFilter;
+    _visible = _filter.isEmpty() ? QVector<qint64>() : visible;
+    endResetModel();
+}
+
+void TraceModel::find( const QString & pattern, int after )
+{
+    qint64 from = after < 0 ? _first : absIndex( after ) + 1;
+    _findWatcher.setFuture( QtConcurrent::run( &TraceModel::findRow, _ring, from, _end, pattern ) );
+}
+
+void TraceModel::findFinished()
+{
+    qint64 abs = _findWatcher.result();
+    int row = -1;
+    if ( abs >= _first )
+    {
+        if ( _filter.isEmpty() )
+        {
+            row = abs - _first;
+        }
+        else
+        {
+            QVector<qint64>::const_iterator it = std::lower_bound( _visible.begin(), _visible.end(), abs );
+            if ( it != _visible.end() )
+                row = it - _visible.begin();
+        }
+    }
+    emit found( row );
+}
+
+qint64 TraceModel::absIndex( int row ) const
+{
+    return _filter.isEmpty() ? _first + row : _visible.value( row, _end );
+}
+
+bool TraceModel::matches( const TraceRow & r, const QString & pattern )
+{
+    return pattern.isEmpty() || r.text.contains( pattern, Qt::CaseInsensitive );
+}
+
+///Runs in background on a snapshot of the ring
+QVector<qint64> TraceModel::filterRows( QVector<TraceRow> ring, qint64 first, qint64 end, QString pattern )
+{
+    QVector<qint64> result;
+    if ( pattern.isEmpty() )
+        return result;
+    for ( qint64 i = first; i < end; ++i )
+    {
+        if ( matches( ring[ i % ring.size() ], pattern ) )
+            result.append( i );
+    }
+    return result;
+}
+
+///Runs in background on a snapshot of the ring
+qint64 TraceModel::findRow( QVector<TraceRow> ring, qint64 from, qint64 end, QString pattern )
+{
+    for ( qint64 i = from; i < end; ++i )
+    {
+        if ( matches( ring[ i % ring.size() ], pattern ) )
+            return i;
+    }
+    return -1;
+}
+
+int TraceModel::rowCount( const QModelIndex & parent ) const
+{
+    if ( parent.isValid() )
+        return 0;
+    return _filter.isEmpty() ? _end - _first : _visible.size();
+}
+
+int TraceModel::columnCount( const QModelIndex & parent ) const
+{
+    return parent.isValid() ? 0 : 4;
+}
+
+QVariant TraceModel::data( const QModelIndex & index, int role ) const
+{
+    if ( role != Qt::DisplayRole || !index.isValid() )
+        return QVariant();
+    qint64 abs = absIndex( index.row() );
+    if ( abs < _first || abs >= _end )
+        return QVariant();
+    const TraceRow & r = at( abs );
+    switch ( index.column() )
+    {
+    case 0:
+        return r.kind == TraceRow::Trace ? "TRC" : r.kind == TraceRow::Return ? "RET" : "ERROR";
+    case 1:
+        return r.kind == TraceRow::Trace ? QVariant( r.time ) : QVariant();
+    case 2:
+        return r.kind == TraceRow::Trace ? QVariant( QString("%1:%2").arg(r.thread).arg(r.seq) ) : QVariant();
+    default:
+        return r.text;
+    }
+}
+
+QVariant TraceModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+    if ( role != Qt::DisplayRole || orientation != Qt::Horizontal )
+        return QVariant();
+    static const char * names[] = { "Type", "Time [us]", "Thread:Seq", "Text" };
+    return section >= 0 && section < 4 ? QString( names[section] ) : QVariant();
+}
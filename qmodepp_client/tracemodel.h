@@ -0,0 +1,78 @@
+#ifndef TRACEMODEL_H
+#define TRACEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QVector>
+#include <QString>
+#include <QFutureWatcher>
+
+///Row of the trace-view
+struct TraceRow
+{
+    enum Kind { Trace, Return, Error };
+    Kind kind;
+    quint64 time;       ///<microseconds since first trace-record. 0 for other rows
+    quint32 thread;     ///<MoDe++ thread-id of trace-record
+    quint32 seq;        ///<sequence-nr of trace-record
+    QString text;
+};
+
+///Model of the trace-view. Keeps the newest rows in a bounded ring-buffer, older rows are dropped.
+///Rows are staged by add() and passed to views in one batch by commit(), which is called on timer-tick.
+///Rows are addressed by absolute index (count of rows added before), so a background filter or search
+///can work on a snapshot of the ring while new rows arrive.
+class TraceModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    TraceModel( int capacity, QObject * parent = 0 );
+
+    ///Stages row. It is shown after next commit
+    void add( const TraceRow & row );
+
+    ///Moves staged rows into the ring-buffer. Returns true if rows were added
+    bool commit();
+
+    void clear();
+
+    ///Shows only rows containing pattern. Matching runs in background, view is updated when it's done
+    void setFilter( const QString & pattern );
+
+    ///Searches in background for next row after given row containing pattern. Result is signaled by found
+    void find( const QString & pattern, int after );
+
+    int rowCount( const QModelIndex & parent = QModelIndex() ) const;
+    int columnCount( const QModelIndex & parent = QModelIndex() ) const;
+    QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const;
+    QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const;
+
+signals:
+    ///Row found by find. -1 if pattern was not found
+    void found( int row );
+
+private slots:
+    void filterFinished();
+    void findFinished();
+
+private:
+    const TraceRow & at( qint64 abs ) const { return _ring[ abs % _capacity ]; }
+    qint64 absIndex( int row ) const;
+    static bool matches( const TraceRow & r, const QString & pattern );
+    static QVector<qint64> filterRows( QVector<TraceRow> ring, qint64 first, qint64 end, QString pattern );
+    static qint64 findRow( QVector<TraceRow> ring, qint64 from, qint64 end, QString pattern );
+
+    QVector<TraceRow> _ring;        ///<rows, abs index i is stored at i % capacity
+    int _capacity;
+    qint64 _first;                  ///<abs index of oldest row
+    qint64 _end;                    ///<abs index after newest row
+    QVector<TraceRow> _staged;      ///<rows added since last commit
+
+    QString _filter;                ///<active filter. Empty if all rows are shown
+    QVector<qint64> _visible;       ///<abs indices of shown rows if filter is active
+    QString _pendingFilter;         ///<filter which is being applied in background
+    qint64 _pendingFilterEnd;       ///<end of the snapshot the pending filter works on
+    QFutureWatcher< QVector<qint64> > _filterWatcher;
+    QFutureWatcher< qint64 > _findWatcher;
+};
+
+#endif // TRACEMODEL_H